@@ -9,6 +9,7 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "shapemeshes.h"
+#include "GLStateCache.h"
 
 // GLM Math Header inclusions
 #include <glm/glm.hpp>
@@ -16,6 +17,9 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
 
 namespace
 {
@@ -24,11 +28,180 @@ namespace
 	const GLuint g_FloatsPerVertex = 3;	// Number of coordinates per vertex
 	const GLuint g_FloatsPerNormal = 3;	// Number of values per vertex color
 	const GLuint g_FloatsPerUV = 2;		// Number of texture coordinate values
+
+	// expand a GL_TRIANGLE_FAN range into triangle list indices
+	void AppendTriangleFan(std::vector<GLuint>& indices, GLuint first, GLuint count)
+	{
+		for (GLuint i = 1; i + 1 < count; i++)
+		{
+			indices.push_back(first);
+			indices.push_back(first + i);
+			indices.push_back(first + i + 1);
+		}
+	}
+
+	// expand a GL_TRIANGLE_STRIP range into triangle list indices,
+	// keeping the winding GL uses for odd triangles
+	void AppendTriangleStrip(std::vector<GLuint>& indices, GLuint first, GLuint count)
+	{
+		for (GLuint i = 0; i + 2 < count; i++)
+		{
+			GLuint a = first + i;
+			GLuint b = first + i + 1;
+			if (i % 2 == 1)
+			{
+				std::swap(a, b);
+			}
+			indices.push_back(a);
+			indices.push_back(b);
+			indices.push_back(first + i + 2);
+		}
+	}
+
+	// slices and stacks of the generated levels of detail 1 and
+	// 2; level 0 is the full mesh, 16x16 for the sphere and 36
+	// slices for the cylinder
+	const int g_SphereLodSlices[] = { 12, 8 };
+	const int g_SphereLodStacks[] = { 8, 5 };
+	const int g_CylinderLodSlices[] = { 16, 8 };
+
+	void AppendVertex(std::vector<GLfloat>& vertices, const glm::vec3& position, const glm::vec3& normal, float u, float v)
+	{
+		vertices.push_back(position.x);
+		vertices.push_back(position.y);
+		vertices.push_back(position.z);
+		vertices.push_back(normal.x);
+		vertices.push_back(normal.y);
+		vertices.push_back(normal.z);
+		vertices.push_back(u);
+		vertices.push_back(v);
+	}
+
+	// unit sphere as a triangle list; every ring repeats its first
+	// vertex so that the texture seam gets its own coordinates
+	void BuildSphereData(int slices, int stacks, ShapeMeshes::MeshData& data)
+	{
+		data.vertices.clear();
+		data.indices.clear();
+
+		for (int stack = 0; stack <= stacks; stack++)
+		{
+			float phi = static_cast<float>(M_PI) * stack / stacks;
+			float ringRadius = std::sin(phi);
+			for (int slice = 0; slice <= slices; slice++)
+			{
+				float theta = 2.0f * static_cast<float>(M_PI) * slice / slices;
+				glm::vec3 position(ringRadius * std::sin(theta), std::cos(phi), ringRadius * std::cos(theta));
+				AppendVertex(data.vertices, position, position, static_cast<float>(slice) / slices, 1.0f - static_cast<float>(stack) / stacks);
+			}
+		}
+
+		GLuint rowLength = static_cast<GLuint>(slices + 1);
+		for (int stack = 0; stack < stacks; stack++)
+		{
+			for (int slice = 0; slice < slices; slice++)
+			{
+				GLuint upper = stack * rowLength + slice;
+				GLuint lower = upper + rowLength;
+				// the pole rows collapse to a point, so they need one triangle per slice
+				if (stack != 0)
+				{
+					data.indices.push_back(upper);
+					data.indices.push_back(lower);
+					data.indices.push_back(upper + 1);
+				}
+				if (stack != stacks - 1)
+				{
+					data.indices.push_back(lower);
+					data.indices.push_back(lower + 1);
+					data.indices.push_back(upper + 1);
+				}
+			}
+		}
+	}
+
+	// unit-radius cylinder from y = 0 to y = 1 as a triangle list,
+	// laid out like the full mesh: bottom cap, top cap, then sides
+	void BuildCylinderData(int slices, ShapeMeshes::MeshData& data)
+	{
+		data.vertices.clear();
+		data.indices.clear();
+		const GLuint floatsPerVertex = g_FloatsPerVertex + g_FloatsPerNormal + g_FloatsPerUV;
+
+		for (int cap = 0; cap < 2; cap++)
+		{
+			float y = static_cast<float>(cap);
+			glm::vec3 normal(0.0f, (cap == 0) ? -1.0f : 1.0f, 0.0f);
+			GLuint center = static_cast<GLuint>(data.vertices.size() / floatsPerVertex);
+			AppendVertex(data.vertices, glm::vec3(0.0f, y, 0.0f), normal, 0.5f, 0.5f);
+			for (int slice = 0; slice < slices; slice++)
+			{
+				float theta = 2.0f * static_cast<float>(M_PI) * slice / slices;
+				float x = std::cos(theta);
+				float z = -std::sin(theta);
+				AppendVertex(data.vertices, glm::vec3(x, y, z), normal, 0.5f + 0.5f * x, 0.5f + 0.5f * z);
+			}
+			for (int slice = 0; slice < slices; slice++)
+			{
+				GLuint current = center + 1 + slice;
+				GLuint next = center + 1 + (slice + 1) % slices;
+				// both caps face outwards
+				data.indices.push_back(center);
+				data.indices.push_back((cap == 0) ? next : current);
+				data.indices.push_back((cap == 0) ? current : next);
+			}
+		}
+
+		GLuint first = static_cast<GLuint>(data.vertices.size() / floatsPerVertex);
+		for (int slice = 0; slice <= slices; slice++)
+		{
+			float theta = 2.0f * static_cast<float>(M_PI) * slice / slices;
+			glm::vec3 normal(std::cos(theta), 0.0f, -std::sin(theta));
+			float u = static_cast<float>(slice) / slices;
+			AppendVertex(data.vertices, glm::vec3(normal.x, 0.0f, normal.z), normal, u, 0.0f);
+			AppendVertex(data.vertices, glm::vec3(normal.x, 1.0f, normal.z), normal, u, 1.0f);
+		}
+		for (int slice = 0; slice < slices; slice++)
+		{
+			GLuint bottom = first + 2 * slice;
+			data.indices.push_back(bottom);
+			data.indices.push_back(bottom + 2);
+			data.indices.push_back(bottom + 1);
+			data.indices.push_back(bottom + 1);
+			data.indices.push_back(bottom + 2);
+			data.indices.push_back(bottom + 3);
+		}
+	}
 }
 
 ShapeMeshes::ShapeMeshes()
 {
 	m_bMemoryLayoutDone = false;
+	m_instanceVBO = 0;
+	m_instanceCapacity = 0;
+	m_sharedVAO = 0;
+	m_sharedVBOs[0] = 0;
+	m_sharedVBOs[1] = 0;
+	m_indirectBuffer = 0;
+	m_indirectCapacity = 0;
+	m_pStateCache = NULL;
+
+	// a zero VAO marks a mesh that has not been loaded
+	m_BoxMesh.vao = 0;
+	m_ConeMesh.vao = 0;
+	m_CylinderMesh.vao = 0;
+	m_PlaneMesh.vao = 0;
+	m_PrismMesh.vao = 0;
+	m_Pyramid3Mesh.vao = 0;
+	m_Pyramid4Mesh.vao = 0;
+	m_SphereMesh.vao = 0;
+	m_TaperedCylinderMesh.vao = 0;
+	m_TorusMesh.vao = 0;
+	for (int i = 0; i < LodCount - 1; i++)
+	{
+		m_SphereLods[i].vao = 0;
+		m_CylinderLods[i].vao = 0;
+	}
 }
 
 ///////////////////////////////////////////////////
@@ -105,8 +278,12 @@ void ShapeMeshes::LoadBoxMesh()
 	m_BoxMesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (g_FloatsPerVertex + g_FloatsPerNormal + g_FloatsPerUV));
 	m_BoxMesh.nIndices = sizeof(indices) / sizeof(indices[0]);
 
+	// keep a CPU copy for baking static geometry
+	m_BoxData.vertices.assign(verts, verts + sizeof(verts) / sizeof(verts[0]));
+	m_BoxData.indices.assign(indices, indices + m_BoxMesh.nIndices);
+
 	glGenVertexArrays(1, &m_BoxMesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(m_BoxMesh.vao);
+	BindVertexArray(m_BoxMesh.vao);
 
 	// Create 2 buffers: first one for the vertex data; second one for the indices
 	glGenBuffers(2, m_BoxMesh.vbos);
@@ -293,7 +470,7 @@ void ShapeMeshes::LoadConeMesh()
 
 	// Create VAO
 	glGenVertexArrays(1, &m_ConeMesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(m_ConeMesh.vao);
+	BindVertexArray(m_ConeMesh.vao);
 
 	// Create VBO
 	glGenBuffers(1, m_ConeMesh.vbos);
@@ -555,9 +732,17 @@ void ShapeMeshes::LoadCylinderMesh()
 	m_CylinderMesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (g_FloatsPerVertex + g_FloatsPerNormal + g_FloatsPerUV));
 	m_CylinderMesh.nIndices = 0;
 
+	// keep a CPU copy for baking static geometry, with the
+	// fans and strip from DrawCylinderMesh() as a triangle list
+	m_CylinderData.vertices.assign(verts, verts + sizeof(verts) / sizeof(verts[0]));
+	m_CylinderData.indices.clear();
+	AppendTriangleFan(m_CylinderData.indices, 0, 36);
+	AppendTriangleFan(m_CylinderData.indices, 36, 36);
+	AppendTriangleStrip(m_CylinderData.indices, 72, std::min<GLuint>(146, m_CylinderMesh.nVertices - 72));
+
 	// Create VAO
 	glGenVertexArrays(1, &m_CylinderMesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(m_CylinderMesh.vao);
+	BindVertexArray(m_CylinderMesh.vao);
 
 	// Create VBO
 	glGenBuffers(1, m_CylinderMesh.vbos);
@@ -568,6 +753,13 @@ void ShapeMeshes::LoadCylinderMesh()
 	{
 		SetShaderMemoryLayout();
 	}
+
+	// coarser levels of detail with fewer slices
+	for (int i = 0; i < LodCount - 1; i++)
+	{
+		BuildCylinderData(g_CylinderLodSlices[i], m_CylinderLodData[i]);
+		LoadLodMesh(m_CylinderLodData[i], m_CylinderLods[i]);
+	}
 }
 
 ///////////////////////////////////////////////////
@@ -602,9 +794,13 @@ void ShapeMeshes::LoadPlaneMesh()
 	m_PlaneMesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (g_FloatsPerVertex + g_FloatsPerNormal + g_FloatsPerUV));
 	m_PlaneMesh.nIndices = sizeof(indices) / sizeof(indices[0]);
 
+	// keep a CPU copy for baking static geometry
+	m_PlaneData.vertices.assign(verts, verts + sizeof(verts) / sizeof(verts[0]));
+	m_PlaneData.indices.assign(indices, indices + m_PlaneMesh.nIndices);
+
 	// Generate the VAO for the mesh
 	glGenVertexArrays(1, &m_PlaneMesh.vao);
-	glBindVertexArray(m_PlaneMesh.vao);	// activate the VAO
+	BindVertexArray(m_PlaneMesh.vao);	// activate the VAO
 
 	// Create VBOs for the mesh
 	glGenBuffers(2, m_PlaneMesh.vbos);
@@ -685,7 +881,7 @@ void ShapeMeshes::LoadPrismMesh()
 	m_PrismMesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (g_FloatsPerVertex + g_FloatsPerNormal + g_FloatsPerUV));
 
 	glGenVertexArrays(1, &m_PrismMesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(m_PrismMesh.vao);
+	BindVertexArray(m_PrismMesh.vao);
 
 	// Create 2 buffers: first one for the vertex data; second one for the indices
 	glGenBuffers(1, m_PrismMesh.vbos);
@@ -741,7 +937,7 @@ void ShapeMeshes::LoadPyramid3Mesh()
 
 	glGenVertexArrays(1, &m_Pyramid3Mesh.vao);				// Creates 1 VAO
 	glGenBuffers(1, m_Pyramid3Mesh.vbos);					// Creates 1 VBO
-	glBindVertexArray(m_Pyramid3Mesh.vao);					// Activates the VAO
+	BindVertexArray(m_Pyramid3Mesh.vao);					// Activates the VAO
 	glBindBuffer(GL_ARRAY_BUFFER, m_Pyramid3Mesh.vbos[0]);	// Activates the VBO
 	// Sends vertex or coordinate data to the GPU
 	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
@@ -802,9 +998,14 @@ void ShapeMeshes::LoadPyramid4Mesh()
 	// Calculate total defined vertices
 	m_Pyramid4Mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (g_FloatsPerVertex + g_FloatsPerNormal + g_FloatsPerUV));
 
+	// keep a CPU copy for baking static geometry
+	m_Pyramid4Data.vertices.assign(verts, verts + sizeof(verts) / sizeof(verts[0]));
+	m_Pyramid4Data.indices.clear();
+	AppendTriangleStrip(m_Pyramid4Data.indices, 0, m_Pyramid4Mesh.nVertices);
+
 	glGenVertexArrays(1, &m_Pyramid4Mesh.vao);				// Creates 1 VAO
 	glGenBuffers(1, m_Pyramid4Mesh.vbos);					// Creates 1 VBO
-	glBindVertexArray(m_Pyramid4Mesh.vao);					// Activates the VAO
+	BindVertexArray(m_Pyramid4Mesh.vao);					// Activates the VAO
 	glBindBuffer(GL_ARRAY_BUFFER, m_Pyramid4Mesh.vbos[0]);	// Activates the VBO
 	// Sends vertex or coordinate data to the GPU
 	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
@@ -1683,9 +1884,13 @@ void ShapeMeshes::LoadSphereMesh()
 		combined_values.push_back(verts[i + 4]);
 	}
 
+	// keep a CPU copy for baking static geometry
+	m_SphereData.vertices = combined_values;
+	m_SphereData.indices.assign(indices, indices + m_SphereMesh.nIndices);
+
 	// Create VAO
 	glGenVertexArrays(1, &m_SphereMesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(m_SphereMesh.vao);
+	BindVertexArray(m_SphereMesh.vao);
 
 	// Create VBOs
 	glGenBuffers(2, m_SphereMesh.vbos);
@@ -1699,6 +1904,13 @@ void ShapeMeshes::LoadSphereMesh()
 	{
 		SetShaderMemoryLayout();
 	}
+
+	// coarser levels of detail with fewer slices and stacks
+	for (int i = 0; i < LodCount - 1; i++)
+	{
+		BuildSphereData(g_SphereLodSlices[i], g_SphereLodStacks[i], m_SphereLodData[i]);
+		LoadLodMesh(m_SphereLodData[i], m_SphereLods[i]);
+	}
 }
 
 ///////////////////////////////////////////////////
@@ -1948,7 +2160,7 @@ void ShapeMeshes::LoadTaperedCylinderMesh()
 
 	// Create VAO
 	glGenVertexArrays(1, &m_TaperedCylinderMesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(m_TaperedCylinderMesh.vao);
+	BindVertexArray(m_TaperedCylinderMesh.vao);
 
 	// Create VBO
 	glGenBuffers(1, m_TaperedCylinderMesh.vbos);
@@ -2171,7 +2383,7 @@ void ShapeMeshes::LoadTorusMesh(float thickness)
 
 	// Create VAO
 	glGenVertexArrays(1, &m_TorusMesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(m_TorusMesh.vao);
+	BindVertexArray(m_TorusMesh.vao);
 
 	// Create VBOs
 	glGenBuffers(1, m_TorusMesh.vbos);
@@ -2194,11 +2406,11 @@ void ShapeMeshes::LoadTorusMesh(float thickness)
 ///////////////////////////////////////////////////
 void ShapeMeshes::DrawBoxMesh()
 {
-	glBindVertexArray(m_BoxMesh.vao);
+	BindVertexArray(m_BoxMesh.vao);
 
 	glDrawElements(GL_TRIANGLES, m_BoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
 
-	glBindVertexArray(0);
+	ReleaseVertexArray();
 }
 
 ///////////////////////////////////////////////////
@@ -2210,7 +2422,7 @@ void ShapeMeshes::DrawBoxMesh()
 void ShapeMeshes::DrawConeMesh(
 	bool bDrawBottom)
 {
-	glBindVertexArray(m_ConeMesh.vao);
+	BindVertexArray(m_ConeMesh.vao);
 
 	if (bDrawBottom == true)
 	{
@@ -2218,7 +2430,7 @@ void ShapeMeshes::DrawConeMesh(
 	}
 	glDrawArrays(GL_TRIANGLE_STRIP, 36, 108);	//sides
 
-	glBindVertexArray(0);
+	ReleaseVertexArray();
 }
 
 ///////////////////////////////////////////////////
@@ -2232,7 +2444,7 @@ void ShapeMeshes::DrawCylinderMesh(
 	bool bDrawBottom,
 	bool bDrawSides)
 {
-	glBindVertexArray(m_CylinderMesh.vao);
+	BindVertexArray(m_CylinderMesh.vao);
 
 	if (bDrawBottom == true)
 	{
@@ -2247,7 +2459,7 @@ void ShapeMeshes::DrawCylinderMesh(
 		glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
 	}
 
-	glBindVertexArray(0);
+	ReleaseVertexArray();
 }
 
 ///////////////////////////////////////////////////
@@ -2258,11 +2470,11 @@ void ShapeMeshes::DrawCylinderMesh(
 ///////////////////////////////////////////////////
 void ShapeMeshes::DrawPlaneMesh()
 {
-	glBindVertexArray(m_PlaneMesh.vao);
+	BindVertexArray(m_PlaneMesh.vao);
 
 	glDrawElements(GL_TRIANGLES, m_PlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
 	
-	glBindVertexArray(0);
+	ReleaseVertexArray();
 }
 
 ///////////////////////////////////////////////////
@@ -2273,11 +2485,11 @@ void ShapeMeshes::DrawPlaneMesh()
 ///////////////////////////////////////////////////
 void ShapeMeshes::DrawPrismMesh()
 {
-	glBindVertexArray(m_PrismMesh.vao);
+	BindVertexArray(m_PrismMesh.vao);
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, m_PrismMesh.nVertices);
 
-	glBindVertexArray(0);
+	ReleaseVertexArray();
 }
 
 ///////////////////////////////////////////////////
@@ -2288,11 +2500,11 @@ void ShapeMeshes::DrawPrismMesh()
 ///////////////////////////////////////////////////
 void ShapeMeshes::DrawPyramid3Mesh()
 {
-	glBindVertexArray(m_Pyramid3Mesh.vao);
+	BindVertexArray(m_Pyramid3Mesh.vao);
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, m_Pyramid3Mesh.nVertices);
 
-	glBindVertexArray(0);
+	ReleaseVertexArray();
 }
 
 ///////////////////////////////////////////////////
@@ -2303,11 +2515,11 @@ void ShapeMeshes::DrawPyramid3Mesh()
 ///////////////////////////////////////////////////
 void ShapeMeshes::DrawPyramid4Mesh()
 {
-	glBindVertexArray(m_Pyramid4Mesh.vao);
+	BindVertexArray(m_Pyramid4Mesh.vao);
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, m_Pyramid4Mesh.nVertices);
 
-	glBindVertexArray(0);
+	ReleaseVertexArray();
 }
 
 ///////////////////////////////////////////////////
@@ -2318,11 +2530,11 @@ void ShapeMeshes::DrawPyramid4Mesh()
 ///////////////////////////////////////////////////
 void ShapeMeshes::DrawSphereMesh()
 {
-	glBindVertexArray(m_SphereMesh.vao);
+	BindVertexArray(m_SphereMesh.vao);
 
 	glDrawElements(GL_TRIANGLES, m_SphereMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
 
-	glBindVertexArray(0);
+	ReleaseVertexArray();
 }
 
 ///////////////////////////////////////////////////
@@ -2333,11 +2545,11 @@ void ShapeMeshes::DrawSphereMesh()
 ///////////////////////////////////////////////////
 void ShapeMeshes::DrawHalfSphereMesh()
 {
-	glBindVertexArray(m_SphereMesh.vao);
+	BindVertexArray(m_SphereMesh.vao);
 
 	glDrawElements(GL_TRIANGLES, m_SphereMesh.nIndices/2, GL_UNSIGNED_INT, (void*)0);
 
-	glBindVertexArray(0);
+	ReleaseVertexArray();
 }
 
 ///////////////////////////////////////////////////
@@ -2351,7 +2563,7 @@ void ShapeMeshes::DrawTaperedCylinderMesh(
 	bool bDrawBottom,
 	bool bDrawSides)
 {
-	glBindVertexArray(m_TaperedCylinderMesh.vao);
+	BindVertexArray(m_TaperedCylinderMesh.vao);
 
 	if (bDrawBottom == true)
 	{
@@ -2366,7 +2578,7 @@ void ShapeMeshes::DrawTaperedCylinderMesh(
 		glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
 	}
 
-	glBindVertexArray(0);
+	ReleaseVertexArray();
 }
 
 ///////////////////////////////////////////////////
@@ -2377,11 +2589,11 @@ void ShapeMeshes::DrawTaperedCylinderMesh(
 ///////////////////////////////////////////////////
 void ShapeMeshes::DrawTorusMesh()
 {
-	glBindVertexArray(m_TorusMesh.vao);
+	BindVertexArray(m_TorusMesh.vao);
 
 	glDrawArrays(GL_TRIANGLES, 0, m_TorusMesh.nVertices);
 
-	glBindVertexArray(0);
+	ReleaseVertexArray();
 }
 
 ///////////////////////////////////////////////////
@@ -2392,11 +2604,347 @@ void ShapeMeshes::DrawTorusMesh()
 ///////////////////////////////////////////////////
 void ShapeMeshes::DrawHalfTorusMesh()
 {
-	glBindVertexArray(m_TorusMesh.vao);
+	BindVertexArray(m_TorusMesh.vao);
 
 	glDrawArrays(GL_TRIANGLES, 0, m_TorusMesh.nVertices/2);
 
-	glBindVertexArray(0);
+	ReleaseVertexArray();
+}
+
+///////////////////////////////////////////////////
+//	UploadInstanceData()
+//
+//	Copy the per-instance records used by the 
+//  instanced draw methods into the instance buffer.
+//  The buffer grows as needed and is shared by all
+//  of the meshes.
+///////////////////////////////////////////////////
+void ShapeMeshes::UploadInstanceData(const InstanceData* instances, GLsizei count)
+{
+	GLsizeiptr size = sizeof(InstanceData) * count;
+
+	if (m_instanceVBO == 0)
+	{
+		glGenBuffers(1, &m_instanceVBO);
+
+		// the instance attributes only need to be attached
+		// to each loaded mesh once
+		std::vector<GLMesh*> meshes = { &m_BoxMesh, &m_CylinderMesh, &m_PlaneMesh, &m_Pyramid4Mesh, &m_SphereMesh };
+		for (int i = 0; i < LodCount - 1; i++)
+		{
+			meshes.push_back(&m_SphereLods[i]);
+			meshes.push_back(&m_CylinderLods[i]);
+		}
+		for (GLMesh* mesh : meshes)
+		{
+			if (mesh->vao != 0)
+			{
+				SetInstanceMemoryLayout(mesh->vao);
+			}
+		}
+		if (m_sharedVAO != 0)
+		{
+			SetInstanceMemoryLayout(m_sharedVAO);
+		}
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_instanceVBO);
+	if (size > m_instanceCapacity)
+	{
+		// grow with headroom so that slowly growing scenes
+		// do not reallocate every frame
+		m_instanceCapacity = size + size / 2;
+		glBufferData(GL_ARRAY_BUFFER, m_instanceCapacity, NULL, GL_STREAM_DRAW);
+	}
+	glBufferSubData(GL_ARRAY_BUFFER, 0, size, instances);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+///////////////////////////////////////////////////
+//	DrawBoxMeshInstanced()
+//
+//	Draw copies of the box mesh, one per instance
+//  record.
+///////////////////////////////////////////////////
+void ShapeMeshes::DrawBoxMeshInstanced(GLsizei instanceCount, GLuint baseInstance)
+{
+	BindVertexArray(m_BoxMesh.vao);
+
+	glDrawElementsInstancedBaseInstance(GL_TRIANGLES, m_BoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0, instanceCount, baseInstance);
+
+	ReleaseVertexArray();
+}
+
+///////////////////////////////////////////////////
+//	DrawCylinderMeshInstanced()
+//
+//	Draw copies of the cylinder mesh, one per 
+//  instance record.
+///////////////////////////////////////////////////
+void ShapeMeshes::DrawCylinderMeshInstanced(GLsizei instanceCount, GLuint baseInstance)
+{
+	BindVertexArray(m_CylinderMesh.vao);
+
+	glDrawArraysInstancedBaseInstance(GL_TRIANGLE_FAN, 0, 36, instanceCount, baseInstance);		//bottom
+	glDrawArraysInstancedBaseInstance(GL_TRIANGLE_FAN, 36, 36, instanceCount, baseInstance);	//top
+	glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 72, 146, instanceCount, baseInstance);	//sides
+
+	ReleaseVertexArray();
+}
+
+///////////////////////////////////////////////////
+//	DrawPlaneMeshInstanced()
+//
+//	Draw copies of the plane mesh, one per instance
+//  record.
+///////////////////////////////////////////////////
+void ShapeMeshes::DrawPlaneMeshInstanced(GLsizei instanceCount, GLuint baseInstance)
+{
+	BindVertexArray(m_PlaneMesh.vao);
+
+	glDrawElementsInstancedBaseInstance(GL_TRIANGLES, m_PlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0, instanceCount, baseInstance);
+
+	ReleaseVertexArray();
+}
+
+///////////////////////////////////////////////////
+//	DrawPyramid4MeshInstanced()
+//
+//	Draw copies of the four-sided pyramid mesh, one 
+//  per instance record.
+///////////////////////////////////////////////////
+void ShapeMeshes::DrawPyramid4MeshInstanced(GLsizei instanceCount, GLuint baseInstance)
+{
+	BindVertexArray(m_Pyramid4Mesh.vao);
+
+	glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, m_Pyramid4Mesh.nVertices, instanceCount, baseInstance);
+
+	ReleaseVertexArray();
+}
+
+///////////////////////////////////////////////////
+//	DrawSphereMeshInstanced()
+//
+//	Draw copies of the sphere mesh, one per instance
+//  record.
+///////////////////////////////////////////////////
+void ShapeMeshes::DrawSphereMeshInstanced(GLsizei instanceCount, GLuint baseInstance)
+{
+	BindVertexArray(m_SphereMesh.vao);
+
+	glDrawElementsInstancedBaseInstance(GL_TRIANGLES, m_SphereMesh.nIndices, GL_UNSIGNED_INT, (void*)0, instanceCount, baseInstance);
+
+	ReleaseVertexArray();
+}
+
+///////////////////////////////////////////////////
+//	DrawMeshLod()
+//
+//	Draw a shared mesh at a level of detail. Level
+//  0, and every level of a mesh without a chain of
+//  coarser levels, draws the full mesh.
+///////////////////////////////////////////////////
+void ShapeMeshes::DrawMeshLod(SharedMesh mesh, int lod)
+{
+	if (lod <= 0 || HasLodChain(mesh) == false)
+	{
+		switch (mesh)
+		{
+		case SharedMesh::Box: DrawBoxMesh(); break;
+		case SharedMesh::Cylinder: DrawCylinderMesh(); break;
+		case SharedMesh::Plane: DrawPlaneMesh(); break;
+		case SharedMesh::Pyramid4: DrawPyramid4Mesh(); break;
+		case SharedMesh::Sphere: DrawSphereMesh(); break;
+		default: break;
+		}
+		return;
+	}
+
+	GLMesh& lodMesh = (mesh == SharedMesh::Sphere) ? m_SphereLods[std::min(lod, LodCount - 1) - 1] : m_CylinderLods[std::min(lod, LodCount - 1) - 1];
+	BindVertexArray(lodMesh.vao);
+
+	glDrawElements(GL_TRIANGLES, lodMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+
+	ReleaseVertexArray();
+}
+
+///////////////////////////////////////////////////
+//	DrawMeshLodInstanced()
+//
+//	Draw copies of a shared mesh at a level of 
+//  detail, one per instance record.
+///////////////////////////////////////////////////
+void ShapeMeshes::DrawMeshLodInstanced(SharedMesh mesh, int lod, GLsizei instanceCount, GLuint baseInstance)
+{
+	if (lod <= 0 || HasLodChain(mesh) == false)
+	{
+		switch (mesh)
+		{
+		case SharedMesh::Box: DrawBoxMeshInstanced(instanceCount, baseInstance); break;
+		case SharedMesh::Cylinder: DrawCylinderMeshInstanced(instanceCount, baseInstance); break;
+		case SharedMesh::Plane: DrawPlaneMeshInstanced(instanceCount, baseInstance); break;
+		case SharedMesh::Pyramid4: DrawPyramid4MeshInstanced(instanceCount, baseInstance); break;
+		case SharedMesh::Sphere: DrawSphereMeshInstanced(instanceCount, baseInstance); break;
+		default: break;
+		}
+		return;
+	}
+
+	GLMesh& lodMesh = (mesh == SharedMesh::Sphere) ? m_SphereLods[std::min(lod, LodCount - 1) - 1] : m_CylinderLods[std::min(lod, LodCount - 1) - 1];
+	BindVertexArray(lodMesh.vao);
+
+	glDrawElementsInstancedBaseInstance(GL_TRIANGLES, lodMesh.nIndices, GL_UNSIGNED_INT, (void*)0, instanceCount, baseInstance);
+
+	ReleaseVertexArray();
+}
+
+///////////////////////////////////////////////////
+//	GetMeshData()
+//
+//	Return the CPU copy of a shared mesh at a level
+//  of detail.
+///////////////////////////////////////////////////
+const ShapeMeshes::MeshData& ShapeMeshes::GetMeshData(SharedMesh mesh, int lod) const
+{
+	if (lod > 0 && HasLodChain(mesh) == true)
+	{
+		int level = std::min(lod, LodCount - 1) - 1;
+		return (mesh == SharedMesh::Sphere) ? m_SphereLodData[level] : m_CylinderLodData[level];
+	}
+
+	switch (mesh)
+	{
+	case SharedMesh::Box: return m_BoxData;
+	case SharedMesh::Cylinder: return m_CylinderData;
+	case SharedMesh::Plane: return m_PlaneData;
+	case SharedMesh::Pyramid4: return m_Pyramid4Data;
+	default: return m_SphereData;
+	}
+}
+
+///////////////////////////////////////////////////
+//	GetTriangleCount()
+//
+//	Return how many triangles a shared mesh draws at
+//  a level of detail.
+///////////////////////////////////////////////////
+GLuint ShapeMeshes::GetTriangleCount(SharedMesh mesh, int lod) const
+{
+	return static_cast<GLuint>(GetMeshData(mesh, lod).indices.size() / 3);
+}
+
+///////////////////////////////////////////////////
+//	BuildSharedMeshBuffer()
+//
+//	Pack the indexed copies of the box, cylinder, 
+//  plane, pyramid and sphere meshes into a single 
+//  vertex buffer and index buffer. Each mesh keeps
+//  its own indices and is located by its first 
+//  index and base vertex, so switching between 
+//  them needs no VAO bind. The coarser levels of
+//  detail are packed after the full meshes; meshes
+//  without them point every level at the full mesh.
+//  Meshes that were not loaded are left empty.
+///////////////////////////////////////////////////
+void ShapeMeshes::BuildSharedMeshBuffer()
+{
+	const GLuint floatsPerVertex = g_FloatsPerVertex + g_FloatsPerNormal + g_FloatsPerUV;
+
+	std::vector<GLfloat> vertices;
+	std::vector<GLuint> indices;
+	for (int i = 0; i < static_cast<int>(SharedMesh::Count); i++)
+	{
+		SharedMesh mesh = static_cast<SharedMesh>(i);
+		for (int lod = 0; lod < LodCount; lod++)
+		{
+			if (lod > 0 && HasLodChain(mesh) == false)
+			{
+				m_sharedRanges[i][lod] = m_sharedRanges[i][0];
+				continue;
+			}
+			const MeshData& meshData = GetMeshData(mesh, lod);
+			m_sharedRanges[i][lod].firstIndex = static_cast<GLuint>(indices.size());
+			m_sharedRanges[i][lod].nIndices = static_cast<GLuint>(meshData.indices.size());
+			m_sharedRanges[i][lod].baseVertex = static_cast<GLint>(vertices.size() / floatsPerVertex);
+
+			vertices.insert(vertices.end(), meshData.vertices.begin(), meshData.vertices.end());
+			indices.insert(indices.end(), meshData.indices.begin(), meshData.indices.end());
+		}
+	}
+
+	if (m_sharedVAO == 0)
+	{
+		glGenVertexArrays(1, &m_sharedVAO);
+		glGenBuffers(2, m_sharedVBOs);
+	}
+	BindVertexArray(m_sharedVAO);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_sharedVBOs[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_sharedVBOs[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), indices.data(), GL_STATIC_DRAW);
+
+	SetShaderMemoryLayout();
+
+	BindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	if (m_instanceVBO != 0)
+	{
+		SetInstanceMemoryLayout(m_sharedVAO);
+	}
+}
+
+///////////////////////////////////////////////////
+//	GetSharedMeshCommand()
+//
+//	Build the indirect draw command for instances
+//  [baseInstance, baseInstance + instanceCount) of
+//  a mesh in the shared mesh buffer, at a level of
+//  detail.
+///////////////////////////////////////////////////
+ShapeMeshes::DrawElementsIndirectCommand ShapeMeshes::GetSharedMeshCommand(SharedMesh mesh, GLuint instanceCount, GLuint baseInstance, int lod) const
+{
+	const SharedRange& range = m_sharedRanges[static_cast<int>(mesh)][std::max(0, std::min(lod, LodCount - 1))];
+
+	DrawElementsIndirectCommand command;
+	command.count = range.nIndices;
+	command.instanceCount = instanceCount;
+	command.firstIndex = range.firstIndex;
+	command.baseVertex = range.baseVertex;
+	command.baseInstance = baseInstance;
+	return command;
+}
+
+///////////////////////////////////////////////////
+//	MultiDrawSharedMeshes()
+//
+//	Copy the draw commands into the indirect buffer
+//  and issue all of them with one call.
+///////////////////////////////////////////////////
+void ShapeMeshes::MultiDrawSharedMeshes(const DrawElementsIndirectCommand* commands, GLsizei count)
+{
+	GLsizeiptr size = sizeof(DrawElementsIndirectCommand) * count;
+
+	if (m_indirectBuffer == 0)
+	{
+		glGenBuffers(1, &m_indirectBuffer);
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+	if (size > m_indirectCapacity)
+	{
+		m_indirectCapacity = size;
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, m_indirectCapacity, NULL, GL_STREAM_DRAW);
+	}
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, size, commands);
+
+	BindVertexArray(m_sharedVAO);
+
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0, count, 0);
+
+	ReleaseVertexArray();
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 }
 
 glm::vec3 ShapeMeshes::CalculateTriangleNormal(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2)
@@ -2443,4 +2991,110 @@ void ShapeMeshes::SetShaderMemoryLayout()
 
 	glVertexAttribPointer(2, g_FloatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (g_FloatsPerVertex + g_FloatsPerNormal)));
 	glEnableVertexAttribArray(2);
-}
\ No newline at end of file
+}
+
+///////////////////////////////////////////////////
+//	LoadLodMesh()
+//
+//	Send a generated level of detail, already an
+//  indexed triangle list, to its own VAO/VBOs.
+///////////////////////////////////////////////////
+void ShapeMeshes::LoadLodMesh(const MeshData& data, GLMesh& mesh)
+{
+	const GLuint floatsPerVertex = g_FloatsPerVertex + g_FloatsPerNormal + g_FloatsPerUV;
+	mesh.nVertices = static_cast<GLuint>(data.vertices.size() / floatsPerVertex);
+	mesh.nIndices = static_cast<GLuint>(data.indices.size());
+
+	glGenVertexArrays(1, &mesh.vao);
+	BindVertexArray(mesh.vao);
+
+	glGenBuffers(2, mesh.vbos);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * data.vertices.size(), data.vertices.data(), GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * data.indices.size(), data.indices.data(), GL_STATIC_DRAW);
+
+	SetShaderMemoryLayout();
+
+	// the instance attributes are attached to every loaded mesh
+	// on the first upload, so a mesh loaded later needs its own
+	if (m_instanceVBO != 0)
+	{
+		SetInstanceMemoryLayout(mesh.vao);
+	}
+}
+
+void ShapeMeshes::SetInstanceMemoryLayout(GLuint vao)
+{
+	// Per-instance attributes, advancing once per instance instead of per vertex:
+	// model matrix in locations 3-6, normal matrix in 7-9, selector indices in 10
+	GLsizei stride = sizeof(InstanceData);
+
+	BindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, m_instanceVBO);
+
+	for (GLuint column = 0; column < 4; column++)
+	{
+		glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, stride, (void*)(offsetof(InstanceData, model) + sizeof(glm::vec4) * column));
+		glEnableVertexAttribArray(3 + column);
+		glVertexAttribDivisor(3 + column, 1);
+	}
+	for (GLuint column = 0; column < 3; column++)
+	{
+		glVertexAttribPointer(7 + column, 3, GL_FLOAT, GL_FALSE, stride, (void*)(offsetof(InstanceData, normalMatrix) + sizeof(glm::vec3) * column));
+		glEnableVertexAttribArray(7 + column);
+		glVertexAttribDivisor(7 + column, 1);
+	}
+	glVertexAttribIPointer(10, 4, GL_INT, stride, (void*)offsetof(InstanceData, textureIndex));
+	glEnableVertexAttribArray(10);
+	glVertexAttribDivisor(10, 1);
+
+	BindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+///////////////////////////////////////////////////
+//	SetStateCache()
+//
+//	Route the vertex array binds of every draw
+//  through a state cache, or pass NULL to bind
+//  directly again.
+///////////////////////////////////////////////////
+void ShapeMeshes::SetStateCache(GLStateCache* pStateCache)
+{
+	m_pStateCache = pStateCache;
+}
+
+///////////////////////////////////////////////////
+//	BindVertexArray()
+//
+//	Bind a vertex array, skipping the call when the
+//  state cache already has it bound.
+///////////////////////////////////////////////////
+void ShapeMeshes::BindVertexArray(GLuint vao)
+{
+	if (NULL != m_pStateCache)
+	{
+		m_pStateCache->BindVertexArray(vao);
+	}
+	else
+	{
+		glBindVertexArray(vao);
+	}
+}
+
+///////////////////////////////////////////////////
+//	ReleaseVertexArray()
+//
+//	Unbind the vertex array after a draw. With a
+//  state cache the VAO stays bound, since the next
+//  draw binds its own and repeats of the same mesh
+//  then cost no bind at all.
+///////////////////////////////////////////////////
+void ShapeMeshes::ReleaseVertexArray()
+{
+	if (NULL == m_pStateCache)
+	{
+		glBindVertexArray(0);
+	}
+}
@@ -14,6 +14,10 @@
 
 #include <glm/glm.hpp>
 
+#include <vector>
+
+class GLStateCache;
+
 /***********************************************************
  *  ShapeMeshes
  *
@@ -26,6 +30,53 @@ public:
 	// constructor
 	ShapeMeshes();
 
+	// CPU copy of a loaded mesh as an indexed triangle list, using the
+	// same interleaved layout as the GPU buffers (position, normal, uv)
+	struct MeshData
+	{
+		std::vector<GLfloat> vertices;
+		std::vector<GLuint> indices;
+	};
+
+	// per-instance record read by vertex_instanced.glsl
+	struct InstanceData
+	{
+		glm::mat4 model;
+		glm::mat3 normalMatrix;
+		GLint textureIndex;		// value of the shader's texture selector
+		GLint materialIndex;
+		GLint highlight;
+		GLint padding;
+	};
+
+	// command record read by glMultiDrawElementsIndirect
+	struct DrawElementsIndirectCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	// the meshes packed into the shared mesh buffer
+	enum class SharedMesh
+	{
+		Box,
+		Cylinder,
+		Plane,
+		Pyramid4,
+		Sphere,
+		Count
+	};
+
+	// levels of detail per shared mesh; level 0 is the full
+	// mesh and each further level is coarser
+	static const int LodCount = 3;
+	// only the curved meshes have coarser levels, the others
+	// draw their full mesh at every level
+	static bool HasLodChain(SharedMesh mesh) { return mesh == SharedMesh::Sphere || mesh == SharedMesh::Cylinder; }
+
 private:
 
 	// stores the GL data relative to a given mesh
@@ -49,8 +100,47 @@ private:
 	GLMesh m_TaperedCylinderMesh;
 	GLMesh m_TorusMesh;
 
+	// CPU copies kept for baking static geometry
+	MeshData m_BoxData;
+	MeshData m_CylinderData;
+	MeshData m_PlaneData;
+	MeshData m_Pyramid4Data;
+	MeshData m_SphereData;
+
+	// coarser levels 1 to LodCount - 1 of the curved meshes,
+	// generated when the full mesh is loaded
+	GLMesh m_SphereLods[LodCount - 1];
+	GLMesh m_CylinderLods[LodCount - 1];
+	MeshData m_SphereLodData[LodCount - 1];
+	MeshData m_CylinderLodData[LodCount - 1];
+
 	bool m_bMemoryLayoutDone;
 
+	// shared buffer of per-instance records for the instanced draws
+	GLuint m_instanceVBO;
+	GLsizeiptr m_instanceCapacity;
+
+	// where a mesh sits inside the shared mesh buffer
+	struct SharedRange
+	{
+		GLuint firstIndex;
+		GLuint nIndices;
+		GLint baseVertex;
+	};
+
+	// one vertex buffer and one index buffer holding every
+	// mesh in SharedMesh, drawn through a single VAO
+	GLuint m_sharedVAO;
+	GLuint m_sharedVBOs[2];
+	SharedRange m_sharedRanges[static_cast<int>(SharedMesh::Count)][LodCount];
+
+	// command buffer for the multi-draw indirect calls
+	GLuint m_indirectBuffer;
+	GLsizeiptr m_indirectCapacity;
+
+	// optional cache the vertex array binds go through
+	GLStateCache* m_pStateCache;
+
 public:
 	// methods for loading the shape mesh data 
 	// into memory
@@ -87,6 +177,51 @@ public:
 	void DrawTorusMesh();
 	void DrawHalfTorusMesh();
 
+	// copy per-instance records into the shared instance buffer
+	void UploadInstanceData(const InstanceData* instances, GLsizei count);
+
+	// methods for drawing many copies of a shape mesh in one
+	// call, reading instances [baseInstance, baseInstance + 
+	// instanceCount) from the uploaded instance data
+	void DrawBoxMeshInstanced(GLsizei instanceCount, GLuint baseInstance = 0);
+	void DrawCylinderMeshInstanced(GLsizei instanceCount, GLuint baseInstance = 0);
+	void DrawPlaneMeshInstanced(GLsizei instanceCount, GLuint baseInstance = 0);
+	void DrawPyramid4MeshInstanced(GLsizei instanceCount, GLuint baseInstance = 0);
+	void DrawSphereMeshInstanced(GLsizei instanceCount, GLuint baseInstance = 0);
+
+	// methods for drawing a shared mesh at a level of detail,
+	// once or instanced; level 0 is the same as the matching
+	// DrawXMesh() and DrawXMeshInstanced() calls
+	void DrawMeshLod(SharedMesh mesh, int lod);
+	void DrawMeshLodInstanced(SharedMesh mesh, int lod, GLsizei instanceCount, GLuint baseInstance = 0);
+	// triangles drawn for a shared mesh at a level of detail
+	GLuint GetTriangleCount(SharedMesh mesh, int lod) const;
+
+	// pack the loaded box, cylinder, plane, pyramid and sphere
+	// meshes into the shared mesh buffer
+	void BuildSharedMeshBuffer();
+	bool HasSharedMeshBuffer() const { return m_sharedVAO != 0; }
+
+	// methods for drawing instances of several shared meshes
+	// with one call, each command naming a mesh's index range
+	// and its slice of the uploaded instance data
+	DrawElementsIndirectCommand GetSharedMeshCommand(SharedMesh mesh, GLuint instanceCount, GLuint baseInstance, int lod = 0) const;
+	void MultiDrawSharedMeshes(const DrawElementsIndirectCommand* commands, GLsizei count);
+
+	// send vertex array binds through a state cache so that
+	// consecutive draws of the same mesh skip the rebind
+	void SetStateCache(GLStateCache* pStateCache);
+
+	// CPU copies of the loaded meshes, valid after the
+	// matching Load call
+	const MeshData& GetBoxMeshData() const { return m_BoxData; }
+	const MeshData& GetCylinderMeshData() const { return m_CylinderData; }
+	const MeshData& GetPlaneMeshData() const { return m_PlaneData; }
+	const MeshData& GetPyramid4MeshData() const { return m_Pyramid4Data; }
+	const MeshData& GetSphereMeshData() const { return m_SphereData; }
+	// CPU copy of a shared mesh at a level of detail
+	const MeshData& GetMeshData(SharedMesh mesh, int lod) const;
+
 private:
 
 	// called to calculate the normal for 
@@ -97,4 +232,17 @@ private:
 	// called to set the memory layout 
 	// template for shader data
 	void SetShaderMemoryLayout();
+
+	// called to attach the per-instance attributes
+	// to a mesh's vertex array object
+	void SetInstanceMemoryLayout(GLuint vao);
+
+	// called to send a generated level of detail to
+	// its own vertex array object
+	void LoadLodMesh(const MeshData& data, GLMesh& mesh);
+
+	// called to bind and release a mesh's vertex array
+	// object, through the state cache when one is set
+	void BindVertexArray(GLuint vao);
+	void ReleaseVertexArray();
 };
\ No newline at end of file
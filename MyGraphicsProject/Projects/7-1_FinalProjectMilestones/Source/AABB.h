@@ -0,0 +1,61 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cfloat>
+#include <cmath>
+
+// Axis-aligned bounding box. A default box is empty, with min above max on every
+// axis, so expanding it by the first point or box just takes that point or box.
+struct AABB {
+    glm::vec3 min;
+    glm::vec3 max;
+
+    AABB() : min(FLT_MAX), max(-FLT_MAX) {}
+    AABB(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
+
+    bool IsEmpty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+    glm::vec3 GetCenter() const { return (min + max) * 0.5f; }
+    // Half the size along each axis
+    glm::vec3 GetExtents() const { return (max - min) * 0.5f; }
+
+    bool Overlaps(const AABB& other) const {
+        return min.x <= other.max.x && max.x >= other.min.x &&
+            min.y <= other.max.y && max.y >= other.min.y &&
+            min.z <= other.max.z && max.z >= other.min.z;
+    }
+
+    // Squared distance from a point to the nearest point of the box, 0 inside
+    float DistanceSquared(const glm::vec3& point) const {
+        glm::vec3 outside = glm::max(glm::max(min - point, point - max), glm::vec3(0.0f));
+        return glm::dot(outside, outside);
+    }
+
+    void Expand(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void Expand(const AABB& other) {
+        if (!other.IsEmpty()) {
+            min = glm::min(min, other.min);
+            max = glm::max(max, other.max);
+        }
+    }
+
+    // Box around this one after an affine transform: the center is transformed and
+    // the extents are projected onto each world axis through the absolute matrix
+    AABB Transformed(const glm::mat4& transform) const {
+        if (IsEmpty()) {
+            return *this;
+        }
+        glm::vec3 center = glm::vec3(transform * glm::vec4(GetCenter(), 1.0f));
+        glm::vec3 extents = GetExtents();
+        glm::vec3 worldExtents;
+        for (int row = 0; row < 3; ++row) {
+            worldExtents[row] = std::fabs(transform[0][row]) * extents.x +
+                std::fabs(transform[1][row]) * extents.y +
+                std::fabs(transform[2][row]) * extents.z;
+        }
+        return AABB(center - worldExtents, center + worldExtents);
+    }
+};
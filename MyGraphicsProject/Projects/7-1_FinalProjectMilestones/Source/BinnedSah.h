@@ -0,0 +1,85 @@
+#pragma once
+
+#include "AABB.h"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+
+// Binned surface area heuristic, shared by the BVH builders. Primitive centers are
+// sorted into a few bins along each axis, and every plane between two bins is costed
+// from the bin boxes in one sweep from each end, so finding a split is linear in the
+// primitive count whatever the scene looks like.
+namespace BinnedSah {
+    const int BinCount = 12;
+
+    inline float SurfaceArea(const AABB& box) {
+        if (box.IsEmpty()) {
+            return 0.0f;
+        }
+        glm::vec3 size = box.max - box.min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    // Best split of primitives [first, first + count) of a node with the given bounds.
+    // centers[i] is the center of primitive i and boundsOf(i) returns its box. Returns
+    // false when no plane costs less than testing every primitive of the node; the
+    // primitives whose center is below outPosition on outAxis go left.
+    template<typename BoundsOf>
+    bool FindSplit(const AABB& nodeBounds, const glm::vec3* centers, uint32_t first, uint32_t count,
+        BoundsOf&& boundsOf, int& outAxis, float& outPosition) {
+        AABB centerBounds;
+        for (uint32_t i = first; i < first + count; ++i) {
+            centerBounds.Expand(centers[i]);
+        }
+
+        // Splitting has to beat testing every primitive of this node
+        float bestCost = static_cast<float>(count) * SurfaceArea(nodeBounds);
+        bool found = false;
+        for (int axis = 0; axis < 3; ++axis) {
+            float low = centerBounds.min[axis];
+            float extent = centerBounds.max[axis] - low;
+            if (extent <= 0.0f) {
+                continue;
+            }
+
+            AABB binBounds[BinCount];
+            uint32_t binCounts[BinCount] = {};
+            float binScale = BinCount / extent;
+            for (uint32_t i = first; i < first + count; ++i) {
+                int bin = std::min(BinCount - 1, static_cast<int>((centers[i][axis] - low) * binScale));
+                binBounds[bin].Expand(boundsOf(i));
+                ++binCounts[bin];
+            }
+
+            // Sweep from both ends so every plane between two bins is costed in one pass
+            float leftAreas[BinCount - 1];
+            uint32_t leftCounts[BinCount - 1];
+            AABB leftBox;
+            uint32_t leftCount = 0;
+            for (int plane = 0; plane < BinCount - 1; ++plane) {
+                leftBox.Expand(binBounds[plane]);
+                leftCount += binCounts[plane];
+                leftAreas[plane] = SurfaceArea(leftBox);
+                leftCounts[plane] = leftCount;
+            }
+            AABB rightBox;
+            uint32_t rightCount = 0;
+            for (int plane = BinCount - 2; plane >= 0; --plane) {
+                rightBox.Expand(binBounds[plane + 1]);
+                rightCount += binCounts[plane + 1];
+                if (leftCounts[plane] == 0 || rightCount == 0) {
+                    continue;
+                }
+                float cost = leftCounts[plane] * leftAreas[plane] + rightCount * SurfaceArea(rightBox);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    outAxis = axis;
+                    outPosition = low + (plane + 1) / binScale;
+                    found = true;
+                }
+            }
+        }
+        return found;
+    }
+}
@@ -0,0 +1,54 @@
+#include "Frustum.h"
+
+Frustum::Frustum() {
+    // Accept everything until a matrix is set
+    for (glm::vec4& plane : m_planes) {
+        plane = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+}
+
+void Frustum::SetFromMatrix(const glm::mat4& viewProjection) {
+    // glm is column-major, so row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; ++i) {
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    }
+
+    // left, right, bottom, top, near, far
+    m_planes[0] = rows[3] + rows[0];
+    m_planes[1] = rows[3] - rows[0];
+    m_planes[2] = rows[3] + rows[1];
+    m_planes[3] = rows[3] - rows[1];
+    m_planes[4] = rows[3] + rows[2];
+    m_planes[5] = rows[3] - rows[2];
+
+    for (glm::vec4& plane : m_planes) {
+        float length = glm::length(glm::vec3(plane));
+        if (length > 0.0f) {
+            plane /= length;
+        }
+    }
+}
+
+Frustum::Containment Frustum::Classify(const AABB& box) const {
+    if (box.IsEmpty()) {
+        return Containment::Outside;
+    }
+
+    glm::vec3 center = box.GetCenter();
+    glm::vec3 extents = box.GetExtents();
+    Containment result = Containment::Inside;
+    for (const glm::vec4& plane : m_planes) {
+        glm::vec3 normal = glm::vec3(plane);
+        // Distance of the center, and how far the box reaches along the normal
+        float distance = glm::dot(normal, center) + plane.w;
+        float radius = glm::dot(glm::abs(normal), extents);
+        if (distance < -radius) {
+            return Containment::Outside;
+        }
+        if (distance < radius) {
+            result = Containment::Intersecting;
+        }
+    }
+    return result;
+}
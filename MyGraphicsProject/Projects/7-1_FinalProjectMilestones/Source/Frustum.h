@@ -0,0 +1,40 @@
+#pragma once
+
+#include "AABB.h"
+
+#include <glm/glm.hpp>
+#include <cstddef>
+
+// Per-frame culling counters. Every node ends up either visible or culled; tested
+// counts the bounds checks, which stay well below the node count when whole
+// subtrees are accepted or rejected at once.
+struct CullStats {
+    size_t testedNodes = 0;
+    size_t visibleNodes = 0;
+    size_t culledNodes = 0;
+    // culled nodes that were inside the frustum but hidden by occluders
+    size_t occludedNodes = 0;
+};
+
+// The six clip planes of a view volume, with normals pointing inwards
+class Frustum {
+public:
+    enum class Containment {
+        Outside,
+        Intersecting,
+        Inside
+    };
+
+    Frustum();
+
+    // Extracts the planes from a combined projection * view matrix. They are
+    // normalized, so plane distances are in world units.
+    void SetFromMatrix(const glm::mat4& viewProjection);
+
+    // Empty boxes are always outside
+    Containment Classify(const AABB& box) const;
+
+private:
+    // xyz: normal, w: distance, so a point p is inside when dot(n, p) + w >= 0
+    glm::vec4 m_planes[6];
+};
@@ -0,0 +1,60 @@
+#include "LodSelector.h"
+
+#include <algorithm>
+#include <limits>
+
+LodSelector::LodSelector() :
+    m_viewPosition(0.0f), m_projectionScale(1.0f), m_levelCount(1), m_hysteresis(0.15f) {
+    // Level 1 below a fifth of the screen, and each level after at under a third
+    // of the size of the one before
+    m_thresholds[0] = std::numeric_limits<float>::max();
+    float screenSize = 0.2f;
+    for (int level = 1; level < MaxLevels; ++level) {
+        m_thresholds[level] = screenSize;
+        screenSize *= 0.3f;
+    }
+}
+
+void LodSelector::SetLevelCount(int levelCount) {
+    m_levelCount = std::max(1, std::min(levelCount, static_cast<int>(MaxLevels)));
+}
+
+void LodSelector::SetThreshold(int level, float screenSize) {
+    if (level > 0 && level < MaxLevels) {
+        m_thresholds[level] = screenSize;
+    }
+}
+
+void LodSelector::SetView(const glm::vec3& viewPosition, const glm::mat4& projection) {
+    m_viewPosition = viewPosition;
+    m_projectionScale = projection[1][1];
+}
+
+float LodSelector::GetScreenSize(const AABB& worldBounds) const {
+    if (worldBounds.IsEmpty()) {
+        return 0.0f;
+    }
+    float radius = glm::length(worldBounds.GetExtents());
+    float distance = glm::length(worldBounds.GetCenter() - m_viewPosition);
+    if (distance <= radius) {
+        return std::numeric_limits<float>::max();
+    }
+    // Projected diameter is 2r * scale / d in normalized device units, and the
+    // screen is two of those tall
+    return radius * m_projectionScale / distance;
+}
+
+int LodSelector::Select(const AABB& worldBounds, int currentLevel) const {
+    float size = GetScreenSize(worldBounds);
+    int level = std::max(0, std::min(currentLevel, m_levelCount - 1));
+
+    // Step to a coarser level only once clearly below its threshold, and back to a
+    // finer one only once clearly above the current level's
+    while (level + 1 < m_levelCount && size < m_thresholds[level + 1] * (1.0f - m_hysteresis)) {
+        ++level;
+    }
+    while (level > 0 && size > m_thresholds[level] * (1.0f + m_hysteresis)) {
+        --level;
+    }
+    return level;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "AABB.h"
+
+#include <glm/glm.hpp>
+#include <cstddef>
+
+// Per-frame level-of-detail counters, gathered when the levels are re-chosen
+struct LodStats {
+    size_t nodes = 0;
+    // nodes whose level differs from the one they had last time
+    size_t changes = 0;
+};
+
+// Picks a level of detail from how tall a node's bounds appear on screen, level 0
+// being full detail. Each switch point has a band around it, so a node sitting near
+// a threshold does not flip between two levels every frame.
+class LodSelector {
+public:
+    static const int MaxLevels = 4;
+
+    LodSelector();
+
+    // Levels past the last threshold set are never chosen
+    void SetLevelCount(int levelCount);
+    // Fraction of the screen height below which level is used, for level >= 1
+    void SetThreshold(int level, float screenSize);
+    // Width of the band around each threshold, as a fraction of it
+    void SetHysteresis(float hysteresis) { m_hysteresis = hysteresis; }
+
+    void SetView(const glm::vec3& viewPosition, const glm::mat4& projection);
+
+    // Bounding sphere diameter over the screen height; very large when the eye is inside
+    float GetScreenSize(const AABB& worldBounds) const;
+    int Select(const AABB& worldBounds, int currentLevel) const;
+
+private:
+    glm::vec3 m_viewPosition;
+    // projection[1][1], the cotangent of half the vertical field of view
+    float m_projectionScale;
+    int m_levelCount;
+    float m_thresholds[MaxLevels];
+    float m_hysteresis;
+};
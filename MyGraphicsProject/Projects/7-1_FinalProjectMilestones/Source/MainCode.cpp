@@ -1,6 +1,8 @@
 #include <iostream>         // error handling and output
 #include <cstdlib>          // EXIT_FAILURE
-#include <functional>
+#include <cstring>          // strcmp
+#include <cmath>            // pow
+#include <string>
 
 
 #include <GL/glew.h>        // GLEW library
@@ -19,6 +21,7 @@
 #include "ShaderManager.h"
 #include "Ray.h"
 #include "SceneNode.h"
+#include "RayBoxBenchmark.h"
 
 
 // Namespace for declaring global variables
@@ -36,12 +39,22 @@ namespace
 	ShaderManager* g_ShaderManager = nullptr;
 	// view manager object for managing the 3D view setup and projection to 2D
 	ViewManager* g_ViewManager = nullptr;
+
+	// largest values the stress scene switches accept
+	const unsigned long g_MaxStressNodes = 10000000;
+	const unsigned long g_MaxStressGridSide = 1000;
+	const unsigned long g_MaxStressDepth = 8;
+	const unsigned long g_MaxStressFanOut = 16;
+	const unsigned long g_MaxStressVariety = 1024;
+	const double g_MaxStressLeavesPerCell = 4096.0;
 }
 
 // Function declarations - all functions that are called manually
 // need to be pre-declared at the beginning of the source code.
 bool InitializeGLFW();
 bool InitializeGLEW();
+bool ParseNumber(const std::string& text, unsigned long minimum, unsigned long maximum, unsigned long& outValue);
+void PrintUsage(const char* program);
 
 
 /***********************************************************
@@ -52,6 +65,161 @@ bool InitializeGLEW();
  ***********************************************************/
 int main(int argc, char* argv[])
 {
+	// micro-benchmarks run on their own, without a window
+	for (int i = 1; i < argc; i++)
+	{
+		// time the ray-box kernels against the original test
+		if (strcmp(argv[i], "--bench-ray-box") == 0)
+		{
+			return(RunRayBoxBenchmark(4096, 1024) ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	// read the optional command-line switches before any window
+	// is opened, so a bad value fails fast with the usage text
+	bool bFlatHierarchy = false;
+	bool bStressScene = false;
+	bool bRenderStats = false;
+	bool bQueryStats = false;
+	bool bInstancing = true;
+	bool bCulling = true;
+	bool bOcclusion = true;
+	bool bLod = true;
+	SceneManager::STRESS_SCENE_SETTINGS stressSettings;
+	const char* badSwitch = nullptr;
+	for (int i = 1; i < argc; i++)
+	{
+		bool bHasValue = (i + 1 < argc);
+		unsigned long value = 0;
+		// resolve world transforms through the flattened, index-based hierarchy
+		if (strcmp(argv[i], "--flat-hierarchy") == 0)
+		{
+			bFlatHierarchy = true;
+		}
+		// replace the demo scene with a generated one of roughly N nodes
+		else if (strcmp(argv[i], "--stress") == 0)
+		{
+			if (bHasValue == false || ParseNumber(argv[i + 1], 1, g_MaxStressNodes, value) == false)
+			{
+				badSwitch = argv[i];
+				break;
+			}
+			bStressScene = true;
+			stressSettings.targetNodeCount = value;
+			i++;
+		}
+		// generated scene layout: an explicit COLSxROWS grid instead of a node count
+		else if (strcmp(argv[i], "--stress-grid") == 0)
+		{
+			unsigned long columns = 0;
+			unsigned long rows = 0;
+			std::string grid = bHasValue ? argv[i + 1] : "";
+			size_t separator = grid.find('x');
+			if (bHasValue == false
+				|| ParseNumber(grid.substr(0, separator), 1, g_MaxStressGridSide, columns) == false
+				|| (separator != std::string::npos && ParseNumber(grid.substr(separator + 1), 1, g_MaxStressGridSide, rows) == false))
+			{
+				badSwitch = argv[i];
+				break;
+			}
+			bStressScene = true;
+			stressSettings.targetNodeCount = 0;
+			stressSettings.columns = static_cast<int>(columns);
+			stressSettings.rows = static_cast<int>(separator != std::string::npos ? rows : columns);
+			i++;
+		}
+		// print draw and state change counts while rendering
+		else if (strcmp(argv[i], "--render-stats") == 0)
+		{
+			bRenderStats = true;
+		}
+		// trace a grid of camera rays and query the proximity grid while rendering
+		else if (strcmp(argv[i], "--query-stats") == 0)
+		{
+			bQueryStats = true;
+		}
+		// draw every primitive with its own call, for comparison
+		else if (strcmp(argv[i], "--no-instancing") == 0)
+		{
+			bInstancing = false;
+		}
+		// draw every node even when it is outside the view frustum
+		else if (strcmp(argv[i], "--no-culling") == 0)
+		{
+			bCulling = false;
+		}
+		// frustum culling only, without the CPU occlusion pass
+		else if (strcmp(argv[i], "--no-occlusion") == 0)
+		{
+			bOcclusion = false;
+		}
+		// draw the sphere and cylinder meshes at full detail at any distance
+		else if (strcmp(argv[i], "--no-lod") == 0)
+		{
+			bLod = false;
+		}
+		else if (strcmp(argv[i], "--stress-scatter") == 0)
+		{
+			stressSettings.bScatter = true;
+		}
+		else if (strcmp(argv[i], "--stress-depth") == 0)
+		{
+			if (bHasValue == false || ParseNumber(argv[i + 1], 0, g_MaxStressDepth, value) == false)
+			{
+				badSwitch = argv[i];
+				break;
+			}
+			stressSettings.depth = static_cast<int>(value);
+			i++;
+		}
+		else if (strcmp(argv[i], "--stress-fanout") == 0)
+		{
+			if (bHasValue == false || ParseNumber(argv[i + 1], 1, g_MaxStressFanOut, value) == false)
+			{
+				badSwitch = argv[i];
+				break;
+			}
+			stressSettings.fanOut = static_cast<int>(value);
+			i++;
+		}
+		else if (strcmp(argv[i], "--stress-variety") == 0)
+		{
+			if (bHasValue == false || ParseNumber(argv[i + 1], 1, g_MaxStressVariety, value) == false)
+			{
+				badSwitch = argv[i];
+				break;
+			}
+			stressSettings.variety = static_cast<int>(value);
+			i++;
+		}
+		else if (strcmp(argv[i], "--stress-seed") == 0)
+		{
+			if (bHasValue == false || ParseNumber(argv[i + 1], 0, 4294967295ul, value) == false)
+			{
+				badSwitch = argv[i];
+				break;
+			}
+			stressSettings.seed = static_cast<unsigned int>(value);
+			i++;
+		}
+	}
+
+	if (badSwitch != nullptr)
+	{
+		std::cerr << "Invalid or missing value for " << badSwitch << std::endl;
+		PrintUsage(argv[0]);
+		return(EXIT_FAILURE);
+	}
+	// a deep, wide tree multiplies out to more leaves per cell
+	// than any node count could be reached with
+	if (std::pow(static_cast<double>(stressSettings.fanOut), stressSettings.depth) > g_MaxStressLeavesPerCell)
+	{
+		std::cerr << "--stress-fanout " << stressSettings.fanOut << " with --stress-depth " << stressSettings.depth
+			<< " gives more than " << g_MaxStressLeavesPerCell << " leaves per cell" << std::endl;
+		PrintUsage(argv[0]);
+		return(EXIT_FAILURE);
+	}
+
 	// if GLFW fails initialization, then terminate the application
 	if (InitializeGLFW() == false)
 	{
@@ -79,9 +247,40 @@ int main(int argc, char* argv[])
 		"../../Utilities/shaders/fragmentShader.glsl");
 	g_ShaderManager->use();
 
-	// try to create a new scene manager object and prepare the 3D scene
+	// try to create a new scene manager object
 	g_SceneManager = new SceneManager(g_ShaderManager, g_ViewManager->GetCamera());
-	g_SceneManager->PrepareScene();
+
+	// prepare the 3D scene
+	if (bStressScene == true)
+	{
+		g_SceneManager->PrepareStressScene(stressSettings);
+	}
+	else
+	{
+		g_SceneManager->PrepareScene();
+	}
+	if (bFlatHierarchy == true)
+	{
+		g_SceneManager->SetFlatHierarchyEnabled(true);
+	}
+	g_SceneManager->SetRenderStatsEnabled(bRenderStats);
+	g_SceneManager->SetQueryStatsEnabled(bQueryStats);
+	if (bInstancing == false)
+	{
+		g_SceneManager->SetInstancingEnabled(false);
+	}
+	if (bCulling == false)
+	{
+		g_SceneManager->SetCullingEnabled(false);
+	}
+	if (bOcclusion == false)
+	{
+		g_SceneManager->SetOcclusionCullingEnabled(false);
+	}
+	if (bLod == false)
+	{
+		g_SceneManager->SetLodEnabled(false);
+	}
 	glfwSetInputMode(g_Window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
 	// loop will keep running until the application is closed 
@@ -91,10 +290,25 @@ int main(int argc, char* argv[])
 		// query the latest GLFW events
 		glfwPollEvents();
 
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		// picks finished since the last frame change the selection
+		// now; only the old and new selection are touched
+		PickingService::Result pick;
+		if (g_SceneManager->ApplyPickResults(pick) == true && pick.hit.handle.IsValid()) {
+			std::cout << "Ray hit something!" << std::endl;
+			std::cout << "Node handle: " << pick.hit.handle.index << ":" << pick.hit.handle.generation << std::endl;
+			std::cout << "Distance: " << pick.hit.distance << ", triangle: " << pick.hit.triangle
+				<< ", barycentrics: " << glm::to_string(pick.hit.barycentrics) << std::endl;
+			std::cout << "Tested " << pick.trace.testedLeaves << " nodes, " << pick.trace.narrowTests
+				<< " against their triangles, in " << pick.workerMs << " ms on the worker" << std::endl;
+		}
+
+		// these only reach the driver on the first frame, after
+		// that the state cache sees they are already set
+		GLStateCache& stateCache = g_SceneManager->GetStateCache();
+		stateCache.SetBlend(true);
+		stateCache.SetBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		// Enable z-depth
-		glEnable(GL_DEPTH_TEST);
+		stateCache.SetDepthTest(true);
 
 		// Clear the frame and z buffers
 		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -102,6 +316,7 @@ int main(int argc, char* argv[])
 
 		// convert from 3D object space to 2D view
 		g_ViewManager->PrepareSceneView();
+		g_SceneManager->SetViewTransforms(g_ViewManager->GetViewMatrix(), g_ViewManager->GetProjectionMatrix());
 
 		// refresh the 3D scene
 		g_SceneManager->RenderScene();
@@ -123,33 +338,10 @@ int main(int argc, char* argv[])
 				0.1f, 100.0f
 			);
 
-			// Generate ray from center of screen
+			// Generate ray from center of screen; it is traced on a
+			// worker and selects what it hits on a later frame
 			Ray ray = Ray::fromMouse(centerX, centerY, width, height, view, projection);
-			std::cout << "Ray origin: " << glm::to_string(ray.origin) << std::endl;
-			std::cout << "Ray direction: " << glm::to_string(ray.direction) << std::endl;
-
-			// Traverse the scene for intersection
-			SceneNode* closestNode = nullptr;
-			float closestDistance = FLT_MAX;
-			if (g_SceneManager->GetRootNode()) {
-				g_SceneManager->GetRootNode()->CheckRayHit(ray, glm::mat4(1.0f), closestNode, closestDistance);
-			}
-
-			// Clear previous highlights
-			std::function<void(SceneNode*)> clearHighlights = [&](SceneNode* node) {
-				node->SetHighlighted(false);
-				for (SceneNode* child : node->GetChildren()) {
-					clearHighlights(child);
-				}
-			};
-			clearHighlights(g_SceneManager->GetRootNode());
-
-			// Highlight the closest node, if found
-			if (closestNode) {
-				closestNode->SetHighlighted(true);
-				std::cout << "Ray hit something!" << std::endl;
-				std::cout << "Memory Address: " << closestNode << std::endl;
-			}
+			g_SceneManager->RequestPick(ray);
 		}
 
 		// Flips the the back buffer with the front buffer every frame.
@@ -229,4 +421,56 @@ bool InitializeGLEW()
 	std::cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << "\n" << std::endl;
 
 	return(true);
-}
\ No newline at end of file
+}
+
+/***********************************************************
+ *	ParseNumber()
+ *
+ *  This function is used to read a whole, unsigned decimal
+ *  command-line value and check it against its range. Signs,
+ *  spaces and trailing characters, which strtoul would skip
+ *  or stop at, make the value invalid.
+ ***********************************************************/
+bool ParseNumber(const std::string& text, unsigned long minimum, unsigned long maximum, unsigned long& outValue)
+{
+	// ten digits always fit, and nothing longer is in range
+	if (text.empty() || text.size() > 10 || text.find_first_not_of("0123456789") != std::string::npos)
+	{
+		return(false);
+	}
+
+	unsigned long long value = strtoull(text.c_str(), nullptr, 10);
+	if (value < minimum || value > maximum)
+	{
+		return(false);
+	}
+	outValue = static_cast<unsigned long>(value);
+	return(true);
+}
+
+/***********************************************************
+ *	PrintUsage()
+ *
+ *  This function is used to list the command-line switches
+ *  and the values they accept.
+ ***********************************************************/
+void PrintUsage(const char* program)
+{
+	std::cerr << "Usage: " << program << " [switches]\n"
+		<< "  --bench-ray-box          time the ray-box kernels and exit\n"
+		<< "  --flat-hierarchy         resolve transforms through the flat hierarchy\n"
+		<< "  --render-stats           print draw and state change counts\n"
+		<< "  --query-stats            print ray batch and proximity grid timings\n"
+		<< "  --no-instancing          draw every primitive with its own call\n"
+		<< "  --no-culling             draw nodes outside the view frustum\n"
+		<< "  --no-occlusion           skip the CPU occlusion pass\n"
+		<< "  --no-lod                 draw every mesh at full detail\n"
+		<< "  --stress N               generated scene of about N nodes, 1 to " << g_MaxStressNodes << "\n"
+		<< "  --stress-grid C[xR]      generated scene of C by R cells, each 1 to " << g_MaxStressGridSide << "\n"
+		<< "  --stress-scatter         scatter the cells instead of a grid\n"
+		<< "  --stress-depth D         group levels per cell, 0 to " << g_MaxStressDepth << "\n"
+		<< "  --stress-fanout F        children per group, 1 to " << g_MaxStressFanOut << "\n"
+		<< "  --stress-variety V       material and texture pairs, 1 to " << g_MaxStressVariety << "\n"
+		<< "  --stress-seed S          random seed, 0 to 4294967295\n"
+		<< "F to the power D may be at most " << g_MaxStressLeavesPerCell << " leaves per cell." << std::endl;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+// Stable reference to an arena-allocated SceneNode. The index names the arena slot
+// and the generation the lifetime of the node in it; once the slot is recycled by a
+// scene reload the generation moves on and the handle stops resolving.
+struct NodeHandle {
+    uint32_t index = 0;
+    // Generation 0 is never issued, so a default handle is always invalid
+    uint32_t generation = 0;
+
+    bool IsValid() const { return generation != 0; }
+    bool operator==(const NodeHandle& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const NodeHandle& other) const { return !(*this == other); }
+};
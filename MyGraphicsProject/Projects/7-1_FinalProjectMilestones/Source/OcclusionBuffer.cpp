@@ -0,0 +1,239 @@
+#include "OcclusionBuffer.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+    // Rows per band handed to one worker
+    const int g_BandRows = 16;
+    // Corners closer to the eye than this in clip w are treated as crossing the near plane
+    const float g_MinClipW = 1e-4f;
+
+    // Corner i of a box takes max on x, y, z when bit 0, 1, 2 of i is set
+    const int g_BoxTriangles[12][3] = {
+        { 0, 2, 6 }, { 0, 6, 4 },   // -x
+        { 1, 5, 7 }, { 1, 7, 3 },   // +x
+        { 0, 4, 5 }, { 0, 5, 1 },   // -y
+        { 2, 3, 7 }, { 2, 7, 6 },   // +y
+        { 0, 1, 3 }, { 0, 3, 2 },   // -z
+        { 4, 6, 7 }, { 4, 7, 5 }    // +z
+    };
+
+    // Twice the signed area of (a, b, p); positive when p is left of a->b
+    float Edge(const glm::vec3& a, const glm::vec3& b, float px, float py) {
+        return (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+    }
+}
+
+OcclusionBuffer::OcclusionBuffer(int width, int height) :
+    m_width((std::max(width, 4) + 3) & ~3), m_height(std::max(height, 1)),
+    m_depth(static_cast<size_t>(m_width) * m_height, 1.0f),
+    m_viewProjection(1.0f) {}
+
+void OcclusionBuffer::Begin(const glm::mat4& viewProjection) {
+    m_viewProjection = viewProjection;
+    std::fill(m_depth.begin(), m_depth.end(), 1.0f);
+    m_vertices.clear();
+    m_stats = Stats();
+}
+
+bool OcclusionBuffer::ProjectCorners(const glm::mat4& transform, const AABB& box, ScreenVertex* outCorners) const {
+    for (int i = 0; i < 8; ++i) {
+        glm::vec4 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z, 1.0f);
+        glm::vec4 clip = transform * corner;
+        if (clip.w < g_MinClipW) {
+            return false;
+        }
+        float invW = 1.0f / clip.w;
+        outCorners[i] = ScreenVertex((clip.x * invW * 0.5f + 0.5f) * m_width,
+            (clip.y * invW * 0.5f + 0.5f) * m_height, clip.z * invW);
+    }
+    return true;
+}
+
+void OcclusionBuffer::AddOccluder(const glm::mat4& world, const AABB& localBox) {
+    if (localBox.IsEmpty()) {
+        return;
+    }
+    ScreenVertex corners[8];
+    if (!ProjectCorners(m_viewProjection * world, localBox, corners)) {
+        ++m_stats.skippedOccluders;
+        return;
+    }
+    m_vertices.insert(m_vertices.end(), corners, corners + 8);
+    ++m_stats.occluders;
+}
+
+void OcclusionBuffer::Rasterize(WorkerPool* pool) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    m_stats.triangles = m_stats.occluders * 12;
+
+    size_t bandCount = static_cast<size_t>((m_height + g_BandRows - 1) / g_BandRows);
+    auto drawBands = [this](size_t first, size_t last) {
+        for (size_t band = first; band < last; ++band) {
+            int firstRow = static_cast<int>(band) * g_BandRows;
+            RasterizeBand(firstRow, std::min(firstRow + g_BandRows, m_height));
+        }
+    };
+    if (pool && !m_vertices.empty()) {
+        pool->ParallelFor(bandCount, 1, drawBands);
+    }
+    else {
+        drawBands(0, bandCount);
+    }
+
+    m_stats.rasterMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void OcclusionBuffer::RasterizeBand(int firstRow, int endRow) {
+    for (size_t base = 0; base < m_vertices.size(); base += 8) {
+        const ScreenVertex* corners = &m_vertices[base];
+        for (const int* triangle : g_BoxTriangles) {
+            RasterizeTriangle(corners[triangle[0]], corners[triangle[1]], corners[triangle[2]], firstRow, endRow);
+        }
+    }
+}
+
+void OcclusionBuffer::RasterizeTriangle(const ScreenVertex& v0, const ScreenVertex& in1, const ScreenVertex& in2, int firstRow, int endRow) {
+    // Both windings are drawn, so flip clockwise triangles instead of dropping them
+    ScreenVertex v1 = in1;
+    ScreenVertex v2 = in2;
+    float area = Edge(v0, v1, v2.x, v2.y);
+    if (area < 0.0f) {
+        std::swap(v1, v2);
+        area = -area;
+    }
+    if (area < 1e-6f) {
+        return;
+    }
+
+    // Pixels whose centers fall inside the triangle's bounds, clipped to the band
+    float minX = std::min(v0.x, std::min(v1.x, v2.x));
+    float maxX = std::max(v0.x, std::max(v1.x, v2.x));
+    float minY = std::min(v0.y, std::min(v1.y, v2.y));
+    float maxY = std::max(v0.y, std::max(v1.y, v2.y));
+    int xBegin = std::max(0, static_cast<int>(std::ceil(minX - 0.5f)));
+    int xLast = std::min(m_width - 1, static_cast<int>(std::floor(maxX - 0.5f)));
+    int yBegin = std::max(firstRow, static_cast<int>(std::ceil(minY - 0.5f)));
+    int yLast = std::min(endRow - 1, static_cast<int>(std::floor(maxY - 0.5f)));
+    if (xBegin > xLast || yBegin > yLast) {
+        return;
+    }
+    // Start on a four-pixel boundary; the extra lanes fail the edge tests
+    xBegin &= ~3;
+
+    // Edge functions and depth are linear in x, so each row starts from its first
+    // pixel and steps them across
+    float dw0x = -(v2.y - v1.y);
+    float dw1x = -(v0.y - v2.y);
+    float dw2x = -(v1.y - v0.y);
+    float invArea = 1.0f / area;
+    float dzx = (dw0x * v0.z + dw1x * v1.z + dw2x * v2.z) * invArea;
+
+    float px = xBegin + 0.5f;
+    for (int y = yBegin; y <= yLast; ++y) {
+        float py = y + 0.5f;
+        float w0 = Edge(v1, v2, px, py);
+        float w1 = Edge(v2, v0, px, py);
+        float w2 = Edge(v0, v1, px, py);
+        float z = (w0 * v0.z + w1 * v1.z + w2 * v2.z) * invArea;
+        float* row = &m_depth[static_cast<size_t>(y) * m_width];
+
+#ifdef OCCLUSION_USE_SSE2
+        const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+        const __m128 zero = _mm_setzero_ps();
+        __m128 e0 = _mm_add_ps(_mm_set1_ps(w0), _mm_mul_ps(lanes, _mm_set1_ps(dw0x)));
+        __m128 e1 = _mm_add_ps(_mm_set1_ps(w1), _mm_mul_ps(lanes, _mm_set1_ps(dw1x)));
+        __m128 e2 = _mm_add_ps(_mm_set1_ps(w2), _mm_mul_ps(lanes, _mm_set1_ps(dw2x)));
+        __m128 depth = _mm_add_ps(_mm_set1_ps(z), _mm_mul_ps(lanes, _mm_set1_ps(dzx)));
+        const __m128 step0 = _mm_set1_ps(dw0x * 4.0f);
+        const __m128 step1 = _mm_set1_ps(dw1x * 4.0f);
+        const __m128 step2 = _mm_set1_ps(dw2x * 4.0f);
+        const __m128 stepZ = _mm_set1_ps(dzx * 4.0f);
+        for (int x = xBegin; x <= xLast; x += 4) {
+            __m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+            if (_mm_movemask_ps(inside) != 0) {
+                __m128 current = _mm_loadu_ps(row + x);
+                __m128 nearer = _mm_min_ps(current, depth);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+            }
+            e0 = _mm_add_ps(e0, step0);
+            e1 = _mm_add_ps(e1, step1);
+            e2 = _mm_add_ps(e2, step2);
+            depth = _mm_add_ps(depth, stepZ);
+        }
+#else
+        for (int x = xBegin; x <= xLast; ++x) {
+            if (w0 >= 0.0f && w1 >= 0.0f && w2 >= 0.0f && z < row[x]) {
+                row[x] = z;
+            }
+            w0 += dw0x;
+            w1 += dw1x;
+            w2 += dw2x;
+            z += dzx;
+        }
+#endif
+    }
+}
+
+bool OcclusionBuffer::IsOccluded(const AABB& worldBox) const {
+    ++m_stats.tests;
+    if (worldBox.IsEmpty() || m_vertices.empty()) {
+        return false;
+    }
+    ScreenVertex corners[8];
+    if (!ProjectCorners(m_viewProjection, worldBox, corners)) {
+        return false;
+    }
+
+    float minX = corners[0].x, maxX = corners[0].x;
+    float minY = corners[0].y, maxY = corners[0].y;
+    float nearest = corners[0].z;
+    for (int i = 1; i < 8; ++i) {
+        minX = std::min(minX, corners[i].x);
+        maxX = std::max(maxX, corners[i].x);
+        minY = std::min(minY, corners[i].y);
+        maxY = std::max(maxY, corners[i].y);
+        nearest = std::min(nearest, corners[i].z);
+    }
+    // Off screen is for the frustum test to decide
+    if (maxX < 0.0f || maxY < 0.0f || minX >= m_width || minY >= m_height) {
+        return false;
+    }
+
+    // Every pixel the rectangle touches; widening it to whole quads only adds pixels,
+    // which can keep a box visible but never hide one wrongly
+    int xBegin = std::max(0, static_cast<int>(std::floor(minX))) & ~3;
+    int xLast = std::min(m_width - 1, static_cast<int>(std::floor(maxX)));
+    int yBegin = std::max(0, static_cast<int>(std::floor(minY)));
+    int yLast = std::min(m_height - 1, static_cast<int>(std::floor(maxY)));
+
+#ifdef OCCLUSION_USE_SSE2
+    const __m128 boxDepth = _mm_set1_ps(nearest);
+#endif
+    for (int y = yBegin; y <= yLast; ++y) {
+        const float* row = &m_depth[static_cast<size_t>(y) * m_width];
+#ifdef OCCLUSION_USE_SSE2
+        for (int x = xBegin; x <= xLast; x += 4) {
+            if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), boxDepth)) != 0) {
+                return false;
+            }
+        }
+#else
+        for (int x = xBegin; x <= xLast; ++x) {
+            if (row[x] >= nearest) {
+                return false;
+            }
+        }
+#endif
+    }
+    ++m_stats.occluded;
+    return true;
+}
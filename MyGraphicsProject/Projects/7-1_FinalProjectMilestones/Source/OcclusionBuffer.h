@@ -0,0 +1,66 @@
+#pragma once
+
+#include "AABB.h"
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <vector>
+
+class WorkerPool;
+
+// Low-resolution depth buffer drawn on the CPU from a few large occluder boxes, so
+// anything whose screen rectangle lies wholly behind them can be skipped before it
+// is submitted. Nothing here touches GL.
+//
+// Rows are split into bands that are rasterized concurrently, each band walking every
+// occluder triangle, so no two threads write the same pixel. Pixels are processed four
+// at a time with SSE2 where it is available.
+class OcclusionBuffer {
+public:
+    struct Stats {
+        size_t occluders = 0;
+        size_t triangles = 0;
+        // occluders dropped because they cross the near plane
+        size_t skippedOccluders = 0;
+        size_t tests = 0;
+        size_t occluded = 0;
+        double rasterMs = 0.0;
+    };
+
+    // The width is rounded up to a multiple of four
+    OcclusionBuffer(int width = 256, int height = 128);
+
+    // Clears the depth and the queued occluders for a new frame
+    void Begin(const glm::mat4& viewProjection);
+    // Queues a box, given in the space of world, to be drawn into the depth buffer.
+    // It must lie inside the geometry it stands for, or the culling is not conservative.
+    void AddOccluder(const glm::mat4& world, const AABB& localBox);
+    // Draws the queued occluders; with a pool, the row bands are shared out
+    void Rasterize(WorkerPool* pool = nullptr);
+
+    // True when every pixel the box covers already holds something nearer. Boxes
+    // crossing the near plane are never occluded.
+    bool IsOccluded(const AABB& worldBox) const;
+
+    int GetWidth() const { return m_width; }
+    int GetHeight() const { return m_height; }
+    const std::vector<float>& GetDepth() const { return m_depth; }
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    // Screen-space corner: x and y in pixels, z in normalized device depth
+    typedef glm::vec3 ScreenVertex;
+
+    bool ProjectCorners(const glm::mat4& transform, const AABB& box, ScreenVertex* outCorners) const;
+    void RasterizeBand(int firstRow, int endRow);
+    void RasterizeTriangle(const ScreenVertex& v0, const ScreenVertex& v1, const ScreenVertex& v2, int firstRow, int endRow);
+
+    int m_width;
+    int m_height;
+    std::vector<float> m_depth;
+    glm::mat4 m_viewProjection;
+    // Eight projected corners per queued occluder
+    std::vector<ScreenVertex> m_vertices;
+    // Test counters are bumped from const queries during the single-threaded cull pass
+    mutable Stats m_stats;
+};
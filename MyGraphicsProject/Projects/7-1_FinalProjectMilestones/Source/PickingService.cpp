@@ -0,0 +1,107 @@
+#include "PickingService.h"
+#include "WorkerPool.h"
+
+#include <chrono>
+
+PickingService::PickingService(WorkerPool& pool) :
+    m_pool(pool), m_inFlight(false), m_fillBuffer(0),
+    m_pendingRay(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f)), m_hasPending(false),
+    m_nextRequestId(1), m_structureStale(true), m_capturedLeaves(0) {}
+
+PickingService::~PickingService() {
+    std::unique_lock<std::mutex> lock(m_idleMutex);
+    m_idle.wait(lock, [this]() { return !m_inFlight.load(std::memory_order_acquire); });
+}
+
+void PickingService::InvalidateSnapshot() {
+    m_structureStale = true;
+    m_leafBuffers[m_fillBuffer].clear();
+}
+
+void PickingService::CaptureMoved(const std::vector<const SceneNode*>& movedNodes) {
+    // A full capture is already due and will include these
+    if (m_structureStale) {
+        return;
+    }
+    std::vector<SceneBVH::Leaf>& leaves = m_leafBuffers[m_fillBuffer];
+    SceneBVH::Leaf leaf;
+    for (const SceneNode* node : movedNodes) {
+        if (SceneBVH::CaptureLeaf(node, leaf)) {
+            leaves.push_back(leaf);
+        }
+    }
+    // Nodes that keep moving with no pick to carry their records would grow the
+    // queue without bound; past the scene's size, one full capture is cheaper
+    if (leaves.size() > m_capturedLeaves) {
+        InvalidateSnapshot();
+    }
+}
+
+uint32_t PickingService::Post(const Ray& ray) {
+    m_pendingRay = ray;
+    m_hasPending = true;
+    return m_nextRequestId;
+}
+
+void PickingService::Dispatch(const SceneNode* root) {
+    if (!m_hasPending || m_inFlight.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    // Capturing is the only part that reads the scene, so it happens here. After
+    // nodes were added or removed that means the whole tree; otherwise the records
+    // queued by CaptureMoved are all the worker needs to patch its own tree.
+    bool rebuild = m_structureStale;
+    std::vector<SceneBVH::Leaf>& leaves = m_leafBuffers[m_fillBuffer];
+    if (rebuild) {
+        leaves.clear();
+        if (root) {
+            SceneBVH::CaptureLeaves(root, leaves);
+        }
+        m_capturedLeaves = leaves.size();
+        m_structureStale = false;
+    }
+
+    // The worker is idle, so it is done with the other buffer and the two can swap
+    const std::vector<SceneBVH::Leaf>* handedOver = &leaves;
+    m_fillBuffer = 1 - m_fillBuffer;
+    m_leafBuffers[m_fillBuffer].clear();
+
+    Ray ray = m_pendingRay;
+    uint32_t requestId = m_nextRequestId++;
+    m_hasPending = false;
+    m_inFlight.store(true, std::memory_order_release);
+    m_pool.Submit([this, ray, requestId, handedOver, rebuild]() {
+        Trace(ray, requestId, handedOver, rebuild);
+    });
+}
+
+void PickingService::Trace(const Ray& ray, uint32_t requestId, const std::vector<SceneBVH::Leaf>* leaves,
+    bool rebuild) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Result result;
+    result.requestId = requestId;
+    result.rebuilt = false;
+    if (rebuild) {
+        m_bvh.Build(*leaves);
+        result.rebuilt = true;
+    }
+    else if (!leaves->empty()) {
+        m_bvh.UpdateLeaves(*leaves);
+    }
+    m_bvh.Raycast(ray, result.hit, &result.trace);
+    result.workerMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // At most one request is in flight and the scene's thread drains the queue every
+    // frame, so it never fills; if it ever did, this result is simply dropped
+    m_results.Push(result);
+    // Notified under the lock, so the destructor cannot wake and free the condition
+    // variable while this is still using it
+    std::lock_guard<std::mutex> lock(m_idleMutex);
+    m_inFlight.store(false, std::memory_order_release);
+    m_idle.notify_all();
+}
+
+bool PickingService::PollResult(Result& outResult) {
+    return m_results.Pop(outResult);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "SceneBVH.h"
+#include "SpscQueue.h"
+#include "Ray.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+class WorkerPool;
+
+// Traces picking rays on a worker thread, so the frame that asks for a pick never
+// waits for it. The worker owns its own SceneBVH, built from leaf records captured on
+// the scene's thread; results come back through a lock-free queue and are applied by
+// the scene's thread at the start of a later frame.
+//
+// One request is traced at a time. Requests posted while the worker is busy replace
+// each other, so holding the button down never builds up a backlog. The whole scene
+// is captured only after nodes were added or removed; otherwise just the records of
+// the nodes that moved are queued, into one of two buffers while the worker reads
+// the other, and the worker patches its tree with them.
+class PickingService {
+public:
+    struct Result {
+        uint32_t requestId;
+        RayHit hit;
+        SceneBVH::TraceStats trace;
+        // time spent on the worker, including any rebuild or refit of its tree
+        double workerMs;
+        bool rebuilt;
+    };
+
+    explicit PickingService(WorkerPool& pool);
+    // Waits for the request being traced, if any
+    ~PickingService();
+
+    // Mesh triangles for the worker's narrow phase; set before the first request
+    void SetMeshBVH(SceneNode::MeshType type, const TriangleBVH* bvh) { m_bvh.SetMeshBVH(type, bvh); }
+
+    // Nodes were added or removed, so the next request captures the whole scene
+    void InvalidateSnapshot();
+    // Queues the records of nodes whose bounds were recomputed; call after UpdateBounds
+    void CaptureMoved(const std::vector<const SceneNode*>& movedNodes);
+
+    // Queues a ray, replacing any request not yet handed to the worker, and returns
+    // the id its result will carry
+    uint32_t Post(const Ray& ray);
+    // Hands the waiting request to the worker if it is idle, along with the records
+    // queued since the last one. Call on the scene's thread.
+    void Dispatch(const SceneNode* root);
+    // Takes the oldest finished result; call on the scene's thread
+    bool PollResult(Result& outResult);
+
+    bool IsBusy() const { return m_inFlight.load(std::memory_order_acquire); }
+
+private:
+    PickingService(const PickingService&) = delete;
+    PickingService& operator=(const PickingService&) = delete;
+
+    void Trace(const Ray& ray, uint32_t requestId, const std::vector<SceneBVH::Leaf>* leaves, bool rebuild);
+
+    WorkerPool& m_pool;
+    // only touched by the task in flight once requests start
+    SceneBVH m_bvh;
+    SpscQueue<Result, 8> m_results;
+    std::atomic<bool> m_inFlight;
+    // signalled when the task in flight finishes, for the destructor
+    std::mutex m_idleMutex;
+    std::condition_variable m_idle;
+
+    // Leaf records for the worker. The scene's thread fills one buffer while the
+    // worker may be reading the other; they swap when a request is handed over.
+    std::vector<SceneBVH::Leaf> m_leafBuffers[2];
+    int m_fillBuffer;
+
+    // the scene's thread only
+    Ray m_pendingRay;
+    bool m_hasPending;
+    uint32_t m_nextRequestId;
+    bool m_structureStale;
+    // leaves in the last full capture; queued moves past this many cost more to
+    // apply than capturing the scene again
+    size_t m_capturedLeaves;
+};
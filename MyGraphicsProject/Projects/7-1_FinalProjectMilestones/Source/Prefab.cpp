@@ -0,0 +1,40 @@
+#include "Prefab.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+Prefab::Prefab(const std::string& name) :
+    m_name(name) {}
+
+int Prefab::AddPart(const glm::vec3& position, const glm::vec3& rotation, const glm::vec3& scale,
+    const std::string& materialTag, const std::string& textureTag, int textureSlot,
+    void (*drawFunc)(ShapeMeshes*), SceneNode::MeshType meshType) {
+    Part part;
+    part.localMatrix = glm::translate(glm::mat4(1.0f), position);
+    part.localMatrix = glm::rotate(part.localMatrix, glm::radians(rotation.x), glm::vec3(1, 0, 0));
+    part.localMatrix = glm::rotate(part.localMatrix, glm::radians(rotation.y), glm::vec3(0, 1, 0));
+    part.localMatrix = glm::rotate(part.localMatrix, glm::radians(rotation.z), glm::vec3(0, 0, 1));
+    part.localMatrix = glm::scale(part.localMatrix, scale);
+    part.inverseLocalMatrix = glm::inverse(part.localMatrix);
+    // Normal matrices compose, so an instance only multiplies its own by this one
+    part.normalMatrix = glm::mat3(glm::transpose(part.inverseLocalMatrix));
+    part.materialTag = materialTag;
+    part.textureTag = textureTag;
+    part.textureSlot = textureSlot;
+    part.drawFunction = drawFunc;
+    part.meshType = meshType;
+    part.occluder = false;
+
+    m_parts.push_back(part);
+    m_hasLodParts = m_hasLodParts || SceneNode::HasLodChain(meshType);
+    m_localBounds.Expand(SceneNode::GetMeshBounds(meshType).Transformed(part.localMatrix));
+    // Placed instances now emit one more packet each
+    for (SceneNode* instance : m_instances) {
+        instance->SetLocalBounds(m_localBounds);
+        instance->InvalidateDrawPackets();
+    }
+    return static_cast<int>(m_parts.size()) - 1;
+}
+
+void Prefab::AddInstance(SceneNode* instance) {
+    m_instances.push_back(instance);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "SceneNode.h"
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+class ShapeMeshes;
+
+// A reusable subtree, flattened into parts whose transforms are relative to the
+// prefab origin. Placing the prefab creates a single SceneNode instance that draws
+// every part under its own world matrix, so the part data is shared by all instances.
+class Prefab {
+public:
+    struct Part {
+        glm::mat4 localMatrix;
+        glm::mat4 inverseLocalMatrix;
+        glm::mat3 normalMatrix;
+        std::string materialTag;
+        std::string textureTag;
+        int textureSlot;
+        void (*drawFunction)(ShapeMeshes*);
+        SceneNode::MeshType meshType;
+        // drawn into the occlusion buffer for every instance
+        bool occluder;
+    };
+
+    explicit Prefab(const std::string& name);
+
+    // Same TRS convention as SceneNode::SetTransform; returns the part index
+    int AddPart(const glm::vec3& position, const glm::vec3& rotation, const glm::vec3& scale,
+        const std::string& materialTag, const std::string& textureTag, int textureSlot,
+        void (*drawFunc)(ShapeMeshes*), SceneNode::MeshType meshType = SceneNode::MeshType::Custom);
+
+    void SetPartOccluder(int partIndex, bool value) { m_parts[partIndex].occluder = value; }
+    // True when some part has coarser levels of detail to switch to
+    bool HasLodParts() const { return m_hasLodParts; }
+
+    // Instances are registered by the scene, which drops them when it is cleared
+    void AddInstance(SceneNode* instance);
+    void ClearInstances() { m_instances.clear(); }
+
+    const std::string& GetName() const { return m_name; }
+    const std::vector<Part>& GetParts() const { return m_parts; }
+    const std::vector<SceneNode*>& GetInstances() const { return m_instances; }
+    // Box around every part, relative to the prefab origin
+    const AABB& GetLocalBounds() const { return m_localBounds; }
+
+private:
+    std::string m_name;
+    std::vector<Part> m_parts;
+    std::vector<SceneNode*> m_instances;
+    AABB m_localBounds;
+    bool m_hasLodParts = false;
+};
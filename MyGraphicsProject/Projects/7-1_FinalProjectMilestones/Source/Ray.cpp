@@ -4,7 +4,7 @@
 #include <algorithm>
 
 Ray::Ray(const glm::vec3& origin, const glm::vec3& direction)
-    : origin(origin), direction(glm::normalize(direction)) {}
+    : origin(origin), direction(glm::normalize(direction)), invDirection(1.0f / this->direction) {}
 
 Ray Ray::fromMouse(float mouseX, float mouseY, int screenWidth, int screenHeight,
     const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix) {
@@ -22,30 +22,20 @@ Ray Ray::fromMouse(float mouseX, float mouseY, int screenWidth, int screenHeight
 }
 
 bool Ray::intersectsAABB(const glm::vec3& min, const glm::vec3& max, float& tNear) const {
-    float tmin = (min.x - origin.x) / direction.x;
-    float tmax = (max.x - origin.x) / direction.x;
-    if (tmin > tmax) std::swap(tmin, tmax);
-
-    float tymin = (min.y - origin.y) / direction.y;
-    float tymax = (max.y - origin.y) / direction.y;
-    if (tymin > tymax) std::swap(tymin, tymax);
-
-    if ((tmin > tymax) || (tymin > tmax))
+    // Slab entry and exit on every axis at once; a negative direction swaps them
+    glm::vec3 t0 = (min - origin) * invDirection;
+    glm::vec3 t1 = (max - origin) * invDirection;
+    glm::vec3 tSmall = glm::min(t0, t1);
+    glm::vec3 tLarge = glm::max(t0, t1);
+    float tmin = std::max(std::max(tSmall.x, tSmall.y), tSmall.z);
+    float tmax = std::min(std::min(tLarge.x, tLarge.y), tLarge.z);
+    // An axis-aligned ray starting on a slab plane gives 0 * inf = NaN on that axis,
+    // which min and max would drop; it only runs along the face, so it misses
+    if (glm::any(glm::isnan(t0)) || glm::any(glm::isnan(t1)))
         return false;
-
-    if (tymin > tmin) tmin = tymin;
-    if (tymax < tmax) tmax = tymax;
-
-    float tzmin = (min.z - origin.z) / direction.z;
-    float tzmax = (max.z - origin.z) / direction.z;
-    if (tzmin > tzmax) std::swap(tzmin, tzmax);
-
-    if ((tmin > tzmax) || (tzmin > tmax))
+    if (tmin > tmax)
         return false;
 
-    if (tzmin > tmin) tmin = tzmin;
-    if (tzmax < tmax) tmax = tzmax;
-
     tNear = tmin;
 
     // Optional: discard hits behind the ray
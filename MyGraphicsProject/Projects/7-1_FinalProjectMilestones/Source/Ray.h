@@ -5,6 +5,8 @@ class Ray {
 public:
     glm::vec3 origin;
     glm::vec3 direction;
+    // 1 / direction, worked out once so box tests multiply instead of divide
+    glm::vec3 invDirection;
 
     Ray(const glm::vec3& origin, const glm::vec3& direction);
 
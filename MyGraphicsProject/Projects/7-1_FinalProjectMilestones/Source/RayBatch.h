@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Ray.h"
+
+#include <glm/glm.hpp>
+#include <array>
+#include <cfloat>
+#include <cstddef>
+#include <vector>
+
+// Many rays stored as a structure of arrays, for queries that cast thousands at once:
+// line-of-sight checks, hover probes, visibility sampling. Directions are unit length,
+// so hit distances are world distances. A ray only reports hits nearer than its
+// maximum distance, which turns a closest-hit query into a line-of-sight test.
+struct RayBatch {
+    std::vector<float> originX, originY, originZ;
+    std::vector<float> directionX, directionY, directionZ;
+    std::vector<float> maxDistance;
+
+    size_t GetCount() const { return originX.size(); }
+
+    void Clear() {
+        for (std::vector<float>* column : Columns()) {
+            column->clear();
+        }
+    }
+
+    void Reserve(size_t count) {
+        for (std::vector<float>* column : Columns()) {
+            column->reserve(count);
+        }
+    }
+
+    void Add(const Ray& ray, float maxRayDistance = FLT_MAX) {
+        originX.push_back(ray.origin.x);
+        originY.push_back(ray.origin.y);
+        originZ.push_back(ray.origin.z);
+        directionX.push_back(ray.direction.x);
+        directionY.push_back(ray.direction.y);
+        directionZ.push_back(ray.direction.z);
+        maxDistance.push_back(maxRayDistance);
+    }
+
+    Ray GetRay(size_t index) const {
+        return Ray(glm::vec3(originX[index], originY[index], originZ[index]),
+            glm::vec3(directionX[index], directionY[index], directionZ[index]));
+    }
+
+private:
+    std::array<std::vector<float>*, 7> Columns() {
+        return { { &originX, &originY, &originZ, &directionX, &directionY, &directionZ, &maxDistance } };
+    }
+};
+
+// What one batch query did
+struct RayBatchStats {
+    size_t rays = 0;
+    size_t hits = 0;
+    size_t packets = 0;
+    // tree nodes visited, counted once per packet
+    size_t visitedNodes = 0;
+    // exact tests against a node's meshes, counted once per ray
+    size_t narrowTests = 0;
+    double ms = 0.0;
+
+    double GetRaysPerSecond() const { return ms > 0.0 ? rays * 1000.0 / ms : 0.0; }
+};
@@ -0,0 +1,198 @@
+#include "RayBoxBenchmark.h"
+#include "RayBoxKernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+    // Ray::intersectsAABB as it was before the reciprocal direction was stored:
+    // six divisions and a branch per axis
+    bool DividingIntersect(const Ray& ray, const glm::vec3& min, const glm::vec3& max, float& tNear) {
+        float tmin = (min.x - ray.origin.x) / ray.direction.x;
+        float tmax = (max.x - ray.origin.x) / ray.direction.x;
+        if (tmin > tmax) std::swap(tmin, tmax);
+
+        float tymin = (min.y - ray.origin.y) / ray.direction.y;
+        float tymax = (max.y - ray.origin.y) / ray.direction.y;
+        if (tymin > tymax) std::swap(tymin, tymax);
+
+        if ((tmin > tymax) || (tymin > tmax))
+            return false;
+
+        if (tymin > tmin) tmin = tymin;
+        if (tymax < tmax) tmax = tymax;
+
+        float tzmin = (min.z - ray.origin.z) / ray.direction.z;
+        float tzmax = (max.z - ray.origin.z) / ray.direction.z;
+        if (tzmin > tzmax) std::swap(tzmin, tzmax);
+
+        if ((tmin > tzmax) || (tzmin > tmax))
+            return false;
+
+        if (tzmin > tmin) tmin = tzmin;
+        if (tzmax < tmax) tmax = tzmax;
+
+        tNear = tmin;
+        return tmax >= 0.0f;
+    }
+
+    // Runs body once and reports nanoseconds per box test; the hit count keeps the
+    // compiler from dropping the work
+    void Time(const char* name, size_t tests, const std::function<size_t()>& body) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t hits = body();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  " << name << ": " << ns / tests << " ns per test, " << hits << " hits" << std::endl;
+    }
+
+    int PopCount(int mask) {
+        int count = 0;
+        for (; mask != 0; mask &= mask - 1) {
+            ++count;
+        }
+        return count;
+    }
+}
+
+bool RunRayBoxBenchmark(size_t boxCount, size_t rayCount) {
+    // Whole groups of eight, so every kernel sees the same boxes and rays
+    boxCount = std::max<size_t>(8, boxCount & ~size_t(7));
+    rayCount = std::max<size_t>(8, rayCount & ~size_t(7));
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> size(0.25f, 4.0f);
+    std::uniform_real_distribution<float> spread(-0.05f, 0.05f);
+
+    std::vector<AABB> boxes;
+    boxes.reserve(boxCount);
+    for (size_t i = 0; i < boxCount; ++i) {
+        glm::vec3 center(position(random), position(random) * 0.2f, position(random));
+        glm::vec3 extents(size(random), size(random), size(random));
+        boxes.push_back(AABB(center - extents, center + extents));
+    }
+    std::vector<AABB4> boxes4(boxCount / 4);
+    std::vector<AABB8> boxes8(boxCount / 8);
+    for (size_t i = 0; i < boxCount; ++i) {
+        boxes4[i / 4].Set(static_cast<int>(i % 4), boxes[i]);
+        boxes8[i / 8].Set(static_cast<int>(i % 8), boxes[i]);
+    }
+
+    // Coherent groups of eight rays leaving one eye in nearly the same direction,
+    // like neighbouring pixels
+    std::vector<Ray> rays;
+    rays.reserve(rayCount);
+    for (size_t group = 0; group < rayCount / 8; ++group) {
+        glm::vec3 eye(position(random), 5.0f, position(random));
+        glm::vec3 direction(position(random), position(random) * 0.1f, position(random));
+        for (int lane = 0; lane < 8; ++lane) {
+            rays.push_back(Ray(eye, direction + glm::vec3(spread(random), spread(random), spread(random)) * glm::length(direction)));
+        }
+    }
+    std::vector<RayPacket4> packets4(rayCount / 4);
+    std::vector<RayPacket8> packets8(rayCount / 8);
+    for (size_t i = 0; i < rayCount; ++i) {
+        packets4[i / 4].Set(static_cast<int>(i % 4), rays[i]);
+        packets8[i / 8].Set(static_cast<int>(i % 8), rays[i]);
+    }
+
+    size_t tests = boxCount * rayCount;
+    std::cout << "Ray-box tests: " << rayCount << " rays x " << boxCount << " boxes, wide kernels use "
+        << RayBoxKernels::GetInstructionSet() << std::endl;
+
+    Time("dividing", tests, [&]() {
+        size_t hits = 0;
+        float tNear;
+        for (const Ray& ray : rays) {
+            for (const AABB& box : boxes) {
+                hits += DividingIntersect(ray, box.min, box.max, tNear) ? 1 : 0;
+            }
+        }
+        return hits;
+    });
+    Time("Ray::intersectsAABB", tests, [&]() {
+        size_t hits = 0;
+        float tNear;
+        for (const Ray& ray : rays) {
+            for (const AABB& box : boxes) {
+                hits += ray.intersectsAABB(box.min, box.max, tNear) ? 1 : 0;
+            }
+        }
+        return hits;
+    });
+    Time("scalar kernel", tests, [&]() {
+        size_t hits = 0;
+        float tNear;
+        for (const Ray& ray : rays) {
+            for (const AABB& box : boxes) {
+                hits += RayBoxKernels::IntersectBox(ray, box, FLT_MAX, tNear) ? 1 : 0;
+            }
+        }
+        return hits;
+    });
+    Time("1 ray x 4 boxes", tests, [&]() {
+        size_t hits = 0;
+        float tNear[4];
+        for (const Ray& ray : rays) {
+            for (const AABB4& group : boxes4) {
+                hits += PopCount(RayBoxKernels::IntersectBoxes4(ray, group, FLT_MAX, tNear));
+            }
+        }
+        return hits;
+    });
+    Time("1 ray x 8 boxes", tests, [&]() {
+        size_t hits = 0;
+        float tNear[8];
+        for (const Ray& ray : rays) {
+            for (const AABB8& group : boxes8) {
+                hits += PopCount(RayBoxKernels::IntersectBoxes8(ray, group, FLT_MAX, tNear));
+            }
+        }
+        return hits;
+    });
+    Time("4 rays x 1 box", tests, [&]() {
+        size_t hits = 0;
+        float tNear[4];
+        for (const RayPacket4& packet : packets4) {
+            for (const AABB& box : boxes) {
+                hits += PopCount(RayBoxKernels::IntersectPacket4(packet, box, FLT_MAX, tNear));
+            }
+        }
+        return hits;
+    });
+    Time("8 rays x 1 box", tests, [&]() {
+        size_t hits = 0;
+        float tNear[8];
+        for (const RayPacket8& packet : packets8) {
+            for (const AABB& box : boxes) {
+                hits += PopCount(RayBoxKernels::IntersectPacket8(packet, box, FLT_MAX, tNear));
+            }
+        }
+        return hits;
+    });
+
+    // Every lane of every wide kernel has to agree with the scalar kernel
+    size_t mismatches = 0;
+    for (size_t r = 0; r < rayCount; ++r) {
+        for (size_t b = 0; b < boxCount; ++b) {
+            float tScalar, tWide[8];
+            int expected = RayBoxKernels::IntersectBox(rays[r], boxes[b], FLT_MAX, tScalar) ? 1 : 0;
+            int boxLane = static_cast<int>(b % 8);
+            int rayLane = static_cast<int>(r % 8);
+            int got4 = (RayBoxKernels::IntersectBoxes4(rays[r], boxes4[b / 4], FLT_MAX, tWide) >> (b % 4)) & 1;
+            int got8 = (RayBoxKernels::IntersectBoxes8(rays[r], boxes8[b / 8], FLT_MAX, tWide) >> boxLane) & 1;
+            int gotPacket4 = (RayBoxKernels::IntersectPacket4(packets4[r / 4], boxes[b], FLT_MAX, tWide) >> (r % 4)) & 1;
+            int gotPacket8 = (RayBoxKernels::IntersectPacket8(packets8[r / 8], boxes[b], FLT_MAX, tWide) >> rayLane) & 1;
+            if (got4 != expected || got8 != expected || gotPacket4 != expected || gotPacket8 != expected ||
+                (expected && tWide[rayLane] != tScalar)) {
+                ++mismatches;
+            }
+        }
+    }
+    std::cout << "  " << mismatches << " wide results differ from the scalar kernel" << std::endl;
+    return mismatches == 0;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+
+// Times the ray-box tests against each other on random boxes and prints the cost of
+// one test for each: the original per-axis division form, Ray::intersectsAABB, the
+// scalar kernel, one ray against 4 and 8 boxes, and 4 and 8 ray packets against one
+// box. The wide kernels' hits are checked against the scalar ones as they run.
+// Returns false when some kernel disagreed.
+bool RunRayBoxBenchmark(size_t boxCount, size_t rayCount);
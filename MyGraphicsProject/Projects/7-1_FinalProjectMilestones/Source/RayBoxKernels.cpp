@@ -0,0 +1,250 @@
+#include "RayBoxKernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAYBOX_USE_SSE 1
+#include <emmintrin.h>
+#endif
+// The project is not built with /arch:AVX, so the 8-wide kernels are compiled for
+// AVX on their own and only called once the processor is known to support it
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define RAYBOX_HAS_AVX 1
+#define RAYBOX_AVX_TARGET
+#include <intrin.h>
+#include <immintrin.h>
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define RAYBOX_HAS_AVX 1
+#define RAYBOX_AVX_TARGET __attribute__((target("avx")))
+#include <immintrin.h>
+#endif
+
+namespace {
+    // A ray parallel to an axis whose origin lies exactly on one of that axis'
+    // planes works out 0 * inf = NaN there. The ray only runs along the box face,
+    // so every kernel counts it as a miss rather than let min and max drop the NaN.
+    bool SlabScalar(float ox, float oy, float oz, float ix, float iy, float iz,
+        float minX, float minY, float minZ, float maxX, float maxY, float maxZ,
+        float tLimit, float& outNear) {
+        float tx0 = (minX - ox) * ix, tx1 = (maxX - ox) * ix;
+        float ty0 = (minY - oy) * iy, ty1 = (maxY - oy) * iy;
+        float tz0 = (minZ - oz) * iz, tz1 = (maxZ - oz) * iz;
+        float tNear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::min(tz0, tz1));
+        float tFar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::max(tz0, tz1));
+        outNear = tNear;
+        if (std::isnan(tx0) || std::isnan(tx1) || std::isnan(ty0) || std::isnan(ty1) || std::isnan(tz0) || std::isnan(tz1)) {
+            return false;
+        }
+        return tNear <= tFar && tFar >= 0.0f && tNear <= tLimit;
+    }
+
+#ifdef RAYBOX_USE_SSE
+    // Four slab tests, whatever is broadcast and whatever varies per lane
+    int Slab4(__m128 ox, __m128 oy, __m128 oz, __m128 ix, __m128 iy, __m128 iz,
+        __m128 minX, __m128 minY, __m128 minZ, __m128 maxX, __m128 maxY, __m128 maxZ,
+        __m128 tLimit, float* outNear) {
+        __m128 tx0 = _mm_mul_ps(_mm_sub_ps(minX, ox), ix);
+        __m128 tx1 = _mm_mul_ps(_mm_sub_ps(maxX, ox), ix);
+        __m128 ty0 = _mm_mul_ps(_mm_sub_ps(minY, oy), iy);
+        __m128 ty1 = _mm_mul_ps(_mm_sub_ps(maxY, oy), iy);
+        __m128 tz0 = _mm_mul_ps(_mm_sub_ps(minZ, oz), iz);
+        __m128 tz1 = _mm_mul_ps(_mm_sub_ps(maxZ, oz), iz);
+        __m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_min_ps(tz0, tz1));
+        __m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_max_ps(tz0, tz1));
+        _mm_storeu_ps(outNear, tNear);
+        __m128 grazing = _mm_or_ps(_mm_cmpunord_ps(tx0, tx1), _mm_or_ps(_mm_cmpunord_ps(ty0, ty1), _mm_cmpunord_ps(tz0, tz1)));
+        __m128 hit = _mm_and_ps(_mm_cmple_ps(tNear, tFar),
+            _mm_and_ps(_mm_cmpge_ps(tFar, _mm_setzero_ps()), _mm_cmple_ps(tNear, tLimit)));
+        return _mm_movemask_ps(_mm_andnot_ps(grazing, hit));
+    }
+
+    int Boxes4(const Ray& ray, const float* minX, const float* minY, const float* minZ,
+        const float* maxX, const float* maxY, const float* maxZ, float tLimit, float* outNear) {
+        return Slab4(_mm_set1_ps(ray.origin.x), _mm_set1_ps(ray.origin.y), _mm_set1_ps(ray.origin.z),
+            _mm_set1_ps(ray.invDirection.x), _mm_set1_ps(ray.invDirection.y), _mm_set1_ps(ray.invDirection.z),
+            _mm_loadu_ps(minX), _mm_loadu_ps(minY), _mm_loadu_ps(minZ),
+            _mm_loadu_ps(maxX), _mm_loadu_ps(maxY), _mm_loadu_ps(maxZ), _mm_set1_ps(tLimit), outNear);
+    }
+
+    int Packet4(const float* ox, const float* oy, const float* oz, const float* ix, const float* iy, const float* iz,
+        const AABB& box, float tLimit, float* outNear) {
+        return Slab4(_mm_loadu_ps(ox), _mm_loadu_ps(oy), _mm_loadu_ps(oz),
+            _mm_loadu_ps(ix), _mm_loadu_ps(iy), _mm_loadu_ps(iz),
+            _mm_set1_ps(box.min.x), _mm_set1_ps(box.min.y), _mm_set1_ps(box.min.z),
+            _mm_set1_ps(box.max.x), _mm_set1_ps(box.max.y), _mm_set1_ps(box.max.z), _mm_set1_ps(tLimit), outNear);
+    }
+#else
+    int Boxes4(const Ray& ray, const float* minX, const float* minY, const float* minZ,
+        const float* maxX, const float* maxY, const float* maxZ, float tLimit, float* outNear) {
+        int mask = 0;
+        for (int lane = 0; lane < 4; ++lane) {
+            if (SlabScalar(ray.origin.x, ray.origin.y, ray.origin.z, ray.invDirection.x, ray.invDirection.y, ray.invDirection.z,
+                minX[lane], minY[lane], minZ[lane], maxX[lane], maxY[lane], maxZ[lane], tLimit, outNear[lane])) {
+                mask |= 1 << lane;
+            }
+        }
+        return mask;
+    }
+
+    int Packet4(const float* ox, const float* oy, const float* oz, const float* ix, const float* iy, const float* iz,
+        const AABB& box, float tLimit, float* outNear) {
+        int mask = 0;
+        for (int lane = 0; lane < 4; ++lane) {
+            if (SlabScalar(ox[lane], oy[lane], oz[lane], ix[lane], iy[lane], iz[lane],
+                box.min.x, box.min.y, box.min.z, box.max.x, box.max.y, box.max.z, tLimit, outNear[lane])) {
+                mask |= 1 << lane;
+            }
+        }
+        return mask;
+    }
+#endif
+
+#ifdef RAYBOX_HAS_AVX
+    bool CpuSupportsAvx() {
+#if defined(__AVX__)
+        return true;
+#elif defined(_MSC_VER)
+        // AVX itself, and OSXSAVE so the OS can be asked whether it saves the
+        // 256-bit registers on a context switch
+        int info[4];
+        __cpuid(info, 1);
+        if ((info[2] & (1 << 28)) == 0 || (info[2] & (1 << 27)) == 0) {
+            return false;
+        }
+        return (_xgetbv(0) & 0x6) == 0x6;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx") != 0;
+#endif
+    }
+
+    const bool g_UseAvx = CpuSupportsAvx();
+
+    RAYBOX_AVX_TARGET int Slab8(__m256 ox, __m256 oy, __m256 oz, __m256 ix, __m256 iy, __m256 iz,
+        __m256 minX, __m256 minY, __m256 minZ, __m256 maxX, __m256 maxY, __m256 maxZ,
+        __m256 tLimit, float* outNear) {
+        __m256 tx0 = _mm256_mul_ps(_mm256_sub_ps(minX, ox), ix);
+        __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(maxX, ox), ix);
+        __m256 ty0 = _mm256_mul_ps(_mm256_sub_ps(minY, oy), iy);
+        __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(maxY, oy), iy);
+        __m256 tz0 = _mm256_mul_ps(_mm256_sub_ps(minZ, oz), iz);
+        __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(maxZ, oz), iz);
+        __m256 tNear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)), _mm256_min_ps(tz0, tz1));
+        __m256 tFar = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)), _mm256_max_ps(tz0, tz1));
+        _mm256_storeu_ps(outNear, tNear);
+        __m256 grazing = _mm256_or_ps(_mm256_cmp_ps(tx0, tx1, _CMP_UNORD_Q),
+            _mm256_or_ps(_mm256_cmp_ps(ty0, ty1, _CMP_UNORD_Q), _mm256_cmp_ps(tz0, tz1, _CMP_UNORD_Q)));
+        __m256 hit = _mm256_and_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ),
+            _mm256_and_ps(_mm256_cmp_ps(tFar, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(tNear, tLimit, _CMP_LE_OQ)));
+        return _mm256_movemask_ps(_mm256_andnot_ps(grazing, hit));
+    }
+
+    RAYBOX_AVX_TARGET int Boxes8Avx(const Ray& ray, const AABB8& boxes, float tLimit, float* outNear) {
+        return Slab8(_mm256_set1_ps(ray.origin.x), _mm256_set1_ps(ray.origin.y), _mm256_set1_ps(ray.origin.z),
+            _mm256_set1_ps(ray.invDirection.x), _mm256_set1_ps(ray.invDirection.y), _mm256_set1_ps(ray.invDirection.z),
+            _mm256_load_ps(boxes.minX), _mm256_load_ps(boxes.minY), _mm256_load_ps(boxes.minZ),
+            _mm256_load_ps(boxes.maxX), _mm256_load_ps(boxes.maxY), _mm256_load_ps(boxes.maxZ), _mm256_set1_ps(tLimit), outNear);
+    }
+
+    RAYBOX_AVX_TARGET int Packet8Avx(const RayPacket8& rays, const AABB& box, float tLimit, float* outNear) {
+        return Slab8(_mm256_load_ps(rays.originX), _mm256_load_ps(rays.originY), _mm256_load_ps(rays.originZ),
+            _mm256_load_ps(rays.invDirX), _mm256_load_ps(rays.invDirY), _mm256_load_ps(rays.invDirZ),
+            _mm256_set1_ps(box.min.x), _mm256_set1_ps(box.min.y), _mm256_set1_ps(box.min.z),
+            _mm256_set1_ps(box.max.x), _mm256_set1_ps(box.max.y), _mm256_set1_ps(box.max.z), _mm256_set1_ps(tLimit), outNear);
+    }
+#endif
+}
+
+void AABB4::Set(int lane, const AABB& box) {
+    minX[lane] = box.min.x;
+    minY[lane] = box.min.y;
+    minZ[lane] = box.min.z;
+    maxX[lane] = box.max.x;
+    maxY[lane] = box.max.y;
+    maxZ[lane] = box.max.z;
+    laneMask |= 1u << lane;
+}
+
+void AABB8::Set(int lane, const AABB& box) {
+    minX[lane] = box.min.x;
+    minY[lane] = box.min.y;
+    minZ[lane] = box.min.z;
+    maxX[lane] = box.max.x;
+    maxY[lane] = box.max.y;
+    maxZ[lane] = box.max.z;
+    laneMask |= 1u << lane;
+}
+
+void RayPacket4::Set(int lane, const Ray& ray) {
+    originX[lane] = ray.origin.x;
+    originY[lane] = ray.origin.y;
+    originZ[lane] = ray.origin.z;
+    invDirX[lane] = ray.invDirection.x;
+    invDirY[lane] = ray.invDirection.y;
+    invDirZ[lane] = ray.invDirection.z;
+    laneMask |= 1u << lane;
+}
+
+void RayPacket8::Set(int lane, const Ray& ray) {
+    originX[lane] = ray.origin.x;
+    originY[lane] = ray.origin.y;
+    originZ[lane] = ray.origin.z;
+    invDirX[lane] = ray.invDirection.x;
+    invDirY[lane] = ray.invDirection.y;
+    invDirZ[lane] = ray.invDirection.z;
+    laneMask |= 1u << lane;
+}
+
+bool RayBoxKernels::IntersectBox(const Ray& ray, const AABB& box, float tLimit, float& outNear) {
+    return SlabScalar(ray.origin.x, ray.origin.y, ray.origin.z, ray.invDirection.x, ray.invDirection.y, ray.invDirection.z,
+        box.min.x, box.min.y, box.min.z, box.max.x, box.max.y, box.max.z, tLimit, outNear);
+}
+
+int RayBoxKernels::IntersectBoxes4(const Ray& ray, const AABB4& boxes, float tLimit, float outNear[4]) {
+    return Boxes4(ray, boxes.minX, boxes.minY, boxes.minZ, boxes.maxX, boxes.maxY, boxes.maxZ, tLimit, outNear)
+        & static_cast<int>(boxes.laneMask);
+}
+
+int RayBoxKernels::IntersectBoxes8(const Ray& ray, const AABB8& boxes, float tLimit, float outNear[8]) {
+#ifdef RAYBOX_HAS_AVX
+    if (g_UseAvx) {
+        return Boxes8Avx(ray, boxes, tLimit, outNear) & static_cast<int>(boxes.laneMask);
+    }
+#endif
+    // Two four-wide halves
+    int mask = Boxes4(ray, boxes.minX, boxes.minY, boxes.minZ, boxes.maxX, boxes.maxY, boxes.maxZ, tLimit, outNear) |
+        (Boxes4(ray, boxes.minX + 4, boxes.minY + 4, boxes.minZ + 4, boxes.maxX + 4, boxes.maxY + 4, boxes.maxZ + 4,
+            tLimit, outNear + 4) << 4);
+    return mask & static_cast<int>(boxes.laneMask);
+}
+
+int RayBoxKernels::IntersectPacket4(const RayPacket4& rays, const AABB& box, float tLimit, float outNear[4]) {
+    return Packet4(rays.originX, rays.originY, rays.originZ, rays.invDirX, rays.invDirY, rays.invDirZ, box, tLimit, outNear)
+        & static_cast<int>(rays.laneMask);
+}
+
+int RayBoxKernels::IntersectPacket8(const RayPacket8& rays, const AABB& box, float tLimit, float outNear[8]) {
+#ifdef RAYBOX_HAS_AVX
+    if (g_UseAvx) {
+        return Packet8Avx(rays, box, tLimit, outNear) & static_cast<int>(rays.laneMask);
+    }
+#endif
+    int mask = Packet4(rays.originX, rays.originY, rays.originZ, rays.invDirX, rays.invDirY, rays.invDirZ, box, tLimit, outNear) |
+        (Packet4(rays.originX + 4, rays.originY + 4, rays.originZ + 4, rays.invDirX + 4, rays.invDirY + 4, rays.invDirZ + 4,
+            box, tLimit, outNear + 4) << 4);
+    return mask & static_cast<int>(rays.laneMask);
+}
+
+const char* RayBoxKernels::GetInstructionSet() {
+#ifdef RAYBOX_HAS_AVX
+    if (g_UseAvx) {
+        return "AVX";
+    }
+#endif
+#ifdef RAYBOX_USE_SSE
+    return "SSE";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "AABB.h"
+#include "Ray.h"
+
+#include <cfloat>
+#include <cstdint>
+
+// Wide ray-box slab tests. Boxes and rays are stored as structures of arrays so a
+// single instruction handles every lane: one ray against 4 or 8 boxes, or a packet
+// of 4 or 8 coherent rays against one box. The reciprocal direction comes from the
+// Ray, so no test divides. SSE is used where available, AVX for the 8-wide kernels
+// when the processor supports it, and plain loops otherwise.
+//
+// Every kernel returns a bit mask with bit i set when lane i hits within
+// [0, tLimit], and writes the entry distance of each lane to outNear. Like
+// Ray::intersectsAABB, the entry distance is negative when the origin is inside.
+
+// Four boxes, lane by lane. Unused lanes never hit.
+struct alignas(16) AABB4 {
+    float minX[4], minY[4], minZ[4];
+    float maxX[4], maxY[4], maxZ[4];
+    uint32_t laneMask = 0;
+
+    void Set(int lane, const AABB& box);
+};
+
+struct alignas(32) AABB8 {
+    float minX[8], minY[8], minZ[8];
+    float maxX[8], maxY[8], maxZ[8];
+    uint32_t laneMask = 0;
+
+    void Set(int lane, const AABB& box);
+};
+
+// Four rays, lane by lane, for packets cast from nearby pixels
+struct alignas(16) RayPacket4 {
+    float originX[4], originY[4], originZ[4];
+    float invDirX[4], invDirY[4], invDirZ[4];
+    uint32_t laneMask = 0;
+
+    void Set(int lane, const Ray& ray);
+};
+
+struct alignas(32) RayPacket8 {
+    float originX[8], originY[8], originZ[8];
+    float invDirX[8], invDirY[8], invDirZ[8];
+    uint32_t laneMask = 0;
+
+    void Set(int lane, const Ray& ray);
+};
+
+namespace RayBoxKernels {
+    // One ray, one box; the scalar form the wide kernels are checked against
+    bool IntersectBox(const Ray& ray, const AABB& box, float tLimit, float& outNear);
+
+    int IntersectBoxes4(const Ray& ray, const AABB4& boxes, float tLimit, float outNear[4]);
+    int IntersectBoxes8(const Ray& ray, const AABB8& boxes, float tLimit, float outNear[8]);
+
+    int IntersectPacket4(const RayPacket4& rays, const AABB& box, float tLimit, float outNear[4]);
+    int IntersectPacket8(const RayPacket8& rays, const AABB& box, float tLimit, float outNear[8]);
+
+    // Which instruction set the widest kernels run with on this processor
+    const char* GetInstructionSet();
+}
@@ -0,0 +1,371 @@
+#include "RenderQueue.h"
+#include "SceneManager.h"
+#include "ShaderManager.h"
+
+#include <algorithm>
+
+namespace {
+    const uint32_t g_DepthBits = 24;
+    const uint32_t g_DepthMax = (1u << g_DepthBits) - 1;
+    const uint32_t g_MeshBits = 20;
+    const uint32_t g_MeshMax = (1u << g_MeshBits) - 1;
+
+    ShapeMeshes::SharedMesh ToSharedMesh(SceneNode::MeshType type) {
+        switch (type) {
+        case SceneNode::MeshType::Box: return ShapeMeshes::SharedMesh::Box;
+        case SceneNode::MeshType::Sphere: return ShapeMeshes::SharedMesh::Sphere;
+        case SceneNode::MeshType::Cylinder: return ShapeMeshes::SharedMesh::Cylinder;
+        case SceneNode::MeshType::Plane: return ShapeMeshes::SharedMesh::Plane;
+        default: return ShapeMeshes::SharedMesh::Pyramid4;
+        }
+    }
+}
+
+uint64_t RenderQueue::MakeKey(uint32_t program, uint32_t texture, uint32_t material, uint32_t mesh, uint32_t depth) {
+    return (static_cast<uint64_t>(program & 0xF) << 60) |
+        (static_cast<uint64_t>(texture & 0xFF) << 52) |
+        (static_cast<uint64_t>(material & 0xFF) << 44) |
+        (static_cast<uint64_t>(mesh & g_MeshMax) << 24) |
+        static_cast<uint64_t>(depth & g_DepthMax);
+}
+
+void RenderQueue::Begin(const glm::vec3& viewPosition, float farPlane) {
+    m_items.clear();
+    m_entries.clear();
+    m_viewPosition = viewPosition;
+    m_farPlane = farPlane > 0.0f ? farPlane : 1.0f;
+    m_recorded = true;
+    m_sorted = false;
+    m_keysStale = false;
+    m_recordedThisFrame = true;
+}
+
+void RenderQueue::SetViewPosition(const glm::vec3& viewPosition) {
+    if (viewPosition != m_viewPosition) {
+        m_viewPosition = viewPosition;
+        m_keysStale = true;
+    }
+}
+
+void RenderQueue::BeginRewrite(uint32_t first) {
+    m_rewriting = true;
+    m_rewriteOverflow = false;
+    m_rewriteCursor = first;
+}
+
+bool RenderQueue::EndRewrite(uint32_t end) {
+    m_rewriting = false;
+    return !m_rewriteOverflow && m_rewriteCursor == end;
+}
+
+uint64_t RenderQueue::MakeItemKey(const DrawItem& item) const {
+    // Front to back within a state group, so early depth rejection can help
+    float distance = glm::length(glm::vec3(item.model[3]) - m_viewPosition);
+    uint32_t depth = static_cast<uint32_t>(std::min(distance / m_farPlane, 1.0f) * g_DepthMax);
+    // Each level of detail is a separate mesh as far as state changes go
+    return MakeKey(item.program, item.texture, item.material, item.mesh * ShapeMeshes::LodCount + item.lod, depth);
+}
+
+void RenderQueue::Add(const glm::mat4& model, const glm::mat3& normalMatrix,
+    const std::string& materialTag, const std::string& textureTag, int textureSlot,
+    void (*drawFunc)(ShapeMeshes*), SceneNode::MeshType meshType, bool highlighted, int lod, uint32_t program) {
+    DrawItem item;
+    item.model = model;
+    item.normalMatrix = normalMatrix;
+    item.drawFunction = drawFunc;
+    item.meshType = meshType;
+    item.mesh = InternMesh(drawFunc);
+    item.program = program;
+    item.material = InternMaterial(materialTag);
+    item.texture = InternTexture(textureTag, textureSlot);
+    item.textureSlot = textureSlot;
+    item.highlighted = highlighted;
+    item.visible = true;
+    bool hasLods = meshType != SceneNode::MeshType::Custom && ShapeMeshes::HasLodChain(ToSharedMesh(meshType));
+    item.lod = static_cast<uint8_t>(hasLods ? std::max(0, std::min(lod, ShapeMeshes::LodCount - 1)) : 0);
+
+    if (m_rewriting) {
+        if (m_rewriteCursor >= m_items.size()) {
+            m_rewriteOverflow = true;
+            return;
+        }
+        // The entry pointing at this item picks up its new key on the next sort;
+        // it keeps its visibility until the next cull pass
+        item.visible = m_items[m_rewriteCursor].visible;
+        m_items[m_rewriteCursor++] = item;
+        m_keysStale = true;
+        ++m_rewrittenThisFrame;
+        return;
+    }
+
+    SortEntry entry;
+    entry.key = MakeItemKey(item);
+    entry.item = static_cast<uint32_t>(m_items.size());
+    m_items.push_back(item);
+    m_entries.push_back(entry);
+}
+
+void RenderQueue::SetPacketsVisible(uint32_t first, uint32_t end, bool visible) {
+    end = std::min(end, static_cast<uint32_t>(m_items.size()));
+    for (uint32_t i = first; i < end; ++i) {
+        if (m_items[i].visible != visible) {
+            m_items[i].visible = visible;
+            // The uploaded instance records no longer match the visible set
+            m_instancesStale = true;
+        }
+    }
+}
+
+void RenderQueue::Sort() {
+    if (m_sorted && !m_keysStale) {
+        return;
+    }
+    if (m_keysStale) {
+        for (SortEntry& entry : m_entries) {
+            entry.key = MakeItemKey(m_items[entry.item]);
+        }
+        m_keysStale = false;
+    }
+    m_sorted = true;
+    m_instancesStale = true;
+
+    // LSD radix sort, one byte per pass; stable, so equal keys keep tree order
+    m_scratch.resize(m_entries.size());
+    for (uint32_t shift = 0; shift < 64; shift += 8) {
+        size_t counts[256] = {};
+        for (const SortEntry& entry : m_entries) {
+            ++counts[(entry.key >> shift) & 0xFF];
+        }
+        // A byte that is the same in every key would only copy the array
+        if (std::find(counts, counts + 256, m_entries.size()) != counts + 256) {
+            continue;
+        }
+
+        size_t offset = 0;
+        for (size_t& count : counts) {
+            size_t c = count;
+            count = offset;
+            offset += c;
+        }
+        for (const SortEntry& entry : m_entries) {
+            m_scratch[counts[(entry.key >> shift) & 0xFF]++] = entry;
+        }
+        m_entries.swap(m_scratch);
+    }
+}
+
+void RenderQueue::Submit(SceneManager* sceneManager, ShaderManager* shaderManager, ShapeMeshes* meshes) {
+    m_stats = Stats();
+    m_stats.recorded = m_recordedThisFrame;
+    m_stats.rewrittenPackets = m_rewrittenThisFrame;
+    m_recordedThisFrame = false;
+    m_rewrittenThisFrame = 0;
+    // The items are stored in the order the scene collected them, so the same
+    // draws submitted unsorted would change state at every transition counted here
+    int treeMaterial = -1;
+    int treeTexture = -1;
+    for (const DrawItem& item : m_items) {
+        if (!item.visible) {
+            ++m_stats.culledDraws;
+            continue;
+        }
+        if (IsInstanced(item)) {
+            continue;
+        }
+        if (item.material != treeMaterial) {
+            treeMaterial = item.material;
+            ++m_stats.treeOrderMaterialChanges;
+        }
+        if (item.texture != treeTexture) {
+            treeTexture = item.texture;
+            ++m_stats.treeOrderTextureChanges;
+        }
+    }
+    m_stats.draws = m_entries.size() - m_stats.culledDraws;
+
+    const SceneManager::SCENE_UNIFORMS& uniforms = sceneManager->GetUniforms();
+    int lastMaterial = -1;
+    int lastTexture = -1;
+    int lastHighlight = -1;
+
+    for (const SortEntry& entry : m_entries) {
+        const DrawItem& item = m_items[entry.item];
+        if (!item.visible) {
+            continue;
+        }
+        if (meshes && item.meshType != SceneNode::MeshType::Custom) {
+            ShapeMeshes::SharedMesh mesh = ToSharedMesh(item.meshType);
+            m_stats.triangles += meshes->GetTriangleCount(mesh, item.lod);
+            m_stats.fullDetailTriangles += meshes->GetTriangleCount(mesh, 0);
+        }
+        if (IsInstanced(item)) {
+            continue;
+        }
+
+        if (item.material != lastMaterial) {
+            sceneManager->SetShaderMaterial(m_materialTags[item.material]);
+            lastMaterial = item.material;
+            ++m_stats.materialChanges;
+        }
+        if (item.texture != lastTexture) {
+            sceneManager->SetShaderTexture(m_textureTags[item.texture], item.textureSlot);
+            lastTexture = item.texture;
+            ++m_stats.textureChanges;
+        }
+        if (static_cast<int>(item.highlighted) != lastHighlight) {
+            shaderManager->setBoolValue(uniforms.highlight, item.highlighted);
+            lastHighlight = item.highlighted;
+            ++m_stats.highlightChanges;
+        }
+
+        shaderManager->setMat4Value(uniforms.model, item.model);
+        shaderManager->setMat3Value(uniforms.normalMatrix, item.normalMatrix);
+        if (item.lod > 0 && meshes) {
+            meshes->DrawMeshLod(ToSharedMesh(item.meshType), item.lod);
+            ++m_stats.drawCalls;
+        }
+        else if (item.drawFunction && meshes) {
+            item.drawFunction(meshes);
+            ++m_stats.drawCalls;
+        }
+    }
+}
+
+void RenderQueue::SubmitInstanced(SceneManager* sceneManager, ShapeMeshes* meshes) {
+    if (!m_instancingEnabled || !meshes) {
+        return;
+    }
+
+    // A replayed frame draws from the instance buffer uploaded after the last sort
+    if (m_instancesStale) {
+        RebuildInstances(sceneManager, meshes);
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < InstanceSlotCount; ++i) {
+        total += m_meshCounts[i];
+    }
+    if (total == 0) {
+        return;
+    }
+
+    // With every primitive in one buffer, the whole set goes out as a single
+    // multi-draw whose commands each point at one mesh's slice of the instances
+    if (meshes->HasSharedMeshBuffer()) {
+        meshes->MultiDrawSharedMeshes(m_commands.data(), static_cast<GLsizei>(m_commands.size()));
+        ++m_stats.drawCalls;
+        m_stats.instancedDraws += total;
+        return;
+    }
+
+    for (size_t i = 0; i < InstanceSlotCount; ++i) {
+        if (m_meshCounts[i] == 0) {
+            continue;
+        }
+        SceneNode::MeshType meshType = static_cast<SceneNode::MeshType>(i / ShapeMeshes::LodCount);
+        meshes->DrawMeshLodInstanced(ToSharedMesh(meshType), static_cast<int>(i % ShapeMeshes::LodCount),
+            static_cast<GLsizei>(m_meshCounts[i]), static_cast<GLuint>(m_meshStarts[i]));
+        ++m_stats.drawCalls;
+        m_stats.instancedDraws += m_meshCounts[i];
+    }
+}
+
+void RenderQueue::RebuildInstances(SceneManager* sceneManager, ShapeMeshes* meshes) {
+    m_instancesStale = false;
+
+    // Counting sort by mesh type and level of detail; walking the sorted
+    // entries keeps each mesh's instances in key order
+    std::fill(m_meshCounts, m_meshCounts + InstanceSlotCount, 0);
+    for (const SortEntry& entry : m_entries) {
+        const DrawItem& item = m_items[entry.item];
+        if (item.visible && IsInstanced(item)) {
+            ++m_meshCounts[GetInstanceSlot(item)];
+        }
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < InstanceSlotCount; ++i) {
+        m_meshStarts[i] = total;
+        total += m_meshCounts[i];
+    }
+    m_commands.clear();
+    if (total == 0) {
+        return;
+    }
+
+    m_instances.resize(total);
+    size_t cursors[InstanceSlotCount];
+    std::copy(m_meshStarts, m_meshStarts + InstanceSlotCount, cursors);
+    for (const SortEntry& entry : m_entries) {
+        const DrawItem& item = m_items[entry.item];
+        if (!item.visible || !IsInstanced(item)) {
+            continue;
+        }
+        ShapeMeshes::InstanceData& instance = m_instances[cursors[GetInstanceSlot(item)]++];
+        instance.model = item.model;
+        instance.normalMatrix = item.normalMatrix;
+        instance.textureIndex = item.textureSlot;
+        int& materialIndex = m_materialBlockIndices[item.material];
+        if (materialIndex < 0) {
+            materialIndex = sceneManager->FindMaterialIndex(m_materialTags[item.material]);
+        }
+        instance.materialIndex = materialIndex;
+        instance.highlight = item.highlighted ? 1 : 0;
+        instance.padding = 0;
+    }
+    meshes->UploadInstanceData(m_instances.data(), static_cast<GLsizei>(total));
+
+    if (meshes->HasSharedMeshBuffer()) {
+        for (size_t i = 0; i < InstanceSlotCount; ++i) {
+            if (m_meshCounts[i] == 0) {
+                continue;
+            }
+            SceneNode::MeshType meshType = static_cast<SceneNode::MeshType>(i / ShapeMeshes::LodCount);
+            m_commands.push_back(meshes->GetSharedMeshCommand(ToSharedMesh(meshType), static_cast<GLuint>(m_meshCounts[i]),
+                static_cast<GLuint>(m_meshStarts[i]), static_cast<int>(i % ShapeMeshes::LodCount)));
+        }
+    }
+}
+
+bool RenderQueue::IsInstanced(const DrawItem& item) const {
+    return m_instancingEnabled && item.meshType != SceneNode::MeshType::Custom;
+}
+
+size_t RenderQueue::GetInstanceSlot(const DrawItem& item) {
+    return static_cast<size_t>(item.meshType) * ShapeMeshes::LodCount + item.lod;
+}
+
+uint16_t RenderQueue::InternMaterial(const std::string& tag) {
+    std::unordered_map<std::string, uint16_t>::iterator found = m_materialIds.find(tag);
+    if (found != m_materialIds.end()) {
+        return found->second;
+    }
+    uint16_t id = static_cast<uint16_t>(m_materialTags.size());
+    m_materialIds[tag] = id;
+    m_materialTags.push_back(tag);
+    m_materialBlockIndices.push_back(-1);
+    return id;
+}
+
+uint16_t RenderQueue::InternTexture(const std::string& tag, int slot) {
+    std::vector<std::pair<int, uint16_t>>& slots = m_textureIds[tag];
+    for (const std::pair<int, uint16_t>& entry : slots) {
+        if (entry.first == slot) {
+            return entry.second;
+        }
+    }
+    uint16_t id = static_cast<uint16_t>(m_textureTags.size());
+    slots.push_back(std::make_pair(slot, id));
+    m_textureTags.push_back(tag);
+    return id;
+}
+
+uint32_t RenderQueue::InternMesh(void (*drawFunc)(ShapeMeshes*)) {
+    std::unordered_map<void (*)(ShapeMeshes*), uint32_t>::iterator found = m_meshIds.find(drawFunc);
+    if (found != m_meshIds.end()) {
+        return found->second;
+    }
+    uint32_t id = static_cast<uint32_t>(m_meshIds.size());
+    m_meshIds[drawFunc] = id;
+    return id;
+}
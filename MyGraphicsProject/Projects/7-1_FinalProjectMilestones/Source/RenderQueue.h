@@ -0,0 +1,158 @@
+#pragma once
+
+#include "SceneNode.h"
+#include "ShapeMeshes.h"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class SceneManager;
+class ShaderManager;
+
+// Per-frame list of draws. The scene traversal appends packets in tree order, the
+// queue radix-sorts them on a packed 64-bit key so draws sharing program, texture,
+// material and mesh sit next to each other, and submission skips repeated state.
+//
+// The packets are retained between frames. While the scene is unchanged they are
+// replayed as they are; nodes that changed rewrite their own packets in place, and
+// only a camera move or a rewrite makes the queue sort again.
+class RenderQueue {
+public:
+    // Counters for the last submitted frame. The tree-order figures are the material
+    // and texture changes the same draws would need submitted unsorted, in the order
+    // the scene collected them.
+    struct Stats {
+        size_t draws = 0;
+        size_t materialChanges = 0;
+        size_t textureChanges = 0;
+        size_t highlightChanges = 0;
+        size_t treeOrderMaterialChanges = 0;
+        size_t treeOrderTextureChanges = 0;
+        // GL draw calls issued; with instancing, many draws share one call
+        size_t drawCalls = 0;
+        size_t instancedDraws = 0;
+        // true when the packets were collected from the scene rather than replayed
+        bool recorded = false;
+        size_t rewrittenPackets = 0;
+        // recorded packets left out by the last cull pass
+        size_t culledDraws = 0;
+        // triangles of the primitive meshes drawn, and what they
+        // would have cost with every mesh at full detail
+        size_t triangles = 0;
+        size_t fullDetailTriangles = 0;
+    };
+
+    // Key layout, most significant first:
+    // program 4 | texture 8 | material 8 | mesh 20 | depth 24
+    // The mesh field holds the mesh id times the level-of-detail count plus the level.
+    // Ids past a field's width only weaken grouping; submission compares the ids.
+    static uint64_t MakeKey(uint32_t program, uint32_t texture, uint32_t material, uint32_t mesh, uint32_t depth);
+
+    // Clears the recorded packets; depth is measured from viewPosition up to farPlane
+    void Begin(const glm::vec3& viewPosition, float farPlane);
+    // Packets stay valid until Begin; Invalidate makes the scene collect them again
+    bool IsRecorded() const { return m_recorded; }
+    void Invalidate() { m_recorded = false; }
+    // Re-sorts on the next Sort only if the position moved
+    void SetViewPosition(const glm::vec3& viewPosition);
+    // Adds issued between these overwrite recorded packets from first onwards instead
+    // of appending; EndRewrite returns false unless they ended exactly at end
+    void BeginRewrite(uint32_t first);
+    bool EndRewrite(uint32_t end);
+    // lod is ignored for meshes without coarser levels
+    void Add(const glm::mat4& model, const glm::mat3& normalMatrix,
+        const std::string& materialTag, const std::string& textureTag, int textureSlot,
+        void (*drawFunc)(ShapeMeshes*), SceneNode::MeshType meshType, bool highlighted, int lod = 0, uint32_t program = 0);
+    // Shows or hides the recorded packets [first, end); hidden packets stay in the
+    // queue, so visibility can flip every frame without recording again
+    void SetPacketsVisible(uint32_t first, uint32_t end, bool visible);
+    // Does nothing when neither the packets nor the view changed since the last sort
+    void Sort();
+    // Draws the packets one at a time. With instancing enabled, packets for the basic
+    // primitives are left for SubmitInstanced and only custom meshes are drawn here.
+    void Submit(SceneManager* sceneManager, ShaderManager* shaderManager, ShapeMeshes* meshes);
+    // Uploads one instance record per primitive packet and draws each primitive mesh
+    // with a single instanced call, or all of them with one multi-draw when the meshes
+    // share a buffer. Expects the instanced program to be in use.
+    void SubmitInstanced(SceneManager* sceneManager, ShapeMeshes* meshes);
+
+    void SetInstancingEnabled(bool enabled) { m_instancingEnabled = enabled; m_instancesStale = true; }
+    bool IsInstancingEnabled() const { return m_instancingEnabled; }
+
+    size_t GetPacketCount() const { return m_entries.size(); }
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    struct DrawItem {
+        glm::mat4 model;
+        glm::mat3 normalMatrix;
+        void (*drawFunction)(ShapeMeshes*);
+        SceneNode::MeshType meshType;
+        uint32_t mesh;
+        uint32_t program;
+        uint16_t material;
+        uint16_t texture;
+        int textureSlot;
+        bool highlighted;
+        bool visible;
+        uint8_t lod;
+    };
+
+    // Only keys and item indices move during the sort
+    struct SortEntry {
+        uint64_t key;
+        uint32_t item;
+    };
+
+    uint64_t MakeItemKey(const DrawItem& item) const;
+    uint16_t InternMaterial(const std::string& tag);
+    uint16_t InternTexture(const std::string& tag, int slot);
+    uint32_t InternMesh(void (*drawFunc)(ShapeMeshes*));
+
+    std::vector<DrawItem> m_items;
+    std::vector<SortEntry> m_entries;
+    std::vector<SortEntry> m_scratch;
+
+    // Ids are stable across frames, so keys stay comparable frame to frame
+    std::unordered_map<std::string, uint16_t> m_materialIds;
+    std::vector<std::string> m_materialTags;
+    // Entry of each interned material in the scene's material block, or -1 until looked up
+    std::vector<int> m_materialBlockIndices;
+    // Texture state is the tag plus its slot; a tag is rarely bound to more than one
+    std::unordered_map<std::string, std::vector<std::pair<int, uint16_t>>> m_textureIds;
+    std::vector<std::string> m_textureTags;
+    std::unordered_map<void (*)(ShapeMeshes*), uint32_t> m_meshIds;
+
+    bool IsInstanced(const DrawItem& item) const;
+    // Instanced packets are grouped by mesh type and level of detail
+    static size_t GetInstanceSlot(const DrawItem& item);
+    static const size_t InstanceSlotCount = static_cast<size_t>(SceneNode::MeshType::Custom) * ShapeMeshes::LodCount;
+    // Regroups the instanced packets by mesh and uploads their instance records
+    void RebuildInstances(SceneManager* sceneManager, ShapeMeshes* meshes);
+
+    bool m_recorded = false;
+    bool m_sorted = false;
+    // the packets or view changed, so the keys must be rebuilt before sorting
+    bool m_keysStale = false;
+    bool m_rewriting = false;
+    bool m_rewriteOverflow = false;
+    uint32_t m_rewriteCursor = 0;
+    bool m_recordedThisFrame = false;
+    size_t m_rewrittenThisFrame = 0;
+
+    // Instance records grouped by mesh, rebuilt and uploaded only after a sort
+    std::vector<ShapeMeshes::InstanceData> m_instances;
+    std::vector<ShapeMeshes::DrawElementsIndirectCommand> m_commands;
+    size_t m_meshCounts[InstanceSlotCount] = {};
+    size_t m_meshStarts[InstanceSlotCount] = {};
+    bool m_instancesStale = true;
+    bool m_instancingEnabled = false;
+
+    glm::vec3 m_viewPosition = glm::vec3(0.0f);
+    float m_farPlane = 100.0f;
+    Stats m_stats;
+};
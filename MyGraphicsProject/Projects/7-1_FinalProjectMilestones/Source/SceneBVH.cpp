@@ -0,0 +1,499 @@
+#include "SceneBVH.h"
+#include "BinnedSah.h"
+#include "SceneNode.h"
+#include "RayBoxKernels.h"
+#include "Prefab.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+namespace {
+    // Nodes with this many leaves or fewer are never split
+    const uint32_t g_MaxLeafSize = 2;
+    // Deep enough for any scene this project builds; deeper nodes stay leaves
+    const int g_MaxDepth = 48;
+    // Packets per worker chunk in a batch query, and the fewest worth spreading out
+    const size_t g_BatchPacketGrain = 16;
+    const size_t g_MinParallelPackets = 64;
+    const uint32_t g_NoLeaf = 0xFFFFFFFFu;
+}
+
+void SceneBVH::Clear() {
+    m_nodes.clear();
+    m_leaves.clear();
+    m_leafOrder.clear();
+    m_leafOfSlot.clear();
+    m_centers.clear();
+    m_stats = Stats();
+}
+
+bool SceneBVH::CaptureLeaf(const SceneNode* node, Leaf& outLeaf) {
+    // Grouping nodes draw nothing and have empty bounds of their own
+    if (node->GetWorldBounds().IsEmpty()) {
+        return false;
+    }
+    outLeaf.worldBounds = node->GetWorldBounds();
+    outLeaf.toLocal = node->GetInverseWorldMatrix();
+    outLeaf.localBounds = node->GetLocalBounds();
+    outLeaf.prefab = node->GetPrefab();
+    outLeaf.meshType = node->GetMeshType();
+    outLeaf.handle = node->GetHandle();
+    return true;
+}
+
+void SceneBVH::CaptureLeaves(const SceneNode* root, std::vector<Leaf>& outLeaves) {
+    Leaf leaf;
+    if (CaptureLeaf(root, leaf)) {
+        outLeaves.push_back(leaf);
+    }
+    for (const SceneNode* child : root->GetChildren()) {
+        CaptureLeaves(child, outLeaves);
+    }
+}
+
+void SceneBVH::Build(const SceneNode* root) {
+    std::vector<Leaf> leaves;
+    if (root) {
+        CaptureLeaves(root, leaves);
+    }
+    Build(std::move(leaves));
+}
+
+void SceneBVH::Build(std::vector<Leaf> leaves) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Clear();
+    m_leaves = std::move(leaves);
+    if (!m_leaves.empty()) {
+        m_leafOrder.reserve(m_leaves.size());
+        m_centers.reserve(m_leaves.size());
+        for (size_t leaf = 0; leaf < m_leaves.size(); ++leaf) {
+            m_leafOrder.push_back(static_cast<uint32_t>(leaf));
+            m_centers.push_back(m_leaves[leaf].worldBounds.GetCenter());
+            uint32_t slot = m_leaves[leaf].handle.index;
+            if (slot >= m_leafOfSlot.size()) {
+                m_leafOfSlot.resize(slot + 1, g_NoLeaf);
+            }
+            m_leafOfSlot[slot] = static_cast<uint32_t>(leaf);
+        }
+        // A binary tree over n leaves has at most 2n - 1 nodes
+        m_nodes.reserve(m_leaves.size() * 2);
+        Node root;
+        root.first = 0;
+        root.count = static_cast<uint32_t>(m_leaves.size());
+        m_nodes.push_back(root);
+        RefitNodes();
+        Subdivide(0, 1);
+        m_centers.clear();
+        m_centers.shrink_to_fit();
+    }
+    m_stats.leaves = m_leaves.size();
+    m_stats.nodes = m_nodes.size();
+    m_stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool SceneBVH::Refit(const SceneNode* root) {
+    std::vector<Leaf> leaves;
+    leaves.reserve(m_leaves.size());
+    if (root) {
+        CaptureLeaves(root, leaves);
+    }
+    return Refit(std::move(leaves));
+}
+
+bool SceneBVH::Refit(std::vector<Leaf> leaves) {
+    if (leaves.size() != m_leaves.size()) {
+        return false;
+    }
+    m_leaves = std::move(leaves);
+    RefitNodes();
+    return true;
+}
+
+size_t SceneBVH::UpdateLeaves(const std::vector<Leaf>& leaves) {
+    size_t applied = 0;
+    for (const Leaf& leaf : leaves) {
+        uint32_t slot = leaf.handle.index;
+        if (slot >= m_leafOfSlot.size() || m_leafOfSlot[slot] == g_NoLeaf) {
+            continue;
+        }
+        Leaf& held = m_leaves[m_leafOfSlot[slot]];
+        if (held.handle != leaf.handle) {
+            continue;
+        }
+        held = leaf;
+        ++applied;
+    }
+    if (applied > 0) {
+        RefitNodes();
+    }
+    return applied;
+}
+
+void SceneBVH::RefitNodes() {
+    // Children always come after their parent, so a reverse sweep sees them first
+    for (size_t i = m_nodes.size(); i-- > 0;) {
+        Node& node = m_nodes[i];
+        node.bounds = AABB();
+        if (node.count > 0) {
+            for (uint32_t leaf = node.first; leaf < node.first + node.count; ++leaf) {
+                node.bounds.Expand(m_leaves[m_leafOrder[leaf]].worldBounds);
+            }
+        }
+        else {
+            node.bounds.Expand(m_nodes[node.first].bounds);
+            node.bounds.Expand(m_nodes[node.first + 1].bounds);
+        }
+    }
+}
+
+void SceneBVH::Subdivide(uint32_t nodeIndex, int depth) {
+    m_stats.depth = std::max(m_stats.depth, depth);
+    Node node = m_nodes[nodeIndex];
+    int axis;
+    float position;
+    if (node.count <= g_MaxLeafSize || depth >= g_MaxDepth || !FindSplit(node, axis, position)) {
+        return;
+    }
+
+    // Partition the leaves, and their centers alongside, about the split plane
+    uint32_t left = node.first;
+    uint32_t right = node.first + node.count;
+    while (left < right) {
+        if (m_centers[left][axis] < position) {
+            ++left;
+        }
+        else {
+            --right;
+            std::swap(m_leafOrder[left], m_leafOrder[right]);
+            std::swap(m_centers[left], m_centers[right]);
+        }
+    }
+    uint32_t leftCount = left - node.first;
+    if (leftCount == 0 || leftCount == node.count) {
+        return;
+    }
+
+    uint32_t childIndex = static_cast<uint32_t>(m_nodes.size());
+    Node leftChild;
+    leftChild.first = node.first;
+    leftChild.count = leftCount;
+    Node rightChild;
+    rightChild.first = left;
+    rightChild.count = node.count - leftCount;
+    for (uint32_t leaf = leftChild.first; leaf < leftChild.first + leftChild.count; ++leaf) {
+        leftChild.bounds.Expand(m_leaves[m_leafOrder[leaf]].worldBounds);
+    }
+    for (uint32_t leaf = rightChild.first; leaf < rightChild.first + rightChild.count; ++leaf) {
+        rightChild.bounds.Expand(m_leaves[m_leafOrder[leaf]].worldBounds);
+    }
+    m_nodes.push_back(leftChild);
+    m_nodes.push_back(rightChild);
+    m_nodes[nodeIndex].first = childIndex;
+    m_nodes[nodeIndex].count = 0;
+
+    Subdivide(childIndex, depth + 1);
+    Subdivide(childIndex + 1, depth + 1);
+}
+
+bool SceneBVH::FindSplit(const Node& node, int& outAxis, float& outPosition) const {
+    return BinnedSah::FindSplit(node.bounds, m_centers.data(), node.first, node.count,
+        [this](uint32_t leaf) { return m_leaves[m_leafOrder[leaf]].worldBounds; }, outAxis, outPosition);
+}
+
+void SceneBVH::SetMeshBVH(SceneNode::MeshType type, const TriangleBVH* bvh) {
+    if (type != SceneNode::MeshType::Custom) {
+        m_meshBvhs[static_cast<int>(type)] = bvh;
+    }
+}
+
+bool SceneBVH::IntersectMesh(const Ray& ray, const glm::mat4& toLocal, SceneNode::MeshType type, const AABB& localBounds,
+    RayHit& hit) const {
+    // The mesh-space ray is traced at unit length; dividing by how much the transform
+    // stretched the direction turns its distances back into world ones
+    glm::vec3 localDirection = glm::vec3(toLocal * glm::vec4(ray.direction, 0.0f));
+    float scale = glm::length(localDirection);
+    if (scale <= 0.0f) {
+        return false;
+    }
+    Ray localRay(glm::vec3(toLocal * glm::vec4(ray.origin, 1.0f)), localDirection);
+
+    const TriangleBVH* mesh = (type != SceneNode::MeshType::Custom) ? m_meshBvhs[static_cast<int>(type)] : nullptr;
+    if (mesh) {
+        TriangleBVH::Hit triangleHit;
+        if (!mesh->Raycast(localRay, hit.distance * scale, triangleHit)) {
+            return false;
+        }
+        hit.distance = triangleHit.distance / scale;
+        hit.triangle = static_cast<int>(triangleHit.triangle);
+        hit.barycentrics = triangleHit.barycentrics;
+        return true;
+    }
+
+    float tNear;
+    if (!RayBoxKernels::IntersectBox(localRay, localBounds, hit.distance * scale, tNear) || tNear <= 0.0f) {
+        return false;
+    }
+    hit.distance = tNear / scale;
+    hit.triangle = -1;
+    hit.barycentrics = glm::vec2(0.0f);
+    return true;
+}
+
+bool SceneBVH::IntersectLeaf(const Ray& ray, const Leaf& leaf, RayHit& hit) const {
+    bool found = false;
+    if (leaf.prefab) {
+        const std::vector<Prefab::Part>& parts = leaf.prefab->GetParts();
+        for (size_t part = 0; part < parts.size(); ++part) {
+            if (IntersectMesh(ray, parts[part].inverseLocalMatrix * leaf.toLocal, parts[part].meshType,
+                SceneNode::GetMeshBounds(parts[part].meshType), hit)) {
+                hit.part = static_cast<int>(part);
+                found = true;
+            }
+        }
+    }
+    else if (IntersectMesh(ray, leaf.toLocal, leaf.meshType, leaf.localBounds, hit)) {
+        hit.part = -1;
+        found = true;
+    }
+    if (found) {
+        hit.handle = leaf.handle;
+    }
+    return found;
+}
+
+bool SceneBVH::Raycast(const Ray& ray, RayHit& hit, TraceStats* stats) const {
+    TraceStats trace;
+    if (stats) {
+        *stats = trace;
+    }
+    float tRoot;
+    if (m_nodes.empty() || !RayBoxKernels::IntersectBox(ray, m_nodes[0].bounds, hit.distance, tRoot)) {
+        return false;
+    }
+
+    // Hits are world distances, so boxes are visited nearest first and any box
+    // starting beyond the closest hit so far is skipped
+    bool found = false;
+    struct Entry {
+        uint32_t node;
+        float tNear;
+    };
+    Entry stack[g_MaxDepth * 2];
+    int stackSize = 0;
+    stack[stackSize++] = { 0, tRoot };
+    while (stackSize > 0) {
+        Entry entry = stack[--stackSize];
+        if (entry.tNear > hit.distance) {
+            continue;
+        }
+        const Node& node = m_nodes[entry.node];
+        ++trace.visitedNodes;
+        if (node.count > 0) {
+            for (uint32_t index = node.first; index < node.first + node.count; ++index) {
+                const Leaf& leaf = m_leaves[m_leafOrder[index]];
+                float tBox;
+                ++trace.testedLeaves;
+                if (!RayBoxKernels::IntersectBox(ray, leaf.worldBounds, hit.distance, tBox)) {
+                    continue;
+                }
+                ++trace.narrowTests;
+                found = IntersectLeaf(ray, leaf, hit) || found;
+            }
+            continue;
+        }
+
+        float tLeft, tRight;
+        bool hitLeft = RayBoxKernels::IntersectBox(ray, m_nodes[node.first].bounds, hit.distance, tLeft);
+        bool hitRight = RayBoxKernels::IntersectBox(ray, m_nodes[node.first + 1].bounds, hit.distance, tRight);
+        if (hitLeft && hitRight) {
+            bool leftFirst = tLeft <= tRight;
+            stack[stackSize++] = leftFirst ? Entry{ node.first + 1, tRight } : Entry{ node.first, tLeft };
+            stack[stackSize++] = leftFirst ? Entry{ node.first, tLeft } : Entry{ node.first + 1, tRight };
+        }
+        else if (hitLeft) {
+            stack[stackSize++] = { node.first, tLeft };
+        }
+        else if (hitRight) {
+            stack[stackSize++] = { node.first + 1, tRight };
+        }
+    }
+    if (stats) {
+        *stats = trace;
+    }
+    return found;
+}
+
+void SceneBVH::RaycastPacket(const RayPacket4& packet, const Ray* rays, RayHit* hits, TraceStats& trace) const {
+    // The kernel takes one limit for the whole packet, the farthest closest hit of its
+    // lanes; each lane then drops out of boxes starting beyond its own closest hit
+    float limit = 0.0f;
+    auto updateLimit = [&]() {
+        limit = 0.0f;
+        for (int lane = 0; lane < 4; ++lane) {
+            if (packet.laneMask & (1u << lane)) {
+                limit = std::max(limit, hits[lane].distance);
+            }
+        }
+    };
+    auto testBox = [&](const AABB& box, float outNear[4], float& outNearest) {
+        int mask = RayBoxKernels::IntersectPacket4(packet, box, limit, outNear);
+        outNearest = FLT_MAX;
+        for (int lane = 0; lane < 4; ++lane) {
+            if (!(mask & (1 << lane))) {
+                continue;
+            }
+            if (outNear[lane] > hits[lane].distance) {
+                mask &= ~(1 << lane);
+            }
+            else {
+                outNearest = std::min(outNearest, outNear[lane]);
+            }
+        }
+        return mask;
+    };
+
+    updateLimit();
+    float tNear[4];
+    float tRoot;
+    if (m_nodes.empty() || testBox(m_nodes[0].bounds, tNear, tRoot) == 0) {
+        return;
+    }
+
+    // Same ordered traversal as Raycast, keyed on the nearest lane
+    struct Entry {
+        uint32_t node;
+        float tNear;
+    };
+    Entry stack[g_MaxDepth * 2];
+    int stackSize = 0;
+    stack[stackSize++] = { 0, tRoot };
+    while (stackSize > 0) {
+        Entry entry = stack[--stackSize];
+        if (entry.tNear > limit) {
+            continue;
+        }
+        const Node& node = m_nodes[entry.node];
+        ++trace.visitedNodes;
+        if (node.count > 0) {
+            for (uint32_t index = node.first; index < node.first + node.count; ++index) {
+                const Leaf& leaf = m_leaves[m_leafOrder[index]];
+                float tBox;
+                ++trace.testedLeaves;
+                int mask = testBox(leaf.worldBounds, tNear, tBox);
+                for (int lane = 0; lane < 4; ++lane) {
+                    if (mask & (1 << lane)) {
+                        ++trace.narrowTests;
+                        IntersectLeaf(rays[lane], leaf, hits[lane]);
+                    }
+                }
+                if (mask != 0) {
+                    updateLimit();
+                }
+            }
+            continue;
+        }
+
+        float tLeft, tRight;
+        bool hitLeft = testBox(m_nodes[node.first].bounds, tNear, tLeft) != 0;
+        bool hitRight = testBox(m_nodes[node.first + 1].bounds, tNear, tRight) != 0;
+        if (hitLeft && hitRight) {
+            bool leftFirst = tLeft <= tRight;
+            stack[stackSize++] = leftFirst ? Entry{ node.first + 1, tRight } : Entry{ node.first, tLeft };
+            stack[stackSize++] = leftFirst ? Entry{ node.first, tLeft } : Entry{ node.first + 1, tRight };
+        }
+        else if (hitLeft) {
+            stack[stackSize++] = { node.first, tLeft };
+        }
+        else if (hitRight) {
+            stack[stackSize++] = { node.first + 1, tRight };
+        }
+    }
+}
+
+void SceneBVH::RaycastBatch(const RayBatch& rays, std::vector<RayHit>& outHits, WorkerPool* pool, RayBatchStats* stats) const {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t count = rays.GetCount();
+    outHits.assign(count, RayHit());
+    for (size_t ray = 0; ray < count; ++ray) {
+        outHits[ray].distance = rays.maxDistance[ray];
+    }
+
+    // Counting sort by octant, the signs of the direction. Rays in one octant cross
+    // box slabs in the same order, so their packets agree on which child is nearer
+    // and tend to visit the same boxes. Input order is kept inside an octant, so rays
+    // that came in coherent, like neighbouring pixels, stay neighbours.
+    std::vector<uint8_t> octants(count);
+    size_t octantStarts[9] = {};
+    for (size_t ray = 0; ray < count; ++ray) {
+        octants[ray] = static_cast<uint8_t>((rays.directionX[ray] < 0.0f ? 1 : 0) |
+            (rays.directionY[ray] < 0.0f ? 2 : 0) | (rays.directionZ[ray] < 0.0f ? 4 : 0));
+        ++octantStarts[octants[ray] + 1];
+    }
+    for (int octant = 0; octant < 8; ++octant) {
+        octantStarts[octant + 1] += octantStarts[octant];
+    }
+    std::vector<uint32_t> order(count);
+    size_t cursors[8];
+    std::copy(octantStarts, octantStarts + 8, cursors);
+    for (size_t ray = 0; ray < count; ++ray) {
+        order[cursors[octants[ray]]++] = static_cast<uint32_t>(ray);
+    }
+
+    // Packets never straddle two octants; the last one of each may be short
+    struct Packet {
+        uint32_t first;
+        uint32_t count;
+    };
+    std::vector<Packet> packets;
+    packets.reserve(count / 4 + 8);
+    for (int octant = 0; octant < 8; ++octant) {
+        for (size_t first = octantStarts[octant]; first < octantStarts[octant + 1]; first += 4) {
+            packets.push_back({ static_cast<uint32_t>(first),
+                static_cast<uint32_t>(std::min<size_t>(4, octantStarts[octant + 1] - first)) });
+        }
+    }
+
+    // Each ray belongs to exactly one packet, so chunks write disjoint hits
+    std::atomic<size_t> visitedNodes(0);
+    std::atomic<size_t> narrowTests(0);
+    auto tracePackets = [&](size_t firstPacket, size_t lastPacket) {
+        TraceStats trace;
+        for (size_t index = firstPacket; index < lastPacket; ++index) {
+            const Packet& packet = packets[index];
+            RayPacket4 lanes = RayPacket4();
+            Ray leadRay = rays.GetRay(order[packet.first]);
+            Ray laneRays[4] = { leadRay, leadRay, leadRay, leadRay };
+            RayHit laneHits[4];
+            for (uint32_t lane = 0; lane < packet.count; ++lane) {
+                uint32_t ray = order[packet.first + lane];
+                laneRays[lane] = rays.GetRay(ray);
+                lanes.Set(static_cast<int>(lane), laneRays[lane]);
+                laneHits[lane] = outHits[ray];
+            }
+            RaycastPacket(lanes, laneRays, laneHits, trace);
+            for (uint32_t lane = 0; lane < packet.count; ++lane) {
+                outHits[order[packet.first + lane]] = laneHits[lane];
+            }
+        }
+        visitedNodes += trace.visitedNodes;
+        narrowTests += trace.narrowTests;
+    };
+    if (pool && packets.size() >= g_MinParallelPackets) {
+        pool->ParallelFor(packets.size(), g_BatchPacketGrain, tracePackets);
+    }
+    else {
+        tracePackets(0, packets.size());
+    }
+
+    if (stats) {
+        stats->rays = count;
+        stats->hits = static_cast<size_t>(std::count_if(outHits.begin(), outHits.end(),
+            [](const RayHit& hit) { return hit.handle.IsValid(); }));
+        stats->packets = packets.size();
+        stats->visitedNodes = visitedNodes;
+        stats->narrowTests = narrowTests;
+        stats->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "AABB.h"
+#include "Ray.h"
+#include "RayBatch.h"
+#include "SceneNode.h"
+#include "TriangleBVH.h"
+
+#include <glm/glm.hpp>
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class WorkerPool;
+struct RayPacket4;
+
+// Closest surface a picking ray met
+struct RayHit {
+    // invalid when nothing was hit
+    NodeHandle handle;
+    // world-space distance from the ray origin
+    float distance = FLT_MAX;
+    // part of a prefab instance, or -1 for a plain node
+    int part = -1;
+    // triangle of the node's mesh, or -1 when only its box could be tested
+    int triangle = -1;
+    // weights of the triangle's second and third corners
+    glm::vec2 barycentrics = glm::vec2(0.0f);
+};
+
+// Bounding volume hierarchy over the world bounds of the nodes that draw something,
+// used to find what a ray hits without visiting every node. The tree is built with
+// binned SAH splits and stored as a flat array: an inner node's children sit side by
+// side, and every node comes before its descendants, so a refit is one reverse sweep.
+//
+// The tree keeps its own copy of what it needs from each node, captured on the thread
+// that owns the scene. Queries never touch a SceneNode, so a tree can be handed to
+// another thread and traced there while the scene moves on.
+//
+// The tree is the broad phase. Nodes whose world box the ray passes through are then
+// tested exactly against the triangles of their primitive mesh, through the mesh
+// BVHs registered with SetMeshBVH; custom meshes fall back to their local box.
+//
+// Moving nodes only needs a Refit(); adding or removing nodes needs a new Build().
+class SceneBVH {
+public:
+    struct Stats {
+        size_t leaves = 0;
+        size_t nodes = 0;
+        int depth = 0;
+        double buildMs = 0.0;
+    };
+
+    // Work done by one Raycast
+    struct TraceStats {
+        size_t visitedNodes = 0;
+        size_t testedLeaves = 0;
+        // leaves whose world box was hit, and so went to the narrow phase
+        size_t narrowTests = 0;
+    };
+
+    // What the tree copies from a drawing node
+    struct Leaf {
+        AABB worldBounds;
+        // inverse world matrix
+        glm::mat4 toLocal;
+        AABB localBounds;
+        // prefab definitions do not change once placed, so sharing them is safe
+        const Prefab* prefab;
+        SceneNode::MeshType meshType;
+        NodeHandle handle;
+    };
+
+    // Copies every drawing node under root, in tree order; call after the world
+    // bounds are up to date
+    static void CaptureLeaves(const SceneNode* root, std::vector<Leaf>& outLeaves);
+    // Copies one node; returns false, leaving outLeaf alone, when it draws nothing
+    static bool CaptureLeaf(const SceneNode* node, Leaf& outLeaf);
+
+    void Build(std::vector<Leaf> leaves);
+    void Build(const SceneNode* root);
+    // Takes new leaf records for the same nodes in the same order and grows the inner
+    // boxes to fit, keeping the tree shape. Returns false, changing nothing, when the
+    // number of leaves differs; the tree has to be built again then.
+    bool Refit(std::vector<Leaf> leaves);
+    bool Refit(const SceneNode* root);
+    // Replaces the records of the nodes in leaves, matched by handle, and refits the
+    // tree. Records for nodes the tree does not hold are skipped; returns how many
+    // were applied.
+    size_t UpdateLeaves(const std::vector<Leaf>& leaves);
+    void Clear();
+    bool IsEmpty() const { return m_nodes.empty(); }
+
+    // Triangles of a primitive mesh in the mesh's own space, owned by the caller;
+    // nullptr makes nodes of that type test their box instead
+    void SetMeshBVH(SceneNode::MeshType type, const TriangleBVH* bvh);
+
+    // Closest surface hit nearer than hit.distance. Leaves hit untouched and returns
+    // false when there is none. Safe to call from several threads at once.
+    bool Raycast(const Ray& ray, RayHit& hit, TraceStats* stats = nullptr) const;
+    // Closest hit of every ray in the batch, nearer than its maximum distance, written
+    // to outHits in batch order. Rays are grouped by the signs of their direction and
+    // traced four at a time, so rays heading the same way share each box test; with a
+    // pool the packets are split across its threads.
+    void RaycastBatch(const RayBatch& rays, std::vector<RayHit>& outHits, WorkerPool* pool = nullptr,
+        RayBatchStats* stats = nullptr) const;
+
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    struct Node {
+        AABB bounds;
+        // first child for inner nodes, first entry of m_leafOrder for leaves
+        uint32_t first;
+        // 0 for inner nodes
+        uint32_t count;
+    };
+
+    // Grows every tree node to fit the current leaf bounds
+    void RefitNodes();
+    void Subdivide(uint32_t nodeIndex, int depth);
+    // Best binned SAH split of a node's leaves; returns false when keeping them is cheaper
+    bool FindSplit(const Node& node, int& outAxis, float& outPosition) const;
+    // Narrow phase of one mesh placed by toLocal, from world into mesh space
+    bool IntersectMesh(const Ray& ray, const glm::mat4& toLocal, SceneNode::MeshType type, const AABB& localBounds,
+        RayHit& hit) const;
+    bool IntersectLeaf(const Ray& ray, const Leaf& leaf, RayHit& hit) const;
+    // One packet of up to four rays; lanes outside packet.laneMask are left alone
+    void RaycastPacket(const RayPacket4& packet, const Ray* rays, RayHit* hits, TraceStats& trace) const;
+
+    std::vector<Node> m_nodes;
+    // in capture order, so a refit can replace them in one go
+    std::vector<Leaf> m_leaves;
+    // m_leaves entries in tree order
+    std::vector<uint32_t> m_leafOrder;
+    // m_leaves entry of each arena slot, by NodeHandle::index
+    std::vector<uint32_t> m_leafOfSlot;
+    // centers of the leaf boxes, in m_leafOrder order, only needed while building
+    std::vector<glm::vec3> m_centers;
+    const TriangleBVH* m_meshBvhs[static_cast<int>(SceneNode::MeshType::Custom)] = {};
+    Stats m_stats;
+};
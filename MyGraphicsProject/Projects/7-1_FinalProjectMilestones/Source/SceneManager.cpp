@@ -17,7 +17,13 @@
 
 
 #include <glm/gtx/transform.hpp>
+#include <glm/gtc/constants.hpp>
 #include <GLFW/glfw3.h>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <random>
 
 // declaration of global variables
 namespace
@@ -27,6 +33,40 @@ namespace
 	const char* g_TextureValueName = "objectTexture";
 	const char* g_UseTextureName = "bUseTexture";
 	const char* g_UseLightingName = "bUseLighting";
+
+	// scenes with fewer nodes than this update transforms on
+	// the render thread, since waking the workers costs more
+	const size_t g_ParallelTransformNodeCount = 4096;
+
+	// far clipping distance used by the view, for depth sort keys
+	const float g_DrawSortFarPlane = 100.0f;
+	// frames between render counter reports
+	const unsigned int g_RenderStatsInterval = 300;
+	// lantern flames and shrine lamps, shared by the light block and
+	// the proximity queries
+	const glm::vec3 g_PointLightPositions[] = {
+		glm::vec3(0.0f, 6.0f, 0.0f),
+		glm::vec3(0.0f, 6.0f, 12.0f),
+		glm::vec3(0.0f, 6.0f, 24.0f),
+		glm::vec3(0.0f, 6.0f, 36.0f),
+		glm::vec3(18.0f, 6.0f, 0.0f),
+		glm::vec3(18.0f, 6.0f, 36.0f),
+		glm::vec3(18.75f, 4.80f, 15.5f),
+		glm::vec3(18.75f, 4.80f, 20.5f)
+	};
+	// distance at which the point light attenuation in the light
+	// block drops below 5%
+	const float g_PointLightRange = 18.5f;
+	// nodes reported nearest the camera
+	const size_t g_NearestNodeCount = 4;
+
+	// decoded texture images uploaded per frame, so a burst of
+	// finished decodes does not stall a single frame
+	const int g_TextureUploadsPerFrame = 2;
+
+	// camera rays traced for each report, one per cell of this grid
+	const int g_VisibilitySampleColumns = 160;
+	const int g_VisibilitySampleRows = 90;
 }
 
 /***********************************************************
@@ -34,11 +74,21 @@ namespace
  *
  *  The constructor for the class
  ***********************************************************/
-SceneManager::SceneManager(ShaderManager *pShaderManager, Camera* pCamera)
+SceneManager::SceneManager(ShaderManager *pShaderManager, Camera* pCamera) :
+	m_pickingService(m_workerPool),
+	m_textureLoader(m_workerPool)
 {
 	m_pShaderManager = pShaderManager;
+	m_loadedTextures = 0;
+	m_bResourcesLoaded = false;
 	m_basicMeshes = new ShapeMeshes();
+	m_basicMeshes->SetStateCache(&m_stateCache);
 	m_pCamera = pCamera;
+	m_frameBlock.view = glm::mat4(1.0f);
+	m_frameBlock.projection = glm::mat4(1.0f);
+	m_frameBlock.viewPosition = glm::vec4(0.0f);
+	m_frameBlock.frameTime = glm::vec4(0.0f);
+	m_lodSelector.SetLevelCount(ShapeMeshes::LodCount);
 }
 
 /***********************************************************
@@ -48,6 +98,7 @@ SceneManager::SceneManager(ShaderManager *pShaderManager, Camera* pCamera)
  ***********************************************************/
 SceneManager::~SceneManager()
 {
+	ClearScene();
 	m_pShaderManager = NULL;
 	delete m_basicMeshes;
 	m_basicMeshes = NULL;
@@ -56,75 +107,152 @@ SceneManager::~SceneManager()
 /***********************************************************
  *  CreateGLTexture()
  *
- *  This method is used for loading textures from image files,
- *  configuring the texture mapping parameters in OpenGL,
- *  generating the mipmaps, and loading the read texture into
- *  the next available texture slot in memory.
+ *  This method is used for creating a texture in the next
+ *  available texture slot and queueing its image file to be
+ *  decoded on a worker thread. Until the decoded image is
+ *  uploaded, the texture holds a single grey texel, so the
+ *  scene can be drawn without waiting for the files. If the
+ *  file turns out to be unusable, the texture is freed again.
  ***********************************************************/
 bool SceneManager::CreateGLTexture(const char* filename, std::string tag)
 {
-	int width = 0;
-	int height = 0;
-	int colorChannels = 0;
+	if (m_loadedTextures >= (int)(sizeof(m_textureIDs) / sizeof(m_textureIDs[0])))
+	{
+		std::cout << "No texture slot left for image:" << filename << std::endl;
+		return false;
+	}
+
 	GLuint textureID = 0;
+	const unsigned char placeholder[4] = { 128, 128, 128, 255 };
 
-	// indicate to always flip images vertically when loaded
-	stbi_set_flip_vertically_on_load(true);
-
-	// try to parse the image data from the specified image file
-	unsigned char* image = stbi_load(
-		filename,
-		&width,
-		&height,
-		&colorChannels,
-		0);
-
-	// if the image was successfully read from the image file
-	if (image)
-	{
-		std::cout << "Successfully loaded image:" << filename << ", width:" << width << ", height:" << height << ", channels:" << colorChannels << std::endl;
-
-		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-
-		// set the texture wrapping parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		// set texture filtering parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		// if the loaded image is in RGB format
-		if (colorChannels == 3)
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-		// if the loaded image is in RGBA format - it supports transparency
-		else if (colorChannels == 4)
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-		else
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_2D, textureID);
+
+	// set the texture wrapping parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// set texture filtering parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+	glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+
+	// register the texture and associate it with the special tag
+	// string; the slot is what the decoded image comes back with
+	m_textureIDs[m_loadedTextures].ID = textureID;
+	m_textureIDs[m_loadedTextures].tag = tag;
+	m_textureLoader.Load(m_loadedTextures, filename);
+	m_loadedTextures++;
+
+	return true;
+}
+
+/***********************************************************
+ *  UploadDecodedTextures()
+ *
+ *  This method is used for uploading the texture images the
+ *  workers finished decoding. Only a few go up per frame,
+ *  and once the last one is in, the loading times are
+ *  reported.
+ ***********************************************************/
+void SceneManager::UploadDecodedTextures()
+{
+	TextureLoader::Image image;
+	int uploads = 0;
+	bool bUploaded = false;
+	while (uploads < g_TextureUploadsPerFrame && m_textureLoader.PollDecoded(image) == true)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (UploadTextureImage(image) == false)
 		{
-			std::cout << "Not implemented to handle image with " << colorChannels << " channels" << std::endl;
-			return false;
+			ReleaseFailedTexture(image.slot);
+			m_failedTextures++;
 		}
+		m_textureUploadMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		m_textureDecodeMs += image.decodeMs;
+		TextureLoader::FreeImage(image);
+		uploads++;
+		bUploaded = true;
+	}
 
-		// generate the texture mipmaps for mapping textures to lower resolutions
-		glGenerateMipmap(GL_TEXTURE_2D);
+	if (bUploaded == true && m_textureLoader.GetPendingCount() == 0)
+	{
+		double loadedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_loadStartTime).count();
+		std::cout << (m_loadedTextures - m_failedTextures) << " of " << m_loadedTextures << " textures loaded";
+		if (m_failedTextures > 0)
+		{
+			std::cout << ", " << m_failedTextures << " failed,";
+		}
+		std::cout << " " << loadedMs << " ms after loading started"
+			<< " (" << m_textureDecodeMs << " ms decoding on the workers, " << m_textureUploadMs << " ms uploading)" << std::endl;
+	}
+}
 
-		// free the image data from local memory
-		stbi_image_free(image);
-		glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+/***********************************************************
+ *  UploadTextureImage()
+ *
+ *  This method is used for loading a decoded image into the
+ *  texture of its slot in place of the placeholder, and
+ *  generating the mipmaps. The texture stays bound to its own
+ *  texture unit, so it is uploaded through that unit.
+ ***********************************************************/
+bool SceneManager::UploadTextureImage(const TextureLoader::Image& image)
+{
+	if (image.pixels == nullptr)
+	{
+		std::cout << "Could not load image:" << image.filename << std::endl;
+		return false;
+	}
 
-		// register the loaded texture and associate it with the special tag string
-		m_textureIDs[m_loadedTextures].ID = textureID;
-		m_textureIDs[m_loadedTextures].tag = tag;
-		m_loadedTextures++;
+	std::cout << "Successfully loaded image:" << image.filename << ", width:" << image.width << ", height:" << image.height
+		<< ", channels:" << image.channels << ", decoded in " << image.decodeMs << " ms" << std::endl;
 
-		return true;
+	GLint internalFormat = 0;
+	GLenum format = 0;
+	// if the loaded image is in RGB format
+	if (image.channels == 3)
+	{
+		internalFormat = GL_RGB8;
+		format = GL_RGB;
+	}
+	// if the loaded image is in RGBA format - it supports transparency
+	else if (image.channels == 4)
+	{
+		internalFormat = GL_RGBA8;
+		format = GL_RGBA;
 	}
+	else
+	{
+		std::cout << "Not implemented to handle image with " << image.channels << " channels" << std::endl;
+		return false;
+	}
+
+	m_stateCache.BindTexture2D(image.slot, m_textureIDs[image.slot].ID);
+	m_stateCache.ActiveTexture(image.slot);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels);
+
+	// generate the texture mipmaps for mapping textures to lower resolutions
+	glGenerateMipmap(GL_TEXTURE_2D);
 
-	std::cout << "Could not load image:" << filename << std::endl;
+	return true;
+}
 
-	// Error loading the image
-	return false;
+/***********************************************************
+ *  ReleaseFailedTexture()
+ *
+ *  This method is used for freeing the texture of a slot
+ *  whose image could not be loaded. The slot keeps its place
+ *  but holds no texture, so looking up its tag fails just as
+ *  if the texture had never been created.
+ ***********************************************************/
+void SceneManager::ReleaseFailedTexture(int slot)
+{
+	// unbind first so the state cache does not keep the freed
+	// name, which a later texture could be given
+	m_stateCache.BindTexture2D(slot, 0);
+	glDeleteTextures(1, &m_textureIDs[slot].ID);
+	m_textureIDs[slot].ID = 0;
 }
 
 /***********************************************************
@@ -138,8 +266,7 @@ void SceneManager::BindGLTextures()
 	for (int i = 0; i < m_loadedTextures; i++)
 	{
 		// bind textures on corresponding texture units
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(GL_TEXTURE_2D, m_textureIDs[i].ID);
+		m_stateCache.BindTexture2D(i, m_textureIDs[i].ID);
 	}
 }
 
@@ -171,7 +298,8 @@ int SceneManager::FindTextureID(std::string tag)
 
 	while ((index < m_loadedTextures) && (bFound == false))
 	{
-		if (m_textureIDs[index].tag.compare(tag) == 0)
+		// a slot whose image failed to load holds no texture
+		if (m_textureIDs[index].ID != 0 && m_textureIDs[index].tag.compare(tag) == 0)
 		{
 			textureID = m_textureIDs[index].ID;
 			bFound = true;
@@ -197,7 +325,7 @@ int SceneManager::FindTextureSlot(std::string tag)
 
 	while ((index < m_loadedTextures) && (bFound == false))
 	{
-		if (m_textureIDs[index].tag.compare(tag) == 0)
+		if (m_textureIDs[index].ID != 0 && m_textureIDs[index].tag.compare(tag) == 0)
 		{
 			textureSlot = index;
 			bFound = true;
@@ -278,7 +406,7 @@ void SceneManager::SetTransformations(
 
 	if (NULL != m_pShaderManager)
 	{
-		m_pShaderManager->setMat4Value(g_ModelName, modelView);
+		m_pShaderManager->setMat4Value(m_uniforms.model, modelView);
 	}
 }
 
@@ -304,8 +432,8 @@ void SceneManager::SetShaderColor(
 
 	if (NULL != m_pShaderManager)
 	{
-		m_pShaderManager->setIntValue(g_UseTextureName, false);
-		m_pShaderManager->setVec4Value(g_ColorValueName, currentColor);
+		m_pShaderManager->setIntValue(m_uniforms.bUseTexture, false);
+		m_pShaderManager->setVec4Value(m_uniforms.objectColor, currentColor);
 	}
 }
 
@@ -320,7 +448,7 @@ void SceneManager::SetShaderTexture(
 {
 	if (NULL != m_pShaderManager)
 	{
-		m_pShaderManager->setIntValue(g_UseTextureName, true);
+		m_pShaderManager->setIntValue(m_uniforms.bUseTexture, true);
 
 		//The following finds the unit and texture ID
 		int textureID = -1;
@@ -328,16 +456,16 @@ void SceneManager::SetShaderTexture(
 		textureSlot = FindTextureSlot(textureTag);
 		textureID = FindTextureID(textureTag);
 
-		glActiveTexture(GL_TEXTURE0 + textureSlot);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-
-		GLint textureUniformLoc = glGetUniformLocation(programID, textureTag.c_str());
-		GLint objectIDUniformLoc = glGetUniformLocation(programID, "object");
-
-		glUniform1i(objectIDUniformLoc, object);
-		glUniform1i(textureUniformLoc, textureSlot);
+		m_pShaderManager->setIntValue(m_uniforms.object, object);
+		if (textureSlot >= 0)
+		{
+			// the texture normally stays on its slot from the
+			// last frame, so the cache drops this bind
+			m_stateCache.BindTexture2D(textureSlot, textureID);
+			m_pShaderManager->setSampler2DValue(m_uniforms.textures[textureSlot], textureSlot);
+		}
 
-		m_pShaderManager->setSampler2DValue(g_TextureValueName, textureID);
+		m_pShaderManager->setSampler2DValue(m_uniforms.objectTexture, textureID);
 	}
 }
 
@@ -351,7 +479,7 @@ void SceneManager::SetTextureUVScale(float u, float v)
 {
 	if (NULL != m_pShaderManager)
 	{
-		m_pShaderManager->setVec2Value("UVscale", glm::vec2(u, v));
+		m_pShaderManager->setVec2Value(m_uniforms.uvScale, glm::vec2(u, v));
 	}
 }
 
@@ -364,21 +492,115 @@ void SceneManager::SetTextureUVScale(float u, float v)
 void SceneManager::SetShaderMaterial(
 	std::string materialTag)
 {
-	if (m_objectMaterials.size() > 0)
-	{
-		OBJECT_MATERIAL material;
-		bool bReturn = false;
+	// the material values themselves live in the material
+	// block, so a draw only selects its entry
+	m_pShaderManager->setIntValue(m_uniforms.materialIndex, FindMaterialIndex(materialTag));
+}
 
-		bReturn = FindMaterial(materialTag, material);
-		if (bReturn == true)
+/***********************************************************
+ *  FindMaterialIndex()
+ *
+ *  This method is used for finding the entry of a defined
+ *  material in the material block. Entry 0 holds the default
+ *  material used for tags that have no definition.
+ ***********************************************************/
+int SceneManager::FindMaterialIndex(const std::string& materialTag) const
+{
+	int count = std::min((int)m_objectMaterials.size(), g_MaxBlockMaterials - 1);
+	for (int index = 0; index < count; index++)
+	{
+		if (m_objectMaterials[index].tag == materialTag)
 		{
-			m_pShaderManager->setVec3Value("material.ambientColor", material.ambientColor);
-			m_pShaderManager->setFloatValue("material.ambientStrength", material.ambientStrength);
-			m_pShaderManager->setVec3Value("material.diffuseColor", material.diffuseColor);
-			m_pShaderManager->setVec3Value("material.specularColor", material.specularColor);
-			m_pShaderManager->setFloatValue("material.shininess", material.shininess);
+			return(index + 1);
 		}
 	}
+	return(0);
+}
+
+/***********************************************************
+ *  SetViewTransforms()
+ *
+ *  This method is used for passing the camera matrices of
+ *  the frame about to be rendered. They reach the shaders
+ *  through the frame block when the scene is rendered.
+ ***********************************************************/
+void SceneManager::SetViewTransforms(const glm::mat4& view, const glm::mat4& projection)
+{
+	m_frameBlock.view = view;
+	m_frameBlock.projection = projection;
+}
+
+/***********************************************************
+ *  CreateNode()
+ *
+ *  This method is used for allocating a new scene node. The
+ *  nodes are carved out of contiguous blocks owned by the
+ *  scene, and are all released together by ClearScene().
+ ***********************************************************/
+SceneNode* SceneManager::CreateNode()
+{
+	return(m_nodeArena.Create());
+}
+
+/***********************************************************
+ *  ClearScene()
+ *
+ *  This method is used for tearing down the whole scene
+ *  graph. The arena keeps its blocks so that a rebuilt scene
+ *  can reuse them without going back to the heap.
+ ***********************************************************/
+void SceneManager::ClearScene()
+{
+	// the selected nodes are about to go, and their handles with them
+	m_selection.clear();
+	m_staticBatch.Release();
+	m_transformHierarchy.Clear();
+	m_renderQueue.Invalidate();
+	m_occluders.clear();
+	m_bOccludersStale = true;
+	m_pickBvh.Clear();
+	m_bPickBvhStale = true;
+	m_pickingService.InvalidateSnapshot();
+	m_spatialGrid.Clear();
+	m_bSpatialGridStale = true;
+	m_movedNodes.clear();
+	m_rootNode = nullptr;
+	m_nodeArena.Reset();
+	// prefab definitions outlive the scene, their placements do not
+	for (const std::unique_ptr<Prefab>& prefab : m_prefabs)
+	{
+		prefab->ClearInstances();
+	}
+}
+
+/***********************************************************
+ *  CreatePrefab()
+ *
+ *  This method is used for registering a new prefab. Parts
+ *  are added to the returned definition once, and it can then
+ *  be placed any number of times with InstantiatePrefab().
+ ***********************************************************/
+Prefab* SceneManager::CreatePrefab(const std::string& name)
+{
+	m_prefabs.push_back(std::unique_ptr<Prefab>(new Prefab(name)));
+	return(m_prefabs.back().get());
+}
+
+/***********************************************************
+ *  InstantiatePrefab()
+ *
+ *  This method is used for placing a prefab in the scene. The
+ *  placement is a single node carrying only its transform; the
+ *  parts are drawn and picked through the shared definition.
+ ***********************************************************/
+SceneNode* SceneManager::InstantiatePrefab(Prefab* prefab, const glm::vec3& position,
+	const glm::vec3& rotation, const glm::vec3& scale)
+{
+	SceneNode* instance = CreateNode();
+	instance->SetTransform(position, rotation, scale);
+	instance->SetPrefab(prefab);
+	prefab->AddInstance(instance);
+	return(instance);
 }
 
 /**************************************************************/
@@ -501,6 +723,10 @@ void SceneManager::DefineObjectMaterials() {
   ***********************************************************/
 void SceneManager::LoadSceneTextures()
 {
+	// the image files are decoded on the workers while the scene
+	// is built and drawn; see UploadDecodedTextures()
+	m_loadStartTime = std::chrono::steady_clock::now();
+
 	/*** STUDENTS - add the code BELOW for loading the textures that ***/
 	/*** will be used for mapping to objects in the 3D scene. Up to  ***/
 	/*** 16 textures can be loaded per scene. Refer to the code in   ***/
@@ -528,49 +754,41 @@ void SceneManager::LoadSceneTextures()
 }
 
 
-SceneNode* SceneManager::CreateLantern(const glm::vec3& basePosition) {
-	SceneNode* root = new SceneNode(); // Neutral root node
-	root->SetTransform(basePosition, glm::vec3(0), glm::vec3(1.0f));
+/***********************************************************
+ *  DefineLanternPrefab()
+ *
+ *  This method is used for describing the stone lantern once.
+ *  Every lantern in the scene is an instance of this prefab.
+ ***********************************************************/
+void SceneManager::DefineLanternPrefab()
+{
+	m_lanternPrefab = CreatePrefab("lantern");
 
 	// Box base
-	SceneNode* base = new SceneNode();
-	base->SetTransform(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0), glm::vec3(3.0f, 1.5f, 3.0f));
-	base->SetMaterial("stoneTexture");
-	base->SetTexture("stoneTexture", 1);
-	base->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
-	root->AddChild(base);
+	int base = m_lanternPrefab->AddPart(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0), glm::vec3(3.0f, 1.5f, 3.0f),
+		"stoneTexture", "stoneTexture", 1,
+		[](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); }, SceneNode::MeshType::Box);
+	m_lanternPrefab->SetPartOccluder(base, true);
 
 	// Pillar
-	SceneNode* pillar = new SceneNode();
-	pillar->SetTransform(glm::vec3(0.0f, 1.48f, 0.0f), glm::vec3(0), glm::vec3(1.0f, 4.0f, 1.0f));
-	pillar->SetMaterial("stoneTexture");
-	pillar->SetTexture("stoneTexture", 1);
-	pillar->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawCylinderMesh(); });
-	root->AddChild(pillar);
+	m_lanternPrefab->AddPart(glm::vec3(0.0f, 1.48f, 0.0f), glm::vec3(0), glm::vec3(1.0f, 4.0f, 1.0f),
+		"stoneTexture", "stoneTexture", 1,
+		[](ShapeMeshes* mesh) { mesh->DrawCylinderMesh(); }, SceneNode::MeshType::Cylinder);
 
 	// Cap base (inverted pyramid)
-	SceneNode* capBase = new SceneNode();
-	capBase->SetTransform(glm::vec3(0.0f, 5.0f, 0.0f), glm::vec3(0.0f, 0.0f, 180.0f), glm::vec3(3.0f, 1.0f, 3.0f));
-	capBase->SetMaterial("lanternSupportTexture");
-	capBase->SetTexture("lanternSupportTexture", 2);
-	capBase->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawPyramid4Mesh(); });
-	root->AddChild(capBase);
+	m_lanternPrefab->AddPart(glm::vec3(0.0f, 5.0f, 0.0f), glm::vec3(0.0f, 0.0f, 180.0f), glm::vec3(3.0f, 1.0f, 3.0f),
+		"lanternSupportTexture", "lanternSupportTexture", 2,
+		[](ShapeMeshes* mesh) { mesh->DrawPyramid4Mesh(); }, SceneNode::MeshType::Pyramid);
 
 	// Cap top
-	SceneNode* capTop = new SceneNode();
-	capTop->SetTransform(glm::vec3(0.0f, 7.0f, 0.0f), glm::vec3(0), glm::vec3(3.0f, 1.0f, 3.0f));
-	capTop->SetMaterial("lanternSupportTexture");
-	capTop->SetTexture("lanternSupportTexture", 2);
-	capTop->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawPyramid4Mesh(); });
-	root->AddChild(capTop);
+	m_lanternPrefab->AddPart(glm::vec3(0.0f, 7.0f, 0.0f), glm::vec3(0), glm::vec3(3.0f, 1.0f, 3.0f),
+		"lanternSupportTexture", "lanternSupportTexture", 2,
+		[](ShapeMeshes* mesh) { mesh->DrawPyramid4Mesh(); }, SceneNode::MeshType::Pyramid);
 
 	// Top sphere
-	SceneNode* sphere = new SceneNode();
-	sphere->SetTransform(glm::vec3(0.0f, 7.25f, 0.0f), glm::vec3(0), glm::vec3(0.5f));
-	sphere->SetMaterial("lampTopTexture");
-	sphere->SetTexture("lanternSupportTexture", 2);
-	sphere->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawSphereMesh(); });
-	root->AddChild(sphere);
+	m_lanternPrefab->AddPart(glm::vec3(0.0f, 7.25f, 0.0f), glm::vec3(0), glm::vec3(0.5f),
+		"lampTopTexture", "lanternSupportTexture", 2,
+		[](ShapeMeshes* mesh) { mesh->DrawSphereMesh(); }, SceneNode::MeshType::Sphere);
 
 	// Vertical supports
 	std::vector<glm::vec3> supportOffsets = {
@@ -581,86 +799,84 @@ SceneNode* SceneManager::CreateLantern(const glm::vec3& basePosition) {
 	};
 
 	for (const glm::vec3& offset : supportOffsets) {
-		SceneNode* support = new SceneNode();
-		support->SetTransform(offset, glm::vec3(0), glm::vec3(0.6f, 1.25f, 0.6f));
-		support->SetMaterial("lanternSupportTexture");
-		support->SetTexture("lanternSupportTexture", 2);
-		support->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
-		root->AddChild(support);
+		m_lanternPrefab->AddPart(offset, glm::vec3(0), glm::vec3(0.6f, 1.25f, 0.6f),
+			"lanternSupportTexture", "lanternSupportTexture", 2,
+			[](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); }, SceneNode::MeshType::Box);
 	}
 
 	// Flame cylinder
-	SceneNode* flame = new SceneNode();
-	flame->SetTransform(glm::vec3(0.0f, 5.8f, 0.0f), glm::vec3(0), glm::vec3(0.5f, 1.0f, 0.5f));
-	flame->SetMaterial("lampFlameTexture");
-	flame->SetTexture("lampFlameTexture", 4);
-	flame->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawCylinderMesh(); });
-	root->AddChild(flame);
+	m_lanternPrefab->AddPart(glm::vec3(0.0f, 5.8f, 0.0f), glm::vec3(0), glm::vec3(0.5f, 1.0f, 0.5f),
+		"lampFlameTexture", "lampFlameTexture", 4,
+		[](ShapeMeshes* mesh) { mesh->DrawCylinderMesh(); }, SceneNode::MeshType::Cylinder);
 
 	// Flame base
-	SceneNode* flameBase = new SceneNode();
-	flameBase->SetTransform(glm::vec3(0.0f, 5.0f, 0.0f), glm::vec3(0), glm::vec3(0.55f, 0.8f, 0.55f));
-	flameBase->SetMaterial("lampBaseTexture");
-	flameBase->SetTexture("lampBaseTexture", 3);
-	flameBase->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawCylinderMesh(); });
-	root->AddChild(flameBase);
+	m_lanternPrefab->AddPart(glm::vec3(0.0f, 5.0f, 0.0f), glm::vec3(0), glm::vec3(0.55f, 0.8f, 0.55f),
+		"lampBaseTexture", "lampBaseTexture", 3,
+		[](ShapeMeshes* mesh) { mesh->DrawCylinderMesh(); }, SceneNode::MeshType::Cylinder);
+}
 
-	return root;
+SceneNode* SceneManager::CreateLantern(const glm::vec3& basePosition) {
+	if (m_lanternPrefab == nullptr) {
+		DefineLanternPrefab();
+	}
+	return InstantiatePrefab(m_lanternPrefab, basePosition);
 }
 SceneNode* SceneManager::CreateGround() {
-	SceneNode* root = new SceneNode();
+	SceneNode* root = CreateNode();
 	root->SetTransform(glm::vec3(0), glm::vec3(0), glm::vec3(1.0f));
+	root->SetStatic(true);
 
 	// Water Plane
-	SceneNode* water = new SceneNode();
+	SceneNode* water = CreateNode();
 	water->SetTransform(glm::vec3(-15.0f, 0.24f, -5.0f), glm::vec3(0), glm::vec3(50.0f, 1.0f, 50.0f));
 	water->SetMaterial("floorTexture");
 	water->SetTexture("waterTexture", 0);
-	water->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawPlaneMesh(); });
+	water->SetMesh(SceneNode::MeshType::Plane);
 	root->AddChild(water);
 
 	// Grass Patch
-	SceneNode* grass = new SceneNode();
+	SceneNode* grass = CreateNode();
 	grass->SetTransform(glm::vec3(15.0f, 0.25f, 20.0f), glm::vec3(0.0f, 90.0f, 0.0f), glm::vec3(25.0f, 1.0f, 20.0f));
 	grass->SetMaterial("floorTexture");
 	grass->SetTexture("grassTexture", 5);
-	grass->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawPlaneMesh(); });
+	grass->SetMesh(SceneNode::MeshType::Plane);
 	root->AddChild(grass);
 
 	return root;
 }
 SceneNode* SceneManager::CreateShrine() {
-	SceneNode* root = new SceneNode();
+	SceneNode* root = CreateNode();
 	root->SetTransform(glm::vec3(0), glm::vec3(0), glm::vec3(1.0f));
+	root->SetStatic(true);
 
 	// ===== Path to Shrine =====
-	auto path1 = new SceneNode();
+	auto path1 = CreateNode();
 	path1->SetTransform(glm::vec3(10.0f, 0.26f, 20.0f), glm::vec3(0), glm::vec3(2.5f, 1.0f, 25.0f));
 	path1->SetTexture("dirtTexture", 9);
-	path1->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawPlaneMesh(); });
+	path1->SetMesh(SceneNode::MeshType::Plane);
 	root->AddChild(path1);
 
-	auto path2 = new SceneNode();
+	auto path2 = CreateNode();
 	path2->SetTransform(glm::vec3(22.5f, 0.26f, 18.0f), glm::vec3(0), glm::vec3(10.0f, 1.0f, 8.0f));
 	path2->SetTexture("dirtTexture", 9);
-	path2->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawPlaneMesh(); });
+	path2->SetMesh(SceneNode::MeshType::Plane);
 	root->AddChild(path2);
 
 	// ===== Stone Base for Shrine =====
-	auto base1 = new SceneNode();
+	auto base1 = CreateNode();
 	base1->SetTransform(glm::vec3(23.0f, 0.50f, 18.0f), glm::vec3(0), glm::vec3(12.0f, 0.5f, 12.0f));
 	base1->SetMaterial("stoneTexture");
 	base1->SetTexture("stoneTexture", 1);
 	base1->SetTexture("crackTexture", 1);
-	base1->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
+	base1->SetMesh(SceneNode::MeshType::Box);
 	root->AddChild(base1);
 
-	auto base2 = new SceneNode();
+	auto base2 = CreateNode();
 	base2->SetTransform(glm::vec3(23.0f, 0.75f, 18.0f), glm::vec3(0), glm::vec3(10.0f, 1.0f, 10.0f));
 	base2->SetMaterial("stoneTexture");
 	base2->SetTexture("stoneTexture", 1);
 	base2->SetTexture("crackTexture", 1);
-	base2->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
+	base2->SetMesh(SceneNode::MeshType::Box);
 	root->AddChild(base2);
 
 	// ===== Torii Gate (Left + Right Columns & Beams) =====
@@ -668,27 +884,27 @@ SceneNode* SceneManager::CreateShrine() {
 		{14.5f, 0.27f, 12.0f}, {14.5f, 0.27f, 24.0f}
 	};
 	for (const auto& pos : toriiColumns) {
-		auto column = new SceneNode();
+		auto column = CreateNode();
 		column->SetTransform(pos, glm::vec3(0), glm::vec3(1.0f, 10.0f, 1.0f));
 		column->SetMaterial("toriiSupport");
 		column->SetTexture("toriiTexture", 10);
-		column->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawCylinderMesh(); });
+		column->SetMesh(SceneNode::MeshType::Cylinder);
 		root->AddChild(column);
 	}
 
 	// Horizontal Beam
-	auto beam1 = new SceneNode();
+	auto beam1 = CreateNode();
 	beam1->SetTransform(glm::vec3(14.5f, 8.75f, 12.0f), glm::vec3(0, 90.0f, 90.0f), glm::vec3(0.5f, 4.0f, 1.0f));
 	beam1->SetMaterial("toriiSupport");
 	beam1->SetTexture("toriiTexture", 10);
-	beam1->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
+	beam1->SetMesh(SceneNode::MeshType::Box);
 	root->AddChild(beam1);
 
-	auto beam2 = new SceneNode();
+	auto beam2 = CreateNode();
 	beam2->SetTransform(glm::vec3(14.5f, 8.75f, 24.0f), glm::vec3(0, 90.0f, 90.0f), glm::vec3(0.5f, 4.0f, 1.0f));
 	beam2->SetMaterial("toriiSupport");
 	beam2->SetTexture("toriiTexture", 10);
-	beam2->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
+	beam2->SetMesh(SceneNode::MeshType::Box);
 	root->AddChild(beam2);
 
 	// Top Pyramids for Torii
@@ -704,57 +920,58 @@ SceneNode* SceneManager::CreateShrine() {
 		const glm::vec3& pos = entry.first;
 		float yrot = entry.second;
 
-		SceneNode* pyramid = new SceneNode();
+		SceneNode* pyramid = CreateNode();
 		pyramid->SetTransform(pos, glm::vec3(0, yrot, 90.0f), glm::vec3(1.0f, 3.0f, 1.0f));
 		pyramid->SetMaterial("toriiSupport");
 		pyramid->SetTexture("toriiTexture", 10);
-		pyramid->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawPyramid4Mesh(); });
+		pyramid->SetMesh(SceneNode::MeshType::Pyramid);
 		root->AddChild(pyramid);
 	}
 
 	// ===== Roof Beams =====
-	auto roofBeam1 = new SceneNode();
+	auto roofBeam1 = CreateNode();
 	roofBeam1->SetTransform(glm::vec3(14.5f, 8.0f, 18.0f), glm::vec3(90.0f, 0, 0), glm::vec3(1.0f, 18.0f, 1.0f));
 	roofBeam1->SetMaterial("toriiSupport");
 	roofBeam1->SetTexture("toriiTexture", 10);
-	roofBeam1->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
+	roofBeam1->SetMesh(SceneNode::MeshType::Box);
 	root->AddChild(roofBeam1);
 
-	auto roofBeam2 = new SceneNode();
+	auto roofBeam2 = CreateNode();
 	roofBeam2->SetTransform(glm::vec3(14.5f, 11.0f, 18.0f), glm::vec3(90.0f, 0, 0), glm::vec3(2.0f, 19.0f, 1.5f));
 	roofBeam2->SetMaterial("toriiSupport");
 	roofBeam2->SetTexture("toriiTexture", 10);
-	roofBeam2->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
+	roofBeam2->SetMesh(SceneNode::MeshType::Box);
 	root->AddChild(roofBeam2);
 
-	auto roofBase = new SceneNode();
+	auto roofBase = CreateNode();
 	roofBase->SetTransform(glm::vec3(14.5f, 9.0f, 18.0f), glm::vec3(0), glm::vec3(0.5f, 3.0f, 1.5f));
 	roofBase->SetMaterial("toriiSupport");
 	roofBase->SetTexture("toriiTexture", 10);
-	roofBase->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
+	roofBase->SetMesh(SceneNode::MeshType::Box);
 	root->AddChild(roofBase);
 
-	auto roofTop = new SceneNode();
+	auto roofTop = CreateNode();
 	roofTop->SetTransform(glm::vec3(14.5f, 11.5f, 18.0f), glm::vec3(90.0f, 0, 0), glm::vec3(2.5f, 19.5f, 1.0f));
 	roofTop->SetMaterial("toriiRoof");
 	roofTop->SetTexture("toriiRoofTexture", 11);
-	roofTop->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
+	roofTop->SetMesh(SceneNode::MeshType::Box);
 	root->AddChild(roofTop);
 
 	// ===== Shrine Roof =====
-	auto shrineRoof = new SceneNode();
+	auto shrineRoof = CreateNode();
 	shrineRoof->SetTransform(glm::vec3(23.0f, 8.75f, 18.0f), glm::vec3(0), glm::vec3(11.0f, 5.0f, 11.5f));
 	shrineRoof->SetMaterial("shrineRoofTexture");
 	shrineRoof->SetTexture("shrineRoofTexture", 12);
-	shrineRoof->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawPyramid4Mesh(); });
+	shrineRoof->SetMesh(SceneNode::MeshType::Pyramid);
 	root->AddChild(shrineRoof);
 
 	// ===== Center Stone w/ Kanji =====
-	auto kanjiStone = new SceneNode();
+	auto kanjiStone = CreateNode();
 	kanjiStone->SetTransform(glm::vec3(23.0f, 3.75f, 18.0f), glm::vec3(0), glm::vec3(3.0f, 5.0f, 3.0f));
 	kanjiStone->SetMaterial("stoneTexture");
 	kanjiStone->SetTexture("kanjiTexture", 14);
-	kanjiStone->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
+	kanjiStone->SetMesh(SceneNode::MeshType::Box);
+	kanjiStone->SetOccluder(true);
 	root->AddChild(kanjiStone);
 
 	// === Shrine Walls ===
@@ -766,11 +983,12 @@ SceneNode* SceneManager::CreateShrine() {
 	};
 
 	for (const auto& pos : supportPosts) {
-		SceneNode* post = new SceneNode();
+		SceneNode* post = CreateNode();
 		post->SetTransform(pos, glm::vec3(0), glm::vec3(1.0f, 5.0f, 1.0f));
 		post->SetMaterial("shrineWallTexture");
 		post->SetTexture("supportTexture", 7);
-		post->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
+		post->SetMesh(SceneNode::MeshType::Box);
+		post->SetOccluder(true);
 		root->AddChild(post);
 	}
 
@@ -781,20 +999,22 @@ SceneNode* SceneManager::CreateShrine() {
 	};
 
 	for (const auto& pos : wallPanels) {
-		SceneNode* panel = new SceneNode();
+		SceneNode* panel = CreateNode();
 		panel->SetTransform(pos, glm::vec3(0), glm::vec3(7.5f, 5.0f, 0.5f));
 		panel->SetMaterial("shrineWallTexture");
 		panel->SetTexture("shrineWallTexture", 13);
-		panel->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
+		panel->SetMesh(SceneNode::MeshType::Box);
+		panel->SetOccluder(true);
 		root->AddChild(panel);
 	}
 
 	// Back wall
-	SceneNode* backWall = new SceneNode();
+	SceneNode* backWall = CreateNode();
 	backWall->SetTransform(glm::vec3(27.25f, 3.755f, 18.0f), glm::vec3(0), glm::vec3(0.5f, 5.0f, 8.0f));
 	backWall->SetMaterial("shrineWallTexture");
 	backWall->SetTexture("shrineWallTexture", 13);
-	backWall->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
+	backWall->SetMesh(SceneNode::MeshType::Box);
+	backWall->SetOccluder(true);
 	root->AddChild(backWall);
 
 	// === Shrine Lantern Bases ===
@@ -804,11 +1024,12 @@ SceneNode* SceneManager::CreateShrine() {
 	};
 
 	for (const auto& pos : lanternBasePositions) {
-		SceneNode* lanternBase = new SceneNode();
+		SceneNode* lanternBase = CreateNode();
 		lanternBase->SetTransform(pos, glm::vec3(0), glm::vec3(0.25f, 1.0f, 0.25f));
 		lanternBase->SetMaterial("shrineWallTexture");
 		lanternBase->SetTexture("supportTexture", 7); // Same as wall posts
-		lanternBase->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
+		lanternBase->SetMesh(SceneNode::MeshType::Box);
+		lanternBase->SetOccluder(true);
 		root->AddChild(lanternBase);
 	}
 
@@ -819,11 +1040,11 @@ SceneNode* SceneManager::CreateShrine() {
 	};
 
 	for (const auto& pos : flamePositions) {
-		SceneNode* flame = new SceneNode();
+		SceneNode* flame = CreateNode();
 		flame->SetTransform(pos, glm::vec3(0), glm::vec3(0.5f, 1.0f, 0.5f));
 		flame->SetMaterial("shrineWallTexture");
 		flame->SetTexture("shrineWallTexture", 13);
-		flame->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawCylinderMesh(); });
+		flame->SetMesh(SceneNode::MeshType::Cylinder);
 		root->AddChild(flame);
 	}
 
@@ -832,7 +1053,7 @@ SceneNode* SceneManager::CreateShrine() {
 	return root;
 }
 SceneNode* SceneManager::CreateDock(const glm::vec3& centerPosition) {
-	SceneNode* root = new SceneNode();
+	SceneNode* root = CreateNode();
 	//Variables for step generation
 	int numSteps = 6;
 	float stepWidth = 4.0f;
@@ -845,15 +1066,16 @@ SceneNode* SceneManager::CreateDock(const glm::vec3& centerPosition) {
 	float startZ = 0.5f;
 
 	root->SetTransform(centerPosition, glm::vec3(0), glm::vec3(1.0f));
+	root->SetStatic(true);
 
 	// Main Dock Planks
 	float plankZ = 0.0f;
 	for (int i = 0; i < 19; i++) {
-		SceneNode* plank = new SceneNode();
+		SceneNode* plank = CreateNode();
 		plank->SetTransform(glm::vec3(0.0f, 0.0f, plankZ), glm::vec3(0), glm::vec3(5.0f, 0.25f, 0.5f));
 		plank->SetMaterial("shrineWallTexture");
 		plank->SetTexture("plankTexture", 6);
-		plank->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
+		plank->SetMesh(SceneNode::MeshType::Box);
 		root->AddChild(plank);
 		plankZ -= 0.5f;
 	}
@@ -862,11 +1084,11 @@ SceneNode* SceneManager::CreateDock(const glm::vec3& centerPosition) {
 	float supportZ = -0.5f;
 	for (int i = 0; i < 5; i++) {
 		for (float x : {-2.0f, 2.0f}) {
-			SceneNode* support = new SceneNode();
+			SceneNode* support = CreateNode();
 			support->SetTransform(glm::vec3(x, -1.625f, supportZ), glm::vec3(0), glm::vec3(0.25f, 2.0f, 0.25f));
 			support->SetMaterial("shrineWallTexture");
 			support->SetTexture("supportTexture", 7);
-			support->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawCylinderMesh(); });
+			support->SetMesh(SceneNode::MeshType::Cylinder);
 			root->AddChild(support);
 		}
 		supportZ -= 2.0f;
@@ -880,11 +1102,11 @@ SceneNode* SceneManager::CreateDock(const glm::vec3& centerPosition) {
 			float z = startZ + i * stepSpacing;
 
 			// Steps
-			SceneNode* step = new SceneNode();
+			SceneNode* step = CreateNode();
 			step->SetTransform(glm::vec3(0.0f, y, z), glm::vec3(0), glm::vec3(stepWidth, 0.25f, stepDepth));
 			step->SetMaterial("shrineWallTexture");
 			step->SetTexture("plankTexture", 6);
-			step->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); });
+			step->SetMesh(SceneNode::MeshType::Box);
 			root->AddChild(step);
 
 			// Supports
@@ -893,7 +1115,7 @@ SceneNode* SceneManager::CreateDock(const glm::vec3& centerPosition) {
 
 
 			for (float x : {-offsetX, offsetX}) {
-				SceneNode* support = new SceneNode();
+				SceneNode* support = CreateNode();
 				support->SetTransform(
 					glm::vec3(x, supportY, z),
 					glm::vec3(0),
@@ -901,7 +1123,7 @@ SceneNode* SceneManager::CreateDock(const glm::vec3& centerPosition) {
 				);
 				support->SetMaterial("shrineWallTexture");
 				support->SetTexture("supportTexture", 7);
-				support->SetMeshDrawFunction([](ShapeMeshes* mesh) { mesh->DrawCylinderMesh(); });
+				support->SetMesh(SceneNode::MeshType::Cylinder);
 				root->AddChild(support);
 			}
 
@@ -923,26 +1145,10 @@ SceneNode* SceneManager::CreateDock(const glm::vec3& centerPosition) {
  ***********************************************************/
 void SceneManager::PrepareScene()
 {
-	programID = m_pShaderManager->LoadShaders("vertex.glsl", "fragment.glsl");
-
-	LoadSceneTextures();
-	DefineObjectMaterials();
-
-	// only one instance of a particular mesh needs to be
-	// loaded in memory no matter how many times it is drawn
-	// in the rendered 3D scene
-
-	m_basicMeshes->LoadBoxMesh();
-	m_basicMeshes->LoadPlaneMesh();
-	m_basicMeshes->LoadCylinderMesh();
-	m_basicMeshes->LoadConeMesh();
-	m_basicMeshes->LoadPrismMesh();
-	m_basicMeshes->LoadPyramid4Mesh();
-	m_basicMeshes->LoadSphereMesh();
-	m_basicMeshes->LoadTaperedCylinderMesh();
-	m_basicMeshes->LoadTorusMesh();
+	LoadSceneResources();
 
-	m_rootNode = new SceneNode();
+	ClearScene();
+	m_rootNode = CreateNode();
 
 	std::vector<glm::vec3> lanternPositions = {
 		glm::vec3(0.0f, 0.0f, 0.0f),
@@ -960,6 +1166,9 @@ void SceneManager::PrepareScene()
 	m_rootNode->AddChild(CreateDock(glm::vec3(10.0f, 1.875f, -4.75f)));
 	m_rootNode->AddChild(CreateGround());
 	m_rootNode->AddChild(CreateShrine());
+
+	BakeStaticGeometry();
+	PrintSceneStats();
 }
 
 /***********************************************************
@@ -971,17 +1180,1164 @@ void SceneManager::PrepareScene()
 void SceneManager::RenderScene()
 {
 	//Due to previous uage of the boolValue in the former RenderFunctions, it has been added here so that textures do register.
-	m_pShaderManager->setBoolValue("useTexture", true);
-	glUseProgram(programID);
-
-	m_pShaderManager->setVec3Value("viewPos", m_pCamera->Position);
-	m_pShaderManager->setFloatValue("time", glfwGetTime());
+	UseProgram(programID);
+	m_pShaderManager->setBoolValue(m_uniforms.useTexture, true);
+
+	// camera and time go out once for both programs
+	m_frameBlock.viewPosition = glm::vec4(m_pCamera->Position, 1.0f);
+	m_frameBlock.frameTime = glm::vec4((float)glfwGetTime(), 0.0f, 0.0f, 0.0f);
+	m_frameUniformBuffer.Update(&m_frameBlock, sizeof(m_frameBlock));
+	// textures decoded since the last frame replace their placeholders
+	UploadDecodedTextures();
 	//Calls if rootNode exists to render based on new SceneNode implementation
 	if (m_rootNode) {
-		glm::mat4 identity = glm::mat4(1.0f);
-		m_rootNode->Render(this, m_pShaderManager, m_basicMeshes, identity);
+		UpdateTransforms();
+		bool bBoundsChanged = m_rootNode->UpdateBounds(false, &m_movedNodes);
+		if (bBoundsChanged == true)
+		{
+			m_bPickBvhRefit = true;
+			m_pickingService.CaptureMoved(m_movedNodes);
+			DetachMovedStaticNodes();
+		}
+
+		// a node switching detail level rewrites its packets below
+		if (m_bLodEnabled == true || m_bLodStale == true)
+		{
+			SelectLevelsOfDetail(bBoundsChanged);
+		}
+
+		// the draws recorded on an earlier frame are replayed with
+		// only the changed nodes' packets rewritten; the scene is
+		// walked in full again when nodes were added or removed
+		m_renderQueue.SetViewPosition(m_pCamera->Position);
+		if (m_renderQueue.IsRecorded() == false || m_rootNode->RefreshDrawPackets(m_renderQueue) == false)
+		{
+			m_renderQueue.Begin(m_pCamera->Position, g_DrawSortFarPlane);
+			m_rootNode->CollectDrawPackets(m_renderQueue);
+			m_bOccludersStale = true;
+			m_bPickBvhStale = true;
+			m_pickingService.InvalidateSnapshot();
+			m_bSpatialGridStale = true;
+		}
+		UpdateSpatialGrid();
+		if (m_bCullingEnabled == true)
+		{
+			CullScene();
+		}
+		m_staticBatch.Render(this, m_pShaderManager);
+		m_renderQueue.Sort();
+		m_renderQueue.Submit(this, m_pShaderManager, m_basicMeshes);
+		if (m_renderQueue.IsInstancingEnabled() == true)
+		{
+			RenderInstancedPrimitives();
+		}
+
+		bool bReportFrame = (++m_frameCount % g_RenderStatsInterval) == 0;
+		if (m_bPrintRenderStats == true && bReportFrame == true)
+		{
+			const RenderQueue::Stats& stats = m_renderQueue.GetStats();
+			std::cout << "Draws: " << stats.draws
+				<< " in " << stats.drawCalls << " calls (" << stats.instancedDraws << " instanced)"
+				<< ", material changes: " << stats.materialChanges << " (tree order " << stats.treeOrderMaterialChanges << ")"
+				<< ", texture changes: " << stats.textureChanges << " (tree order " << stats.treeOrderTextureChanges << ")"
+				<< ", highlight changes: " << stats.highlightChanges
+				<< ", packets " << (stats.recorded ? "recorded" : "replayed") << " (" << stats.rewrittenPackets << " rewritten)" << std::endl;
+			if (m_bCullingEnabled == true)
+			{
+				std::cout << "Culling: " << m_cullStats.visibleNodes << " nodes visible, " << m_cullStats.culledNodes << " culled"
+					<< ", " << m_cullStats.testedNodes << " tested, " << stats.culledDraws << " draws skipped"
+					<< ", " << m_staticBatch.GetCulledBatchCount() << " of " << m_staticBatch.GetBatchCount() << " static batches skipped"
+					<< " in " << m_cullMs << " ms" << std::endl;
+			}
+			if (m_bCullingEnabled == true && m_bOcclusionEnabled == true)
+			{
+				const OcclusionBuffer::Stats& occlusionStats = m_occlusionBuffer.GetStats();
+				std::cout << "Occlusion: " << occlusionStats.occluders << " occluders (" << occlusionStats.triangles << " triangles, "
+					<< occlusionStats.skippedOccluders << " skipped at the near plane) drawn in " << occlusionStats.rasterMs << " ms"
+					<< ", " << occlusionStats.occluded << " of " << occlusionStats.tests << " tests rejected"
+					<< ", " << m_cullStats.occludedNodes << " nodes hidden" << std::endl;
+			}
+			std::cout << "Triangles: " << stats.triangles << " (" << stats.fullDetailTriangles << " at full detail)";
+			if (m_bLodEnabled == true)
+			{
+				std::cout << ", " << m_lodStats.nodes << " nodes with levels of detail, " << m_lodStats.changes << " switched on the last pass";
+			}
+			std::cout << std::endl;
+			// uniform counters cover every frame since the last report
+			std::cout << "Uniform uploads per frame: " << m_pShaderManager->GetUniformUploadCount() / g_RenderStatsInterval
+				<< " (skipped as unchanged " << m_pShaderManager->GetSkippedUniformUploadCount() / g_RenderStatsInterval << ")" << std::endl;
+			m_pShaderManager->ResetUniformCounters();
+			const GLStateCache::STATS& stateStats = m_stateCache.GetStats();
+			std::cout << "GL state changes per frame: " << stateStats.issued / g_RenderStatsInterval
+				<< " (filtered as redundant " << stateStats.filtered / g_RenderStatsInterval << ")" << std::endl;
+			m_stateCache.ResetCounters();
+		}
+		// the sampled queries would skew the frame timings above,
+		// so they are only traced when asked for on their own
+		if (m_bPrintQueryStats == true && bReportFrame == true)
+		{
+			SampleVisibility();
+			PrintProximityStats();
+		}
+	}
+
+	if (m_bFirstFrameReported == false)
+	{
+		double firstFrameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_loadStartTime).count();
+		std::cout << "First frame drawn " << firstFrameMs << " ms after loading started, with "
+			<< m_textureLoader.GetPendingCount() << " of " << m_loadedTextures << " textures still loading" << std::endl;
+		m_bFirstFrameReported = true;
 	}
 
 	/****************************************************************/
 }
 
+/***********************************************************
+ *  ResolveUniforms()
+ *
+ *  This method is used for looking up every uniform the
+ *  scene sets in one of its programs, so the render path
+ *  uploads through pre-resolved handles instead of names.
+ *  Uniforms the program does not use get invalid handles,
+ *  which are ignored when set.
+ ***********************************************************/
+void SceneManager::ResolveUniforms(GLuint program, SCENE_UNIFORMS& uniforms)
+{
+	uniforms.model = m_pShaderManager->GetUniformHandle(program, g_ModelName);
+	uniforms.normalMatrix = m_pShaderManager->GetUniformHandle(program, "normalMatrix");
+	uniforms.useTexture = m_pShaderManager->GetUniformHandle(program, "useTexture");
+	uniforms.bUseTexture = m_pShaderManager->GetUniformHandle(program, g_UseTextureName);
+	uniforms.objectColor = m_pShaderManager->GetUniformHandle(program, g_ColorValueName);
+	uniforms.objectTexture = m_pShaderManager->GetUniformHandle(program, g_TextureValueName);
+	uniforms.object = m_pShaderManager->GetUniformHandle(program, "object");
+	uniforms.highlight = m_pShaderManager->GetUniformHandle(program, "uHighlight");
+	uniforms.uvScale = m_pShaderManager->GetUniformHandle(program, "UVscale");
+	uniforms.materialIndex = m_pShaderManager->GetUniformHandle(program, "materialIndex");
+
+	for (int i = 0; i < m_loadedTextures; i++)
+	{
+		uniforms.textures[i] = m_pShaderManager->GetUniformHandle(program, m_textureIDs[i].tag);
+	}
+}
+
+/***********************************************************
+ *  CreateUniformBuffers()
+ *
+ *  This method is used for creating the uniform blocks the
+ *  scene programs share, and filling the ones that do not
+ *  change from frame to frame.
+ ***********************************************************/
+void SceneManager::CreateUniformBuffers()
+{
+	m_frameUniformBuffer.Create(FrameBlockBinding, sizeof(FrameBlock));
+	m_materialUniformBuffer.Create(MaterialBlockBinding, sizeof(MaterialBlock));
+	m_lightUniformBuffer.Create(LightBlockBinding, sizeof(LightBlock));
+
+	UploadMaterialBlock();
+	UploadLightBlock();
+}
+
+/***********************************************************
+ *  UploadMaterialBlock()
+ *
+ *  This method is used for writing the defined materials
+ *  into the material block, after the default entry.
+ ***********************************************************/
+void SceneManager::UploadMaterialBlock()
+{
+	MaterialBlock block = {};
+
+	// the default entry matches the lighting used before the
+	// materials were passed to the shaders
+	block.materials[0].ambient = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+	block.materials[0].diffuse = glm::vec4(1.0f);
+	block.materials[0].specular = glm::vec4(1.0f, 1.0f, 1.0f, 16.0f);
+
+	int count = std::min((int)m_objectMaterials.size(), g_MaxBlockMaterials - 1);
+	for (int index = 0; index < count; index++)
+	{
+		const OBJECT_MATERIAL& material = m_objectMaterials[index];
+		MaterialBlockEntry& entry = block.materials[index + 1];
+		entry.ambient = glm::vec4(material.ambientColor, material.ambientStrength);
+		entry.diffuse = glm::vec4(material.diffuseColor, 1.0f);
+		entry.specular = glm::vec4(material.specularColor, material.shininess);
+	}
+
+	m_materialUniformBuffer.Update(&block, sizeof(block));
+}
+
+/***********************************************************
+ *  UploadLightBlock()
+ *
+ *  This method is used for writing the scene lights into
+ *  the light block: the flickering lantern flames, the two
+ *  steady shrine lamps and the low evening sun.
+ ***********************************************************/
+void SceneManager::UploadLightBlock()
+{
+	LightBlock block = {};
+
+	// base intensity, flicker amplitude, speed and phase
+	const glm::vec4 pointLightFlicker[] = {
+		glm::vec4(0.5f, 0.3f, 3.0f, 0.0f),
+		glm::vec4(0.5f, 0.3f, 3.0f, 1.0f),
+		glm::vec4(0.5f, 0.3f, 3.0f, 2.0f),
+		glm::vec4(0.5f, 0.3f, 3.0f, 3.0f),
+		glm::vec4(0.5f, 0.3f, 3.0f, 0.0f),
+		glm::vec4(0.5f, 0.3f, 3.0f, 3.0f),
+		glm::vec4(1.0f, 0.0f, 0.0f, 0.0f),
+		glm::vec4(1.0f, 0.0f, 0.0f, 0.0f)
+	};
+
+	int count = sizeof(g_PointLightPositions) / sizeof(g_PointLightPositions[0]);
+	for (int i = 0; i < count; i++)
+	{
+		PointLightEntry& light = block.pointLights[i];
+		light.position = glm::vec4(g_PointLightPositions[i], 1.0f);
+		light.diffuse = glm::vec4(1.0f, 0.6f, 0.3f, 0.1f);
+		light.specular = glm::vec4(1.0f, 0.9f, 0.5f, 0.05f);
+		light.flicker = pointLightFlicker[i];
+	}
+	block.counts.x = count;
+
+	block.directionalDirection = glm::vec4(glm::normalize(glm::vec3(1.0f, -0.5f, -1.0f)), 0.0f);
+	block.directionalDiffuse = glm::vec4(0.8f, 0.4f, 0.3f, 1.0f);
+	block.directionalSpecular = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+	block.ambient = glm::vec4(0.2f, 0.1f, 0.2f, 1.0f);
+
+	m_lightUniformBuffer.Update(&block, sizeof(block));
+}
+
+/***********************************************************
+ *  RenderInstancedPrimitives()
+ *
+ *  This method is used for drawing every queued box, sphere,
+ *  cylinder, plane and pyramid with the instanced program.
+ *  Each instance carries its own model, normal matrix,
+ *  texture selector and highlight flag, so each mesh type
+ *  takes a single draw call however many nodes use it.
+ ***********************************************************/
+void SceneManager::RenderInstancedPrimitives()
+{
+	// the camera, lights and materials come from the shared
+	// uniform blocks, so only this program's own state is set
+	UseProgram(m_instancedProgramID);
+	m_pShaderManager->setBoolValue(m_instancedUniforms.useTexture, true);
+
+	m_renderQueue.SubmitInstanced(this, m_basicMeshes);
+
+	UseProgram(programID);
+}
+
+/***********************************************************
+ *  UseProgram()
+ *
+ *  This method is used for switching the current shader
+ *  program. The state cache binds it and the shader manager
+ *  is told about it, so the two never disagree about which
+ *  program is in use.
+ ***********************************************************/
+void SceneManager::UseProgram(GLuint program)
+{
+	m_stateCache.UseProgram(program);
+	m_pShaderManager->SetCurrentProgram(program);
+}
+
+/***********************************************************
+ *  CullScene()
+ *
+ *  This method is used for hiding the recorded draws of
+ *  nodes outside the view frustum. The node and subtree
+ *  bounds are refreshed earlier in the frame, and a subtree
+ *  whose bounds lie wholly inside or outside the frustum is
+ *  accepted or rejected with a single test. Subtrees inside
+ *  the frustum are then tested against the depth of the
+ *  occluders, drawn on the CPU. Baked static geometry is
+ *  culled a whole batch at a time by the batch bounds.
+ ***********************************************************/
+void SceneManager::CullScene()
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	glm::mat4 viewProjection = m_frameBlock.projection * m_frameBlock.view;
+	m_frustum.SetFromMatrix(viewProjection);
+	m_cullStats = CullStats();
+
+	const OcclusionBuffer* occlusion = nullptr;
+	if (m_bOcclusionEnabled == true)
+	{
+		if (m_bOccludersStale == true)
+		{
+			m_occluders.clear();
+			GatherOccluders(m_rootNode);
+			m_bOccludersStale = false;
+		}
+		if (m_occluders.empty() == false)
+		{
+			RasterizeOccluders(viewProjection);
+			occlusion = &m_occlusionBuffer;
+		}
+	}
+
+	m_rootNode->Cull(m_frustum, occlusion, m_renderQueue, m_cullStats);
+	m_staticBatch.Cull(m_frustum, occlusion);
+	m_cullMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/***********************************************************
+ *  GatherOccluders()
+ *
+ *  This method is used for listing the nodes that draw into
+ *  the occlusion buffer: nodes flagged as occluders, and
+ *  prefab instances with at least one occluder part.
+ ***********************************************************/
+void SceneManager::GatherOccluders(SceneNode* node)
+{
+	bool bOccluder = node->IsOccluder();
+	if (bOccluder == false && node->GetPrefab() != nullptr)
+	{
+		for (const Prefab::Part& part : node->GetPrefab()->GetParts())
+		{
+			bOccluder = bOccluder || part.occluder;
+		}
+	}
+	if (bOccluder == true)
+	{
+		m_occluders.push_back(node);
+	}
+
+	for (SceneNode* child : node->GetChildren())
+	{
+		GatherOccluders(child);
+	}
+}
+
+/***********************************************************
+ *  RasterizeOccluders()
+ *
+ *  This method is used for drawing the depth of every
+ *  occluder into the low-resolution CPU depth buffer. Each
+ *  occluder stands in as a box that fits inside its mesh, so
+ *  nothing is hidden that the real mesh would not hide.
+ ***********************************************************/
+void SceneManager::RasterizeOccluders(const glm::mat4& viewProjection)
+{
+	m_occlusionBuffer.Begin(viewProjection);
+	for (SceneNode* node : m_occluders)
+	{
+		const glm::mat4& world = node->GetWorldMatrix();
+		if (node->IsOccluder() == true)
+		{
+			m_occlusionBuffer.AddOccluder(world, SceneNode::GetOccluderBounds(node->GetMeshType()));
+		}
+		if (node->GetPrefab() != nullptr)
+		{
+			for (const Prefab::Part& part : node->GetPrefab()->GetParts())
+			{
+				if (part.occluder == true)
+				{
+					m_occlusionBuffer.AddOccluder(world * part.localMatrix, SceneNode::GetOccluderBounds(part.meshType));
+				}
+			}
+		}
+	}
+	m_occlusionBuffer.Rasterize(&m_workerPool);
+}
+
+/***********************************************************
+ *  SelectLevelsOfDetail()
+ *
+ *  This method is used for choosing how finely each sphere
+ *  and cylinder is drawn, from how tall its bounds appear
+ *  on screen. A still camera over a still scene keeps the
+ *  levels of the last pass, so the tree is only walked when
+ *  the view or some bounds changed.
+ ***********************************************************/
+void SceneManager::SelectLevelsOfDetail(bool bBoundsChanged)
+{
+	glm::mat4 viewProjection = m_frameBlock.projection * m_frameBlock.view;
+	if (m_bLodStale == false && bBoundsChanged == false && viewProjection == m_lodViewProjection)
+	{
+		return;
+	}
+	m_lodViewProjection = viewProjection;
+	m_bLodStale = false;
+
+	m_lodSelector.SetView(m_pCamera->Position, m_frameBlock.projection);
+	m_lodStats = LodStats();
+	m_rootNode->UpdateLod(m_lodSelector, m_lodStats);
+}
+
+/***********************************************************
+ *  SetLodEnabled()
+ *
+ *  This method is used for choosing whether distant nodes
+ *  are drawn with the coarser meshes. Turning it off puts
+ *  every node back to full detail on the next frame.
+ ***********************************************************/
+void SceneManager::SetLodEnabled(bool bEnabled)
+{
+	m_bLodEnabled = bEnabled;
+	m_lodSelector.SetLevelCount(bEnabled == true ? ShapeMeshes::LodCount : 1);
+	m_bLodStale = true;
+}
+
+/***********************************************************
+ *  SetCullingEnabled()
+ *
+ *  This method is used for choosing whether nodes outside
+ *  the view frustum are left out of the frame. Turning it
+ *  off shows every recorded draw again.
+ ***********************************************************/
+void SceneManager::SetCullingEnabled(bool bEnabled)
+{
+	m_bCullingEnabled = bEnabled;
+	if (bEnabled == false)
+	{
+		m_renderQueue.SetPacketsVisible(0, static_cast<uint32_t>(m_renderQueue.GetPacketCount()), true);
+		m_staticBatch.ShowAll();
+		m_cullStats = CullStats();
+	}
+}
+
+/***********************************************************
+ *  SetInstancingEnabled()
+ *
+ *  This method is used for choosing whether the basic shape
+ *  meshes are drawn instanced or one node at a time. It has
+ *  no effect when the driver cannot run the instanced path.
+ ***********************************************************/
+void SceneManager::SetInstancingEnabled(bool bEnabled)
+{
+	m_renderQueue.SetInstancingEnabled(bEnabled == true && m_instancedProgramID != 0);
+}
+
+/***********************************************************
+ *  SetFlatHierarchyEnabled()
+ *
+ *  This method is used for choosing how world transforms
+ *  are resolved. The flattened form keeps parent indices and
+ *  matrices in contiguous arrays and updates them in a single
+ *  linear pass, which suits very large scenes.
+ ***********************************************************/
+void SceneManager::SetFlatHierarchyEnabled(bool bEnabled)
+{
+	m_useFlatHierarchy = bEnabled;
+	if (bEnabled == false)
+	{
+		// the nodes take back the matrices of the last flat pass
+		// and stay flagged for anything changed since, so the
+		// pointer tree only recomputes those
+		m_transformHierarchy.Clear();
+	}
+}
+
+/***********************************************************
+ *  UpdateTransforms()
+ *
+ *  This method is used for refreshing the cached world
+ *  matrices of the scene before it is rendered or picked.
+ *  Only nodes whose transforms changed are recomputed, and
+ *  the render pass afterwards only reads the results.
+ ***********************************************************/
+void SceneManager::UpdateTransforms()
+{
+	if (m_rootNode == nullptr)
+	{
+		return;
+	}
+
+	// large scenes split the pass across the worker pool: the
+	// pointer tree by top-level subtree, the flat form by depth
+	WorkerPool* pool = nullptr;
+	if (m_nodeArena.GetNodeCount() >= g_ParallelTransformNodeCount)
+	{
+		pool = &m_workerPool;
+	}
+
+	if (m_useFlatHierarchy)
+	{
+		// nodes were added or removed since the last flatten
+		if (m_transformHierarchy.IsValid() == false)
+		{
+			m_transformHierarchy.Build(m_rootNode);
+		}
+		m_transformHierarchy.UpdateWorldTransforms(pool);
+	}
+	else
+	{
+		m_rootNode->UpdateWorldTransform(glm::mat4(1.0f), false, pool);
+	}
+}
+
+/***********************************************************
+ *  BakeStaticGeometry()
+ *
+ *  This method is used for merging the meshes of every
+ *  subtree flagged as static into pre-transformed vertex and
+ *  index buffers, one per material and texture. The original
+ *  nodes stay in the scene so that picking still finds them.
+ ***********************************************************/
+void SceneManager::BakeStaticGeometry()
+{
+	m_staticBatch.Release();
+	if (m_rootNode == nullptr)
+	{
+		return;
+	}
+
+	// the bake reads world matrices, so they must be current
+	UpdateTransforms();
+	for (SceneNode* child : m_rootNode->GetChildren())
+	{
+		if (child->IsStatic())
+		{
+			m_staticBatch.AddSubtree(child, m_basicMeshes);
+		}
+	}
+	m_staticBatch.Upload();
+	// the upload binds its vertex arrays directly
+	m_stateCache.Invalidate();
+
+	std::cout << "Static geometry: " << m_staticBatch.GetNodeCount()
+		<< " nodes baked into " << m_staticBatch.GetBatchCount() << " batches" << std::endl;
+}
+
+/***********************************************************
+ *  UpdatePickBvh()
+ *
+ *  This method is used for bringing the picking hierarchy up
+ *  to date before it is traced on the render thread. It is
+ *  built again when nodes were added or removed since the
+ *  last trace and refitted when only their bounds changed.
+ ***********************************************************/
+void SceneManager::UpdatePickBvh()
+{
+	if (m_bPickBvhStale == true)
+	{
+		m_pickBvh.Build(m_rootNode);
+		m_bPickBvhStale = false;
+		m_bPickBvhRefit = false;
+	}
+	else if (m_bPickBvhRefit == true)
+	{
+		if (m_pickBvh.Refit(m_rootNode) == false)
+		{
+			m_pickBvh.Build(m_rootNode);
+		}
+		m_bPickBvhRefit = false;
+	}
+}
+
+/***********************************************************
+ *  TraceRays()
+ *
+ *  This method is used for finding the closest hit of many
+ *  rays at once, for line of sight checks, hover probes and
+ *  visibility sampling. The rays share the picking hierarchy
+ *  and are traced in packets spread over the worker threads,
+ *  so the call returns once every ray has been traced.
+ ***********************************************************/
+void SceneManager::TraceRays(const RayBatch& rays, std::vector<RayHit>& outHits, RayBatchStats* outStats)
+{
+	if (m_rootNode)
+	{
+		UpdatePickBvh();
+	}
+	m_pickBvh.RaycastBatch(rays, outHits, &m_workerPool, outStats);
+}
+
+/***********************************************************
+ *  UpdateSpatialGrid()
+ *
+ *  This method is used for keeping the proximity grid in step
+ *  with the node bounds. Nodes whose bounds were recomputed
+ *  this frame are moved in the grid one by one; the grid is
+ *  only filled again from the whole tree when nodes were
+ *  added or removed.
+ ***********************************************************/
+void SceneManager::UpdateSpatialGrid()
+{
+	if (m_bSpatialGridStale == true)
+	{
+		m_spatialGrid.Build(m_rootNode);
+		m_bSpatialGridStale = false;
+	}
+	else
+	{
+		for (const SceneNode* node : m_movedNodes)
+		{
+			m_spatialGrid.Update(node->GetHandle(), node->GetWorldBounds());
+		}
+	}
+	m_movedNodes.clear();
+}
+
+/***********************************************************
+ *  PrintProximityStats()
+ *
+ *  This method is used for reporting what the proximity grid
+ *  finds: how many nodes each point light reaches and which
+ *  nodes are nearest the camera. The queries fill fixed
+ *  buffers, so reporting never allocates.
+ ***********************************************************/
+void SceneManager::PrintProximityStats()
+{
+	const size_t bufferSize = 64;
+	NodeHandle handles[bufferSize];
+	float distances[g_NearestNodeCount];
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	size_t litNodes = 0;
+	size_t busiestLight = 0;
+	for (const glm::vec3& position : g_PointLightPositions)
+	{
+		size_t count = m_spatialGrid.QuerySphere(position, g_PointLightRange, handles, bufferSize);
+		litNodes += count;
+		busiestLight = std::max(busiestLight, count);
+	}
+	size_t nearest = m_spatialGrid.QueryNearest(m_pCamera->Position, g_NearestNodeCount, handles, distances);
+	double queryMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	SpatialGrid::Stats gridStats = m_spatialGrid.GetStats();
+	std::cout << "Proximity grid: " << gridStats.nodes << " nodes (" << gridStats.oversizedNodes << " oversized) in "
+		<< gridStats.buckets << " buckets, " << gridStats.updates << " updates (" << gridStats.relinks << " changed cell)"
+		<< ", lights reach " << litNodes << " nodes (at most " << busiestLight << " each)"
+		<< ", nearest the camera at";
+	for (size_t i = 0; i < nearest; ++i)
+	{
+		std::cout << " " << distances[i];
+	}
+	std::cout << " in " << queryMs << " ms" << std::endl;
+}
+
+/***********************************************************
+ *  SampleVisibility()
+ *
+ *  This method is used for measuring the batch ray queries
+ *  against the current view. One ray is cast from the camera
+ *  through every cell of a screen grid, and how many found a
+ *  node and how fast the batch went are reported.
+ ***********************************************************/
+void SceneManager::SampleVisibility()
+{
+	if (m_pCamera == nullptr)
+	{
+		return;
+	}
+
+	// the far plane of the view, unprojected, gives each ray its
+	// direction from the camera
+	glm::mat4 inverseViewProjection = glm::inverse(m_frameBlock.projection * m_frameBlock.view);
+	glm::vec3 origin = m_pCamera->Position;
+	m_visibilityRays.Clear();
+	m_visibilityRays.Reserve(g_VisibilitySampleColumns * g_VisibilitySampleRows);
+	for (int row = 0; row < g_VisibilitySampleRows; ++row)
+	{
+		float y = 1.0f - 2.0f * (row + 0.5f) / g_VisibilitySampleRows;
+		for (int column = 0; column < g_VisibilitySampleColumns; ++column)
+		{
+			float x = 2.0f * (column + 0.5f) / g_VisibilitySampleColumns - 1.0f;
+			glm::vec4 farPoint = inverseViewProjection * glm::vec4(x, y, 1.0f, 1.0f);
+			m_visibilityRays.Add(Ray(origin, glm::vec3(farPoint) / farPoint.w - origin));
+		}
+	}
+
+	RayBatchStats stats;
+	TraceRays(m_visibilityRays, m_visibilityHits, &stats);
+	std::cout << "Ray batch: " << stats.rays << " camera rays, " << stats.hits << " hit a node"
+		<< ", " << stats.packets << " packets, " << stats.visitedNodes << " tree nodes visited"
+		<< ", " << stats.narrowTests << " mesh tests in " << stats.ms << " ms"
+		<< " (" << stats.GetRaysPerSecond() / 1.0e6 << " million rays/s)" << std::endl;
+}
+
+/***********************************************************
+ *  RequestPick()
+ *
+ *  This method is used for queueing a pick to be traced on
+ *  a worker thread. The worker is sent the bounds of the
+ *  nodes that moved since the last request it took, and the
+ *  whole scene only after nodes were added or removed. A
+ *  request waiting behind a busy worker is replaced rather
+ *  than queued.
+ ***********************************************************/
+void SceneManager::RequestPick(const Ray& ray)
+{
+	m_pickingService.Post(ray);
+	m_pickingService.Dispatch(m_rootNode);
+}
+
+/***********************************************************
+ *  ApplyPickResults()
+ *
+ *  This method is used for selecting what the picks finished
+ *  since the last frame hit. Only the newest result counts.
+ *  A node destroyed since its pick was traced no longer
+ *  resolves, and is not selected.
+ ***********************************************************/
+bool SceneManager::ApplyPickResults(PickingService::Result& outResult)
+{
+	bool bHasResult = false;
+	PickingService::Result result;
+	while (m_pickingService.PollResult(result) == true)
+	{
+		outResult = result;
+		bHasResult = true;
+	}
+	// a request that waited behind the one just finished goes out now
+	m_pickingService.Dispatch(m_rootNode);
+
+	if (bHasResult == false)
+	{
+		return(false);
+	}
+	std::vector<NodeHandle> previousSelection = m_selection;
+	SetSelection(outResult.hit.handle);
+	return(m_selection != previousSelection);
+}
+
+/***********************************************************
+ *  SetSelection()
+ *
+ *  This method is used for replacing the selection with a
+ *  single node, or emptying it when the handle is invalid.
+ *  Re-selecting the current selection changes nothing.
+ ***********************************************************/
+void SceneManager::SetSelection(NodeHandle handle)
+{
+	if (m_selection.size() == 1 && m_selection[0] == handle)
+	{
+		return;
+	}
+
+	ClearSelection();
+	AddToSelection(handle);
+}
+
+/***********************************************************
+ *  AddToSelection()
+ *
+ *  This method is used for adding a node to the selection
+ *  and highlighting it.
+ ***********************************************************/
+void SceneManager::AddToSelection(NodeHandle handle)
+{
+	SceneNode* node = m_nodeArena.Resolve(handle);
+	if (node == nullptr || IsSelected(handle))
+	{
+		return;
+	}
+
+	SetNodeHighlighted(node, true);
+	m_selection.push_back(handle);
+}
+
+/***********************************************************
+ *  RemoveFromSelection()
+ *
+ *  This method is used for removing a node from the
+ *  selection and clearing its highlight.
+ ***********************************************************/
+void SceneManager::RemoveFromSelection(NodeHandle handle)
+{
+	for (size_t i = 0; i < m_selection.size(); i++)
+	{
+		if (m_selection[i] == handle)
+		{
+			SceneNode* node = m_nodeArena.Resolve(handle);
+			if (node)
+			{
+				SetNodeHighlighted(node, false);
+			}
+			m_selection.erase(m_selection.begin() + i);
+			return;
+		}
+	}
+}
+
+/***********************************************************
+ *  ClearSelection()
+ *
+ *  This method is used for emptying the selection. Only the
+ *  selected nodes are visited, not the whole scene.
+ ***********************************************************/
+void SceneManager::ClearSelection()
+{
+	for (const NodeHandle& handle : m_selection)
+	{
+		SceneNode* node = m_nodeArena.Resolve(handle);
+		if (node)
+		{
+			SetNodeHighlighted(node, false);
+		}
+	}
+	m_selection.clear();
+}
+
+/***********************************************************
+ *  DetachMovedStaticNodes()
+ *
+ *  This method is used for taking nodes out of the static
+ *  batch once they have been moved. Moving a baked node
+ *  un-bakes it, so any node that moved this frame and is no
+ *  longer baked draws itself and its range in the batch is
+ *  skipped until the scene is baked again.
+ ***********************************************************/
+void SceneManager::DetachMovedStaticNodes()
+{
+	if (m_staticBatch.GetNodeCount() == 0)
+	{
+		return;
+	}
+	for (const SceneNode* node : m_movedNodes)
+	{
+		if (node->IsBaked() == false)
+		{
+			m_staticBatch.Detach(node);
+		}
+	}
+}
+
+/***********************************************************
+ *  SetNodeHighlighted()
+ *
+ *  This method is used for changing the highlight of a node.
+ *  A baked node is also carved out of its static batch, so
+ *  the batch only splits its draw around highlighted nodes.
+ ***********************************************************/
+void SceneManager::SetNodeHighlighted(SceneNode* node, bool bHighlighted)
+{
+	node->SetHighlighted(bHighlighted);
+	if (node->IsBaked())
+	{
+		m_staticBatch.SetHighlighted(node, bHighlighted);
+	}
+}
+
+/***********************************************************
+ *  IsSelected()
+ *
+ *  This method is used for checking whether a node is part
+ *  of the current selection.
+ ***********************************************************/
+bool SceneManager::IsSelected(NodeHandle handle) const
+{
+	for (const NodeHandle& selected : m_selection)
+	{
+		if (selected == handle)
+		{
+			return(true);
+		}
+	}
+	return(false);
+}
+
+/***********************************************************
+ *  LoadSceneResources()
+ *
+ *  This method is used for loading the shaders, textures,
+ *  materials and meshes shared by every scene layout. It only
+ *  does the work the first time it is called.
+ ***********************************************************/
+void SceneManager::LoadSceneResources()
+{
+	if (m_bResourcesLoaded == true)
+	{
+		return;
+	}
+
+	// the instanced draws need glDraw*BaseInstance to read each
+	// mesh's slice of the shared instance buffer
+	if (GLEW_VERSION_4_2 || GLEW_ARB_base_instance)
+	{
+		m_instancedProgramID = m_pShaderManager->LoadShaders("vertex_instanced.glsl", "fragment.glsl");
+	}
+	// loaded last so the shader manager is left pointing at it
+	programID = m_pShaderManager->LoadShaders("vertex.glsl", "fragment.glsl");
+
+	LoadSceneTextures();
+	DefineObjectMaterials();
+
+	// the samplers are looked up by texture tag, so this
+	// waits until the textures are loaded
+	ResolveUniforms(programID, m_uniforms);
+	UniformBuffer::BindProgramBlocks(programID);
+	CreateUniformBuffers();
+
+	if (m_instancedProgramID != 0)
+	{
+		ResolveUniforms(m_instancedProgramID, m_instancedUniforms);
+		UniformBuffer::BindProgramBlocks(m_instancedProgramID);
+
+		// the main program has its samplers set as textures are
+		// bound, but the instanced one never binds them itself,
+		// so point each sampler at its texture's slot up front
+		UseProgram(m_instancedProgramID);
+		for (int i = 0; i < m_loadedTextures; i++)
+		{
+			m_pShaderManager->setSampler2DValue(m_instancedUniforms.textures[i], i);
+		}
+		UseProgram(programID);
+	}
+	m_renderQueue.SetInstancingEnabled(m_instancedProgramID != 0);
+
+	// only one instance of a particular mesh needs to be
+	// loaded in memory no matter how many times it is drawn
+	// in the rendered 3D scene
+
+	m_basicMeshes->LoadBoxMesh();
+	m_basicMeshes->LoadPlaneMesh();
+	m_basicMeshes->LoadCylinderMesh();
+	m_basicMeshes->LoadConeMesh();
+	m_basicMeshes->LoadPrismMesh();
+	m_basicMeshes->LoadPyramid4Mesh();
+	m_basicMeshes->LoadSphereMesh();
+	m_basicMeshes->LoadTaperedCylinderMesh();
+	m_basicMeshes->LoadTorusMesh();
+
+	// with multi-draw indirect every instanced primitive comes
+	// from one shared buffer and goes out in a single call
+	if (m_instancedProgramID != 0 && (GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect))
+	{
+		m_basicMeshes->BuildSharedMeshBuffer();
+	}
+	BuildMeshBVHs();
+
+	// loading binds programs and textures directly, so the
+	// cache starts over from what the driver now has
+	m_stateCache.Invalidate();
+
+	m_bResourcesLoaded = true;
+}
+
+/***********************************************************
+ *  BuildMeshBVHs()
+ *
+ *  This method is used for building a triangle hierarchy
+ *  over the full-detail CPU copy of each primitive mesh.
+ *  Picking traces rays through them in mesh space, so one
+ *  hierarchy serves every node drawing that mesh.
+ ***********************************************************/
+void SceneManager::BuildMeshBVHs()
+{
+	// position, normal and uv, matching ShapeMeshes
+	const size_t floatsPerVertex = 8;
+	const struct
+	{
+		SceneNode::MeshType type;
+		const ShapeMeshes::MeshData* data;
+	} meshes[] = {
+		{ SceneNode::MeshType::Box, &m_basicMeshes->GetBoxMeshData() },
+		{ SceneNode::MeshType::Sphere, &m_basicMeshes->GetSphereMeshData() },
+		{ SceneNode::MeshType::Cylinder, &m_basicMeshes->GetCylinderMeshData() },
+		{ SceneNode::MeshType::Plane, &m_basicMeshes->GetPlaneMeshData() },
+		{ SceneNode::MeshType::Pyramid, &m_basicMeshes->GetPyramid4MeshData() }
+	};
+
+	for (const auto& mesh : meshes)
+	{
+		TriangleBVH& bvh = m_meshBvhs[static_cast<int>(mesh.type)];
+		bvh.Build(mesh.data->vertices, mesh.data->indices, floatsPerVertex);
+		m_pickBvh.SetMeshBVH(mesh.type, bvh.IsEmpty() ? nullptr : &bvh);
+		m_pickingService.SetMeshBVH(mesh.type, bvh.IsEmpty() ? nullptr : &bvh);
+	}
+}
+
+/***********************************************************
+ *  PrintSceneStats()
+ *
+ *  This method is used for reporting the size of the scene
+ *  that was just built.
+ ***********************************************************/
+void SceneManager::PrintSceneStats()
+{
+	std::cout << "Scene nodes: " << m_nodeArena.GetNodeCount()
+		<< ", node bytes: " << m_nodeArena.GetBytesUsed()
+		<< " (reserved " << m_nodeArena.GetBytesReserved()
+		<< " in " << m_nodeArena.GetBlockCount() << " blocks)" << std::endl;
+
+	for (const std::unique_ptr<Prefab>& prefab : m_prefabs)
+	{
+		std::cout << "Prefab " << prefab->GetName() << ": " << prefab->GetParts().size()
+			<< " parts, " << prefab->GetInstances().size() << " instances" << std::endl;
+	}
+}
+
+/***********************************************************
+ *  PrepareStressScene()
+ *
+ *  This method is used for building a large generated scene
+ *  in place of the hand-placed one, for measuring how the
+ *  transform, culling, picking and drawing code scales. Each
+ *  cell of a grid or random scatter holds a small tree of
+ *  group nodes whose leaves are lanterns, docks, shrines and
+ *  loose primitives. With a target node count the number of
+ *  cells is derived from the average size of the first ones.
+ *  The ground is baked like the hand-placed scene's; the
+ *  generated cells are left to the per-node paths.
+ ***********************************************************/
+void SceneManager::PrepareStressScene(const STRESS_SCENE_SETTINGS& settings)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	LoadSceneResources();
+
+	ClearScene();
+	m_rootNode = CreateNode();
+	m_rootNode->AddChild(CreateGround());
+
+	std::mt19937 random(settings.seed);
+	int columns = std::max(settings.columns, 1);
+	int rows = std::max(settings.rows, 1);
+	size_t cellCount = static_cast<size_t>(columns) * rows;
+	if (settings.targetNodeCount > 0)
+	{
+		// grown below once the size of a cell is known
+		cellCount = std::max<size_t>(cellCount, 4);
+	}
+	size_t leafIndex = 0;
+	size_t comboIndex = 0;
+	size_t baseNodes = m_nodeArena.GetNodeCount();
+	bool bSized = (settings.targetNodeCount == 0);
+
+	for (size_t cell = 0; cell < cellCount; cell++)
+	{
+		SceneNode* cellRoot = CreateNode();
+		m_rootNode->AddChild(cellRoot);
+		BuildStressCell(cellRoot, settings, 0, leafIndex, comboIndex);
+
+		// size the layout once every leaf kind has appeared, since
+		// a dock or shrine is far larger than a lantern
+		if (bSized == false && leafIndex >= 4)
+		{
+			bSized = true;
+			double cellNodes = static_cast<double>(m_nodeArena.GetNodeCount() - baseNodes) / (cell + 1);
+			double remaining = static_cast<double>(settings.targetNodeCount > baseNodes ? settings.targetNodeCount - baseNodes : 0);
+			cellCount = std::max<size_t>(static_cast<size_t>(std::ceil(remaining / cellNodes)), cell + 1);
+			columns = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(cellCount))));
+			rows = static_cast<int>((cellCount + columns - 1) / columns);
+		}
+	}
+
+	// place the cells once the final layout is known
+	const std::vector<SceneNode*>& cells = m_rootNode->GetChildren();
+	std::uniform_real_distribution<float> scatterX(0.0f, columns * settings.spacing);
+	std::uniform_real_distribution<float> scatterZ(0.0f, rows * settings.spacing);
+	std::uniform_real_distribution<float> scatterYaw(0.0f, 360.0f);
+	// the first child is the ground
+	for (size_t i = 1; i < cells.size(); i++)
+	{
+		size_t cell = i - 1;
+		glm::vec3 position;
+		float yaw = 0.0f;
+		if (settings.bScatter == true)
+		{
+			position = glm::vec3(scatterX(random), 0.0f, scatterZ(random));
+			yaw = scatterYaw(random);
+		}
+		else
+		{
+			position = glm::vec3((cell % columns) * settings.spacing, 0.0f, (cell / columns) * settings.spacing);
+		}
+		cells[i]->SetTransform(position, glm::vec3(0.0f, yaw, 0.0f), glm::vec3(1.0f));
+	}
+
+	BakeStaticGeometry();
+
+	double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Stress scene: " << cellCount << " cells (" << columns << "x" << rows
+		<< (settings.bScatter ? ", scattered" : ", grid") << "), depth " << settings.depth
+		<< ", fan-out " << settings.fanOut << ", variety " << settings.variety
+		<< ", built in " << elapsedMs << " ms" << std::endl;
+	PrintSceneStats();
+}
+
+/***********************************************************
+ *  BuildStressCell()
+ *
+ *  This method is used for filling one level of a stress
+ *  scene cell. Group levels fan out in a ring around their
+ *  parent; the leaves cycle through lanterns, docks, shrines
+ *  and single primitives.
+ ***********************************************************/
+void SceneManager::BuildStressCell(SceneNode* parent, const STRESS_SCENE_SETTINGS& settings, int level, size_t& leafIndex,
+	size_t& comboIndex)
+{
+	if (level < settings.depth)
+	{
+		int fanOut = std::max(settings.fanOut, 1);
+		// each level packs its ring into the space left by the one above
+		float radius = settings.spacing * 0.25f / static_cast<float>(level + 1);
+		for (int i = 0; i < fanOut; i++)
+		{
+			float angle = glm::two_pi<float>() * i / fanOut;
+			SceneNode* group = CreateNode();
+			group->SetTransform(glm::vec3(std::cos(angle) * radius, 0.0f, std::sin(angle) * radius),
+				glm::vec3(0.0f, glm::degrees(angle), 0.0f), glm::vec3(1.0f));
+			parent->AddChild(group);
+			BuildStressCell(group, settings, level + 1, leafIndex, comboIndex);
+		}
+		return;
+	}
+
+	SceneNode* leaf = nullptr;
+	switch (leafIndex % 4)
+	{
+	case 0:
+		leaf = CreateLantern(glm::vec3(0.0f));
+		break;
+	case 1:
+		leaf = CreateDock(glm::vec3(0.0f, 1.875f, 0.0f));
+		break;
+	case 2:
+		// the shrine is modelled around (23, 0, 18), so pull it back to the origin
+		leaf = CreateShrine();
+		leaf->SetTransform(glm::vec3(-23.0f, 0.0f, -18.0f), glm::vec3(0.0f), glm::vec3(1.0f));
+		break;
+	default:
+		leaf = CreateNode();
+		leaf->SetTransform(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f), glm::vec3(2.0f));
+		leaf->SetMesh(leafIndex % 8 == 3 ? SceneNode::MeshType::Box : SceneNode::MeshType::Sphere);
+		leaf->SetMaterial("stoneTexture");
+		leaf->SetTexture("stoneTexture", 1);
+		break;
+	}
+
+	if (settings.variety > 1)
+	{
+		ApplyStressVariety(leaf, settings.variety, comboIndex);
+	}
+	// generated copies are not baked; they exist to stress the per-node paths
+	leaf->SetStatic(false);
+	parent->AddChild(leaf);
+	leafIndex++;
+}
+
+/***********************************************************
+ *  ApplyStressVariety()
+ *
+ *  This method is used for giving every drawing node of a
+ *  generated subtree the next material and texture in a
+ *  cycle through the loaded set, so the number of distinct
+ *  combinations controls how many state changes a frame
+ *  needs. Prefab instances take the pair as an override for
+ *  all of their parts.
+ ***********************************************************/
+void SceneManager::ApplyStressVariety(SceneNode* node, int variety, size_t& comboIndex)
+{
+	if (m_objectMaterials.empty() || m_loadedTextures == 0)
+	{
+		return;
+	}
+
+	if (node->GetPrefab() != nullptr || node->GetMeshType() != SceneNode::MeshType::Custom)
+	{
+		size_t combo = comboIndex++ % variety;
+		int textureSlot = static_cast<int>(combo % m_loadedTextures);
+		node->SetMaterial(m_objectMaterials[combo % m_objectMaterials.size()].tag);
+		node->SetTexture(m_textureIDs[textureSlot].tag, textureSlot);
+	}
+	for (SceneNode* child : node->GetChildren())
+	{
+		ApplyStressVariety(child, variety, comboIndex);
+	}
+}
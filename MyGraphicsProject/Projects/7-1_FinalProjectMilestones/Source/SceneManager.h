@@ -11,9 +11,26 @@
 
 #include "ShaderManager.h"
 #include "SceneNode.h"
+#include "TransformHierarchy.h"
+#include "SceneNodeArena.h"
+#include "WorkerPool.h"
+#include "Prefab.h"
+#include "StaticBatch.h"
+#include "Frustum.h"
+#include "OcclusionBuffer.h"
+#include "LodSelector.h"
+#include "SceneBVH.h"
+#include "PickingService.h"
+#include "SpatialGrid.h"
+#include "TextureLoader.h"
+#include "RenderQueue.h"
+#include "UniformBuffer.h"
+#include "GLStateCache.h"
 #include "ShapeMeshes.h"
 #include "camera.h"
 
+#include <chrono>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -37,6 +54,24 @@ public:
 		uint32_t ID;
 	};
 
+	// layout of a generated scene used for scaling measurements
+	struct STRESS_SCENE_SETTINGS
+	{
+		// cells laid out as a grid, or scattered over the same area
+		int columns = 10;
+		int rows = 10;
+		bool bScatter = false;
+		float spacing = 40.0f;
+		// when non-zero, columns and rows are chosen to reach this many nodes
+		size_t targetNodeCount = 0;
+		// levels of group nodes in each cell, and children per group
+		int depth = 1;
+		int fanOut = 4;
+		// number of material and texture combinations cycled over the leaves
+		int variety = 1;
+		unsigned int seed = 1;
+	};
+
 	struct OBJECT_MATERIAL
 	{
 		float ambientStrength;
@@ -47,8 +82,87 @@ public:
 		std::string tag;
 	};
 
+	// uniforms of a scene program, resolved once after loading
+	struct SCENE_UNIFORMS
+	{
+		ShaderManager::UniformHandle model;
+		ShaderManager::UniformHandle normalMatrix;
+		ShaderManager::UniformHandle useTexture;
+		ShaderManager::UniformHandle bUseTexture;
+		ShaderManager::UniformHandle objectColor;
+		ShaderManager::UniformHandle objectTexture;
+		ShaderManager::UniformHandle object;
+		ShaderManager::UniformHandle highlight;
+		ShaderManager::UniformHandle uvScale;
+		// entry of the material block used by the next draw
+		ShaderManager::UniformHandle materialIndex;
+		// sampler of each loaded texture, by texture slot
+		ShaderManager::UniformHandle textures[16];
+	};
+
 private:
 	SceneNode* m_rootNode = nullptr;
+	// contiguous storage for every node in the scene
+	SceneNodeArena m_nodeArena;
+	// flattened, index-based copy of the node transforms
+	TransformHierarchy m_transformHierarchy;
+	// when true, world transforms are resolved through m_transformHierarchy
+	bool m_useFlatHierarchy = false;
+	// worker threads for the scene's parallel update passes
+	WorkerPool m_workerPool;
+	// shared subtree definitions placed in the scene as instances
+	std::vector<std::unique_ptr<Prefab>> m_prefabs;
+	Prefab* m_lanternPrefab = nullptr;
+	// merged, pre-transformed geometry of the static subtrees
+	StaticBatch m_staticBatch;
+	// currently selected (highlighted) nodes
+	std::vector<NodeHandle> m_selection;
+	// sorted draw packets for the current frame
+	RenderQueue m_renderQueue;
+	// bound GL state, so repeated binds and switches are dropped
+	GLStateCache m_stateCache;
+	// view volume of the current frame, and what the last cull
+	// pass tested and rejected
+	Frustum m_frustum;
+	CullStats m_cullStats;
+	bool m_bCullingEnabled = true;
+	// depth drawn on the CPU from the occluder nodes, which are
+	// gathered again whenever the draw packets are recorded
+	OcclusionBuffer m_occlusionBuffer;
+	std::vector<SceneNode*> m_occluders;
+	bool m_bOccludersStale = true;
+	bool m_bOcclusionEnabled = true;
+	double m_cullMs = 0.0;
+	// levels of detail are chosen again only when the view or
+	// some bounds changed since the last pass
+	LodSelector m_lodSelector;
+	LodStats m_lodStats;
+	glm::mat4 m_lodViewProjection = glm::mat4(0.0f);
+	bool m_bLodStale = true;
+	bool m_bLodEnabled = true;
+	// picking hierarchy over the node bounds, rebuilt when the draw
+	// packets are recorded again and refitted when bounds change
+	SceneBVH m_pickBvh;
+	bool m_bPickBvhStale = true;
+	bool m_bPickBvhRefit = false;
+	// triangles of each primitive mesh for the exact picking
+	// tests, built once when the meshes are loaded
+	TriangleBVH m_meshBvhs[static_cast<int>(SceneNode::MeshType::Custom)];
+	// picks traced on a worker, from its own copy of the bounds
+	PickingService m_pickingService;
+	// proximity index over the node bounds, rebuilt with the draw
+	// packets and otherwise updated with the nodes that moved
+	SpatialGrid m_spatialGrid;
+	bool m_bSpatialGridStale = true;
+	std::vector<const SceneNode*> m_movedNodes;
+	// camera rays traced for the query stats, kept between reports
+	RayBatch m_visibilityRays;
+	std::vector<RayHit> m_visibilityHits;
+	// print the render queue counters every few seconds
+	bool m_bPrintRenderStats = false;
+	// print the ray batch and proximity grid measurements as often
+	bool m_bPrintQueryStats = false;
+	unsigned int m_frameCount = 0;
 	// pointer to parent node for scene
 	Camera* m_pCamera;
 	// pointer to shader manager object
@@ -57,16 +171,48 @@ private:
 	ShapeMeshes* m_basicMeshes;
 	// total number of loaded textures
 	int m_loadedTextures;
+	// true once the shaders, textures and meshes are loaded
+	bool m_bResourcesLoaded;
 	// loaded textures info
 	TEXTURE_INFO m_textureIDs[16];
+	// texture files decoded on the workers; each texture shows a
+	// placeholder until its image is uploaded
+	TextureLoader m_textureLoader;
+	std::chrono::steady_clock::time_point m_loadStartTime;
+	double m_textureDecodeMs = 0.0;
+	double m_textureUploadMs = 0.0;
+	// textures whose image could not be used, their slots left empty
+	int m_failedTextures = 0;
+	bool m_bFirstFrameReported = false;
 	// defined object materials
 	std::vector<OBJECT_MATERIAL> m_objectMaterials;
 	// Added this in for programID
 	GLuint programID;
 	GLuint skyboxID;
+	// program for the instanced primitive draws; 0 when the
+	// driver lacks base-instance support
+	GLuint m_instancedProgramID = 0;
+	// resolved uniforms of programID and m_instancedProgramID
+	SCENE_UNIFORMS m_uniforms;
+	SCENE_UNIFORMS m_instancedUniforms;
+	// uniform blocks shared by both programs: camera and time,
+	// written once per frame, and the material and light tables,
+	// written when they are defined
+	UniformBuffer m_frameUniformBuffer;
+	UniformBuffer m_materialUniformBuffer;
+	UniformBuffer m_lightUniformBuffer;
+	FrameBlock m_frameBlock;
 
-	// load texture images and convert to OpenGL texture data
+	// create a texture showing a placeholder and queue its image
+	// file to be decoded on a worker
 	bool CreateGLTexture(const char* filename, std::string tag);
+	// upload the images decoded since the last frame, a few at a time
+	void UploadDecodedTextures();
+	// replace a texture's placeholder with its decoded image;
+	// false when the image could not be read or used
+	bool UploadTextureImage(const TextureLoader::Image& image);
+	// free a texture whose image failed, so its tag no longer resolves
+	void ReleaseFailedTexture(int slot);
 	// bind loaded OpenGL textures to slots in memory
 	void BindGLTextures();
 	// free the loaded OpenGL textures
@@ -96,6 +242,52 @@ private:
 
 	void DefineObjectMaterials();
 
+	// allocate a scene node from the scene's node arena
+	SceneNode* CreateNode();
+	// build the shared lantern definition used by CreateLantern()
+	void DefineLanternPrefab();
+	// load the shaders, textures, materials and meshes once
+	void LoadSceneResources();
+	// build the picking triangle hierarchy of each primitive mesh
+	void BuildMeshBVHs();
+	// report node and prefab counts for the current scene
+	void PrintSceneStats();
+	// fill one level of a generated stress scene cell
+	void BuildStressCell(SceneNode* parent, const STRESS_SCENE_SETTINGS& settings, int level, size_t& leafIndex,
+		size_t& comboIndex);
+	// cycle the material and texture of every drawing node in a subtree
+	void ApplyStressVariety(SceneNode* node, int variety, size_t& comboIndex);
+	// look up the scene's uniforms in a loaded program
+	void ResolveUniforms(GLuint program, SCENE_UNIFORMS& uniforms);
+	// create the uniform blocks and fill the material and light tables
+	void CreateUniformBuffers();
+	void UploadMaterialBlock();
+	void UploadLightBlock();
+	// switch programs through the state cache and the shader manager
+	void UseProgram(GLuint program);
+	// draw the queued primitives through the instanced program
+	void RenderInstancedPrimitives();
+	// hide the queued draws of nodes outside the view frustum
+	void CullScene();
+	// collect the occluder nodes and prefab instances under node
+	void GatherOccluders(SceneNode* node);
+	// draw the occluders into the CPU depth buffer
+	void RasterizeOccluders(const glm::mat4& viewProjection);
+	// pick the mesh detail of each node from its size on screen
+	void SelectLevelsOfDetail(bool bBoundsChanged);
+	// bring the picking hierarchy up to date with the node bounds
+	void UpdatePickBvh();
+	// trace a grid of camera rays and report the batch throughput
+	void SampleVisibility();
+	// bring the proximity grid up to date with the moved nodes
+	void UpdateSpatialGrid();
+	// report what the proximity grid finds around the lights and camera
+	void PrintProximityStats();
+	// highlight a node and carve it out of its static batch
+	void SetNodeHighlighted(SceneNode* node, bool bHighlighted);
+	// leave baked nodes that were moved out of the static batch
+	void DetachMovedStaticNodes();
+
 public:
 	// find a loaded texture by tag
 	int FindTextureID(std::string tag);
@@ -106,13 +298,80 @@ public:
 	void SetShaderTexture(std::string textureTag, int object);
 	// set the object material into the shader
 	void SetShaderMaterial(std::string materialTag);
+	// entry of a material in the material block; 0 is the default
+	int FindMaterialIndex(const std::string& materialTag) const;
+	// camera matrices for the frame about to be rendered
+	void SetViewTransforms(const glm::mat4& view, const glm::mat4& projection);
 	// The following methods are for the students to 
 	// customize for their own 3D scene
 	void PrepareScene();
+	// build a generated scene for scaling measurements instead
+	void PrepareStressScene(const STRESS_SCENE_SETTINGS& settings);
 	void RenderScene();
 	SceneNode* CreateLantern(const glm::vec3& basePosition);
 	SceneNode* CreateGround();
 	SceneNode* CreateShrine();
 	SceneNode* CreateDock(const glm::vec3& centerPosition);
 	SceneNode* GetRootNode() const { return m_rootNode; }
+	// register a new, empty prefab owned by the scene
+	Prefab* CreatePrefab(const std::string& name);
+	// place a prefab in the scene as a single instance node
+	SceneNode* InstantiatePrefab(Prefab* prefab, const glm::vec3& position,
+		const glm::vec3& rotation = glm::vec3(0.0f), const glm::vec3& scale = glm::vec3(1.0f));
+	const std::vector<std::unique_ptr<Prefab>>& GetPrefabs() const { return m_prefabs; }
+	// switch between pointer-tree and flattened transform updates
+	void SetFlatHierarchyEnabled(bool bEnabled);
+	// bring every cached world matrix up to date
+	void UpdateTransforms();
+	// destroy every node in the scene at once
+	void ClearScene();
+	// report draw and state change counts while rendering
+	void SetRenderStatsEnabled(bool bEnabled) { m_bPrintRenderStats = bEnabled; }
+	// report ray batch and proximity query timings; the queries
+	// stall the frame they run on, so they have their own switch
+	void SetQueryStatsEnabled(bool bEnabled) { m_bPrintQueryStats = bEnabled; }
+	const RenderQueue::Stats& GetRenderStats() const { return m_renderQueue.GetStats(); }
+	// skip the nodes outside the view frustum, testing whole subtrees at once
+	void SetCullingEnabled(bool bEnabled);
+	const CullStats& GetCullStats() const { return m_cullStats; }
+	// also skip the nodes hidden behind the flagged occluders
+	void SetOcclusionCullingEnabled(bool bEnabled) { m_bOcclusionEnabled = bEnabled; }
+	const OcclusionBuffer::Stats& GetOcclusionStats() const { return m_occlusionBuffer.GetStats(); }
+	// draw distant spheres and cylinders with fewer triangles
+	void SetLodEnabled(bool bEnabled);
+	const LodStats& GetLodStats() const { return m_lodStats; }
+	// uniforms of the main scene program
+	const SCENE_UNIFORMS& GetUniforms() const { return m_uniforms; }
+	// GL state tracker every render path binds through
+	GLStateCache& GetStateCache() { return m_stateCache; }
+	// draw the basic primitives with one instanced call per mesh
+	void SetInstancingEnabled(bool bEnabled);
+	// merge the geometry of static subtrees into batched meshes
+	void BakeStaticGeometry();
+	const SceneBVH::Stats& GetPickStats() const { return m_pickBvh.GetStats(); }
+	// nodes near a point, for lighting and gameplay queries; up to
+	// date with the bounds of the last rendered frame
+	const SpatialGrid& GetSpatialGrid() const { return m_spatialGrid; }
+	// find the closest hit of every ray in a batch, in batch order,
+	// tracing packets of rays across the worker threads
+	void TraceRays(const RayBatch& rays, std::vector<RayHit>& outHits, RayBatchStats* outStats = nullptr);
+	// queue a pick to be traced off the render thread; only the
+	// latest request waiting for the worker is kept
+	void RequestPick(const Ray& ray);
+	// select what the finished picks hit; call at the start of a
+	// frame. Returns true, with the latest result, when the
+	// selection changed.
+	bool ApplyPickResults(PickingService::Result& outResult);
+	// look up a node by handle; nullptr once it has been destroyed
+	SceneNode* ResolveNode(NodeHandle handle) const { return m_nodeArena.Resolve(handle); }
+	// selection set; only the nodes entering or leaving it are touched
+	void SetSelection(NodeHandle handle);
+	void AddToSelection(NodeHandle handle);
+	void RemoveFromSelection(NodeHandle handle);
+	void ClearSelection();
+	bool IsSelected(NodeHandle handle) const;
+	const std::vector<NodeHandle>& GetSelection() const { return m_selection; }
+	// node and memory counters for the current scene
+	size_t GetSceneNodeCount() const { return m_nodeArena.GetNodeCount(); }
+	size_t GetSceneNodeBytes() const { return m_nodeArena.GetBytesUsed(); }
 };
\ No newline at end of file
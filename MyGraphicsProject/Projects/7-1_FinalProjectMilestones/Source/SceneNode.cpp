@@ -1,7 +1,11 @@
 #include "SceneNode.h"
-#include "Ray.h"
-#include "SceneManager.h"
-#include "ShaderManager.h"
+#include "ShapeMeshes.h"
+#include "TransformHierarchy.h"
+#include "WorkerPool.h"
+#include "Prefab.h"
+#include "RenderQueue.h"
+#include "OcclusionBuffer.h"
+#include "LodSelector.h"
 
 
 #include <glm/gtc/matrix_transform.hpp>
@@ -11,8 +15,13 @@ SceneNode::SceneNode() :
     m_textureSlot(0), m_drawFunction(nullptr) {}
 
 SceneNode::~SceneNode() {
-    for (SceneNode* child : m_children) {
-        delete child;
+    if (m_hierarchy) {
+        m_hierarchy->DetachNode(m_hierarchyIndex);
+    }
+    if (m_ownsChildren) {
+        for (SceneNode* child : m_children) {
+            delete child;
+        }
     }
     m_children.clear();
 }
@@ -21,112 +30,369 @@ void SceneNode::SetTransform(const glm::vec3& position, const glm::vec3& rotatio
     m_position = position;
     m_rotation = rotation;
     m_scale = scale;
+    if (m_hierarchy) {
+        m_hierarchy->SetLocalTransform(m_hierarchyIndex, position, rotation, scale);
+    }
+    // The batch holds this subtree where it used to be, so it draws itself from now
+    // on; the scene sees it move and leaves it out of the batch
+    if (m_isBaked) {
+        Unbake();
+    }
+    MarkTransformDirty();
+}
+
+void SceneNode::Unbake() {
+    if (m_isBaked) {
+        SetBaked(false);
+    }
+    for (SceneNode* child : m_children) {
+        child->Unbake();
+    }
+}
+
+void SceneNode::MarkTransformDirty() {
+    m_transformDirty = true;
+    MarkDrawDirty();
+    MarkBoundsDirty();
+    // Stop climbing once an ancestor already knows a descendant is pending
+    for (SceneNode* node = m_parent; node && !node->m_childTransformDirty; node = node->m_parent) {
+        node->m_childTransformDirty = true;
+    }
+}
+
+void SceneNode::MarkDrawDirty() {
+    m_drawDirty = true;
+    for (SceneNode* node = m_parent; node && !node->m_childDrawDirty; node = node->m_parent) {
+        node->m_childDrawDirty = true;
+    }
+}
+
+void SceneNode::MarkBoundsDirty() {
+    m_boundsDirty = true;
+    for (SceneNode* node = m_parent; node && !node->m_childBoundsDirty; node = node->m_parent) {
+        node->m_childBoundsDirty = true;
+    }
+}
+
+void SceneNode::InvalidateDrawPackets() {
+    m_drawStructureDirty = true;
+    MarkDrawDirty();
 }
 
 void SceneNode::SetMaterial(const std::string& materialTag) {
     m_materialTag = materialTag;
+    MarkDrawDirty();
 }
 
 void SceneNode::SetTexture(const std::string& textureTag, int slot) {
     m_textureTag = textureTag;
     m_textureSlot = slot;
+    MarkDrawDirty();
+}
+
+void SceneNode::SetHighlighted(bool value) {
+    if (value == m_isHighlighted) {
+        return;
+    }
+    m_isHighlighted = value;
+    // A baked node only emits a packet while highlighted
+    if (m_isBaked) {
+        InvalidateDrawPackets();
+    }
+    else {
+        MarkDrawDirty();
+    }
 }
 
 void SceneNode::SetMeshDrawFunction(void (*drawFunc)(ShapeMeshes*)) {
     m_drawFunction = drawFunc;
+    // An arbitrary draw call can't be batched or instanced as a known primitive
+    m_meshType = MeshType::Custom;
+    m_localBounds = GetMeshBounds(MeshType::Custom);
+    MarkBoundsDirty();
+    InvalidateDrawPackets();
+}
+
+void SceneNode::SetMesh(MeshType type) {
+    m_meshType = type;
+    switch (type) {
+    case MeshType::Box:
+        m_drawFunction = [](ShapeMeshes* mesh) { mesh->DrawBoxMesh(); };
+        break;
+    case MeshType::Sphere:
+        m_drawFunction = [](ShapeMeshes* mesh) { mesh->DrawSphereMesh(); };
+        break;
+    case MeshType::Cylinder:
+        m_drawFunction = [](ShapeMeshes* mesh) { mesh->DrawCylinderMesh(); };
+        break;
+    case MeshType::Plane:
+        m_drawFunction = [](ShapeMeshes* mesh) { mesh->DrawPlaneMesh(); };
+        break;
+    case MeshType::Pyramid:
+        m_drawFunction = [](ShapeMeshes* mesh) { mesh->DrawPyramid4Mesh(); };
+        break;
+    case MeshType::Custom:
+        break;
+    }
+    m_localBounds = GetMeshBounds(type);
+    MarkBoundsDirty();
+    InvalidateDrawPackets();
+}
+
+AABB SceneNode::GetMeshBounds(MeshType type) {
+    // Matches the vertex data built by ShapeMeshes
+    switch (type) {
+    case MeshType::Box:
+    case MeshType::Pyramid:
+        return AABB(glm::vec3(-0.5f), glm::vec3(0.5f));
+    case MeshType::Sphere:
+        return AABB(glm::vec3(-1.0f), glm::vec3(1.0f));
+    case MeshType::Cylinder:
+        return AABB(glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec3(1.0f, 1.0f, 1.0f));
+    case MeshType::Plane:
+        return AABB(glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec3(1.0f, 0.0f, 1.0f));
+    default:
+        return AABB(glm::vec3(-1.0f), glm::vec3(1.0f));
+    }
+}
+
+AABB SceneNode::GetOccluderBounds(MeshType type) {
+    switch (type) {
+    case MeshType::Box:
+        return GetMeshBounds(type);
+    case MeshType::Sphere:
+        // Cube inscribed in the unit sphere
+        return AABB(glm::vec3(-0.577f), glm::vec3(0.577f));
+    case MeshType::Cylinder:
+        // Square inscribed in the unit circle, over the full height
+        return AABB(glm::vec3(-0.707f, 0.0f, -0.707f), glm::vec3(0.707f, 1.0f, 0.707f));
+    default:
+        return AABB();
+    }
+}
+
+void SceneNode::SetLocalBounds(const AABB& bounds) {
+    m_localBounds = bounds;
+    MarkBoundsDirty();
+}
+
+void SceneNode::SetPrefab(const Prefab* prefab) {
+    m_prefab = prefab;
+    if (m_prefab) {
+        m_localBounds = m_prefab->GetLocalBounds();
+    }
+    MarkBoundsDirty();
+    InvalidateDrawPackets();
 }
 
 void SceneNode::AddChild(SceneNode* child) {
+    child->m_parent = this;
     m_children.push_back(child);
+    child->MarkTransformDirty();
+    InvalidateDrawPackets();
+    // A flattened hierarchy has no room for new slots; it is rebuilt on the next update
+    if (m_hierarchy) {
+        m_hierarchy->Invalidate();
+    }
 }
 
-void SceneNode::Render(SceneManager* sceneManager, ShaderManager* shaderManager, ShapeMeshes* meshes, const glm::mat4& parentTransform) {
-    glm::mat4 transform = parentTransform;
-    transform = glm::translate(transform, m_position);
-    transform = glm::rotate(transform, glm::radians(m_rotation.x), glm::vec3(1, 0, 0));
-    transform = glm::rotate(transform, glm::radians(m_rotation.y), glm::vec3(0, 1, 0));
-    transform = glm::rotate(transform, glm::radians(m_rotation.z), glm::vec3(0, 0, 1));
-    transform = glm::scale(transform, m_scale);
+void SceneNode::BindToHierarchy(TransformHierarchy* hierarchy, int index) {
+    m_hierarchy = hierarchy;
+    m_hierarchyIndex = index;
+}
 
-    if (shaderManager) {
-        shaderManager->setMat4Value("model", transform);
-        shaderManager->setIntValue("bUseTexture", true);
-        shaderManager->setSampler2DValue(m_textureTag, m_textureSlot);
-        shaderManager->setBoolValue("uHighlight", m_isHighlighted);
-    }
+const glm::mat4& SceneNode::GetWorldMatrix() const {
+    return m_hierarchy ? m_hierarchy->GetWorldMatrix(m_hierarchyIndex) : m_worldMatrix;
+}
+
+const glm::mat4& SceneNode::GetInverseWorldMatrix() const {
+    return m_hierarchy ? m_hierarchy->GetInverseWorldMatrix(m_hierarchyIndex) : m_inverseWorldMatrix;
+}
+
+const glm::mat3& SceneNode::GetNormalMatrix() const {
+    return m_hierarchy ? m_hierarchy->GetNormalMatrix(m_hierarchyIndex) : m_normalMatrix;
+}
 
+void SceneNode::UpdateWorldTransform(const glm::mat4& parentWorld, bool parentChanged, WorkerPool* pool) {
+    bool changed = parentChanged || m_transformDirty;
 
-    if (sceneManager) {
-        sceneManager->SetShaderMaterial(m_materialTag);
-        sceneManager->SetShaderTexture(m_textureTag, m_textureSlot);
+    if (m_transformDirty) {
+        m_localMatrix = glm::translate(glm::mat4(1.0f), m_position);
+        m_localMatrix = glm::rotate(m_localMatrix, glm::radians(m_rotation.x), glm::vec3(1, 0, 0));
+        m_localMatrix = glm::rotate(m_localMatrix, glm::radians(m_rotation.y), glm::vec3(0, 1, 0));
+        m_localMatrix = glm::rotate(m_localMatrix, glm::radians(m_rotation.z), glm::vec3(0, 0, 1));
+        m_localMatrix = glm::scale(m_localMatrix, m_scale);
+        m_transformDirty = false;
     }
 
+    if (changed) {
+        m_worldMatrix = parentWorld * m_localMatrix;
+        m_inverseWorldMatrix = glm::inverse(m_worldMatrix);
+        m_normalMatrix = glm::mat3(glm::transpose(m_inverseWorldMatrix));
+    }
 
-    if (m_drawFunction && meshes) {
-        m_drawFunction(meshes);
+    // Clean subtrees under a clean parent are skipped entirely
+    if (changed || m_childTransformDirty) {
+        if (pool && m_children.size() > 1) {
+            // Sibling subtrees only write their own nodes, so they can update concurrently
+            pool->ParallelFor(m_children.size(), 1, [this, changed](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    m_children[i]->UpdateWorldTransform(m_worldMatrix, changed);
+                }
+            });
+        }
+        else {
+            for (SceneNode* child : m_children) {
+                child->UpdateWorldTransform(m_worldMatrix, changed);
+            }
+        }
     }
+    m_childTransformDirty = false;
+}
+
+void SceneNode::CollectDrawPackets(RenderQueue& queue) {
+    m_firstDrawPacket = static_cast<uint32_t>(queue.GetPacketCount());
+    AddOwnDrawPackets(queue);
+    m_drawPacketCount = static_cast<uint32_t>(queue.GetPacketCount()) - m_firstDrawPacket;
+    m_drawDirty = false;
+    m_childDrawDirty = false;
+    m_drawStructureDirty = false;
 
+    m_subtreeNodeCount = 1;
     for (SceneNode* child : m_children) {
-        child->Render(sceneManager, shaderManager, meshes, transform);
+        child->CollectDrawPackets(queue);
+        m_subtreeNodeCount += child->m_subtreeNodeCount;
     }
+    m_subtreePacketEnd = static_cast<uint32_t>(queue.GetPacketCount());
+}
 
-    if (m_isHighlighted && meshes) {
-        glm::mat4 model = parentTransform;
-        model = glm::translate(model, m_position);
-        model = glm::rotate(model, glm::radians(m_rotation.x), glm::vec3(1, 0, 0));
-        model = glm::rotate(model, glm::radians(m_rotation.y), glm::vec3(0, 1, 0));
-        model = glm::rotate(model, glm::radians(m_rotation.z), glm::vec3(0, 0, 1));
-        model = glm::scale(model, m_scale);
+bool SceneNode::RefreshDrawPackets(RenderQueue& queue, bool parentChanged) {
+    if (m_drawStructureDirty) {
+        return false;
+    }
 
-        
+    // Children inherit this node's world matrix, so a changed node rewrites its whole subtree
+    bool changed = parentChanged || m_drawDirty;
+    if (changed && m_drawPacketCount > 0) {
+        queue.BeginRewrite(m_firstDrawPacket);
+        AddOwnDrawPackets(queue);
+        if (!queue.EndRewrite(m_firstDrawPacket + m_drawPacketCount)) {
+            return false;
+        }
     }
 
+    // Clean subtrees under a clean parent are skipped entirely
+    if (changed || m_childDrawDirty) {
+        for (SceneNode* child : m_children) {
+            if (!child->RefreshDrawPackets(queue, changed)) {
+                return false;
+            }
+        }
+    }
+    m_drawDirty = false;
+    m_childDrawDirty = false;
+    return true;
 }
 
-bool SceneNode::Intersects(const Ray& ray, const glm::mat4& parentTransform, float& outDistance) const {
-    // Full transform
-    glm::mat4 model = parentTransform;
-    model = glm::translate(model, m_position);
-    model = glm::rotate(model, glm::radians(m_rotation.x), glm::vec3(1, 0, 0));
-    model = glm::rotate(model, glm::radians(m_rotation.y), glm::vec3(0, 1, 0));
-    model = glm::rotate(model, glm::radians(m_rotation.z), glm::vec3(0, 0, 1));
-    model = glm::scale(model, m_scale);
-
-    // Inverse transform ray into local space
-    glm::mat4 invModel = glm::inverse(model);
-    glm::vec3 localOrigin = glm::vec3(invModel * glm::vec4(ray.origin, 1.0f));
-    glm::vec3 localDir = glm::normalize(glm::vec3(invModel * glm::vec4(ray.direction, 0.0f)));
-    Ray localRay(localOrigin, localDir);
+bool SceneNode::UpdateBounds(bool parentMoved, std::vector<const SceneNode*>* movedNodes) {
+    bool moved = parentMoved || m_boundsDirty;
+    bool changed = moved || m_childBoundsDirty;
+    if (moved) {
+        // Only what the node draws counts; grouping nodes just gather their children
+        if (m_prefab || m_drawFunction) {
+            m_worldBounds = m_localBounds.Transformed(GetWorldMatrix());
+        }
+        else {
+            m_worldBounds = AABB();
+        }
+        if (movedNodes) {
+            movedNodes->push_back(this);
+        }
+    }
 
-    // Intersect local AABB
-    return localRay.intersectsAABB(m_localMin, m_localMax, outDistance);
+    if (moved || m_childBoundsDirty) {
+        m_subtreeBounds = m_worldBounds;
+        for (SceneNode* child : m_children) {
+            child->UpdateBounds(moved, movedNodes);
+            m_subtreeBounds.Expand(child->m_subtreeBounds);
+        }
+    }
+    m_boundsDirty = false;
+    m_childBoundsDirty = false;
+    return changed;
 }
 
-// Checks the hit, try and fix this if able, too far from objects and the rays seemingly choose whatever direction at random 
-void SceneNode::CheckRayHit(const Ray& ray, const glm::mat4& parentTransform,
-    SceneNode*& closestNode, float& closestDistance) {
-    glm::mat4 model = parentTransform;
-    model = glm::translate(model, m_position);
-    model = glm::rotate(model, glm::radians(m_rotation.x), glm::vec3(1, 0, 0));
-    model = glm::rotate(model, glm::radians(m_rotation.y), glm::vec3(0, 1, 0));
-    model = glm::rotate(model, glm::radians(m_rotation.z), glm::vec3(0, 0, 1));
-    model = glm::scale(model, m_scale);
-
-    glm::mat4 invModel = glm::inverse(model);
-    glm::vec3 localOrigin = glm::vec3(invModel * glm::vec4(ray.origin, 1.0f));
-    glm::vec3 localDir = glm::normalize(glm::vec3(invModel * glm::vec4(ray.direction, 0.0f)));
-    Ray localRay(localOrigin, localDir);
+void SceneNode::UpdateLod(const LodSelector& selector, LodStats& stats) {
+    // Baked nodes are drawn by their batch at full detail
+    bool hasLods = m_prefab ? m_prefab->HasLodParts() : (m_drawFunction && !m_isBaked && HasLodChain(m_meshType));
+    if (hasLods) {
+        int level = selector.Select(m_worldBounds, m_lodLevel);
+        ++stats.nodes;
+        if (level != m_lodLevel) {
+            m_lodLevel = static_cast<uint8_t>(level);
+            ++stats.changes;
+            MarkDrawDirty();
+        }
+    }
+    for (SceneNode* child : m_children) {
+        child->UpdateLod(selector, stats);
+    }
+}
 
-    float tHit;
-    if (localRay.intersectsAABB(m_localMin, m_localMax, tHit)) {
-        if (tHit > 0.0f && tHit < closestDistance) {
-            closestDistance = tHit;
-            closestNode = this;
+void SceneNode::Cull(const Frustum& frustum, const OcclusionBuffer* occlusion, RenderQueue& queue, CullStats& stats,
+    bool insideFrustum) const {
+    ++stats.testedNodes;
+    Frustum::Containment containment = insideFrustum ? Frustum::Containment::Inside : frustum.Classify(m_subtreeBounds);
+    bool occluded = containment != Frustum::Containment::Outside && occlusion && occlusion->IsOccluded(m_subtreeBounds);
+    if (containment == Frustum::Containment::Outside || occluded) {
+        queue.SetPacketsVisible(m_firstDrawPacket, m_subtreePacketEnd, false);
+        stats.culledNodes += m_subtreeNodeCount;
+        if (occluded) {
+            stats.occludedNodes += m_subtreeNodeCount;
         }
+        return;
+    }
+    // Without occluders there is nothing left to test below a subtree wholly inside
+    if (containment == Frustum::Containment::Inside && !occlusion) {
+        queue.SetPacketsVisible(m_firstDrawPacket, m_subtreePacketEnd, true);
+        stats.visibleNodes += m_subtreeNodeCount;
+        return;
     }
 
+    // Decide this node on its own box, then recurse; a leaf's own box is its
+    // subtree box, which has already been tested
+    bool visible = m_drawPacketCount > 0;
+    if (visible && containment == Frustum::Containment::Intersecting) {
+        visible = frustum.Classify(m_worldBounds) != Frustum::Containment::Outside;
+    }
+    if (visible && occlusion && !m_children.empty() && occlusion->IsOccluded(m_worldBounds)) {
+        visible = false;
+        ++stats.occludedNodes;
+    }
+    queue.SetPacketsVisible(m_firstDrawPacket, m_firstDrawPacket + m_drawPacketCount, visible);
+    ++(visible ? stats.visibleNodes : stats.culledNodes);
     for (SceneNode* child : m_children) {
-        child->CheckRayHit(ray, model, closestNode, closestDistance);
+        child->Cull(frustum, occlusion, queue, stats, containment == Frustum::Containment::Inside);
+    }
+}
+
+void SceneNode::AddOwnDrawPackets(RenderQueue& queue) const {
+    if (m_prefab) {
+        const glm::mat4& world = GetWorldMatrix();
+        const glm::mat3& normal = GetNormalMatrix();
+        for (const Prefab::Part& part : m_prefab->GetParts()) {
+            bool overrideTexture = !m_textureTag.empty();
+            queue.Add(world * part.localMatrix, normal * part.normalMatrix,
+                m_materialTag.empty() ? part.materialTag : m_materialTag,
+                overrideTexture ? m_textureTag : part.textureTag,
+                overrideTexture ? m_textureSlot : part.textureSlot,
+                part.drawFunction, part.meshType, m_isHighlighted, m_lodLevel);
+        }
+    }
+    // Baked geometry is drawn by its batch, which leaves out highlighted nodes
+    else if (m_drawFunction && (!m_isBaked || m_isHighlighted)) {
+        queue.Add(GetWorldMatrix(), GetNormalMatrix(), m_materialTag, m_textureTag, m_textureSlot,
+            m_drawFunction, m_meshType, m_isHighlighted, m_lodLevel);
     }
 }
 
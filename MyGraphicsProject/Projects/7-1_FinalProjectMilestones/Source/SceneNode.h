@@ -1,16 +1,28 @@
 #pragma once
 
-#include "Ray.h"
+#include "NodeHandle.h"
+#include "AABB.h"
+#include "Frustum.h"
 #include <vector>
 #include <glm/glm.hpp>
 #include <string>
+#include <cstdint>
 
-class SceneManager;
-class ShaderManager;
 class ShapeMeshes;
+class TransformHierarchy;
+class SceneNodeArena;
+class WorkerPool;
+class Prefab;
+class RenderQueue;
+class OcclusionBuffer;
+class LodSelector;
+struct LodStats;
 
 
 class SceneNode {
+    friend class SceneNodeArena;
+    // resolves the transforms of bound nodes and clears their dirty flags
+    friend class TransformHierarchy;
 public:
     enum class MeshType {
         Box,
@@ -28,19 +40,106 @@ public:
     void SetTexture(const std::string& textureTag, int slot);
     void SetMeshDrawFunction(void (*drawFunc)(ShapeMeshes*));
     void AddChild(SceneNode* child);
-    void Render(SceneManager* sceneManager, ShaderManager* shaderManager, ShapeMeshes* meshes, const glm::mat4& parentTransform);
-    bool Intersects(const Ray& ray, const glm::mat4& parentTransform, float& outDistance) const;
-    void CheckRayHit(const Ray& ray, const glm::mat4& parentTransform, SceneNode*& closestNode, float& closestDistance);
-    void SetHighlighted(bool value) { m_isHighlighted = value; }
+    // Recomputes cached matrices for this subtree, skipping branches with no pending changes.
+    // With a pool, this node's children are handed out to the workers as independent subtrees.
+    void UpdateWorldTransform(const glm::mat4& parentWorld, bool parentChanged = false, WorkerPool* pool = nullptr);
+    // Appends a draw packet for each of this subtree's meshes,
+    // remembering which packets of the queue belong to each node
+    void CollectDrawPackets(RenderQueue& queue);
+    // Rewrites in place the packets of nodes changed since they were collected, skipping
+    // clean subtrees. Returns false when a change adds or removes packets, in which case
+    // the subtree has to be collected again.
+    bool RefreshDrawPackets(RenderQueue& queue, bool parentChanged = false);
+    // For changes that alter how many packets a node emits
+    void InvalidateDrawPackets();
+    // Refreshes world and subtree bounds below nodes that moved; call after the
+    // world transforms are up to date. Returns true when any bounds changed. Nodes
+    // whose own world bounds were recomputed are appended to movedNodes, when given.
+    bool UpdateBounds(bool parentMoved = false, std::vector<const SceneNode*>* movedNodes = nullptr);
+    // Chooses the level of detail of every node in this subtree from its world
+    // bounds; call after UpdateBounds. Nodes that change level rewrite their packets.
+    void UpdateLod(const LodSelector& selector, LodStats& stats);
+    // Shows or hides this subtree's recorded packets by testing subtree bounds against
+    // the frustum, so a subtree wholly inside or outside costs one test. With an
+    // occlusion buffer, subtrees hidden behind the occluders are rejected as well.
+    void Cull(const Frustum& frustum, const OcclusionBuffer* occlusion, RenderQueue& queue, CullStats& stats,
+        bool insideFrustum = false) const;
+    // Invalid for nodes that were not created by a SceneNodeArena
+    NodeHandle GetHandle() const { return m_handle; }
+    void SetHighlighted(bool value);
     bool IsHighlighted() const { return m_isHighlighted; }
-    void SetMeshType(MeshType type) { m_meshType = type; }
+    void SetMeshType(MeshType type) { m_meshType = type; MarkDrawDirty(); }
+    // Sets the mesh type together with the matching ShapeMeshes draw call
+    void SetMesh(MeshType type);
     MeshType GetMeshType() const { return m_meshType; }
+    // Extent of a primitive mesh in its own space; custom meshes get a unit-radius box
+    static AABB GetMeshBounds(MeshType type);
+    // Overrides the local box, e.g. for a custom mesh of known size
+    void SetLocalBounds(const AABB& bounds);
+    const AABB& GetLocalBounds() const { return m_localBounds; }
+    // World box of this node's own mesh, empty when it draws nothing
+    const AABB& GetWorldBounds() const { return m_worldBounds; }
+    // World box of everything drawn in this subtree
+    const AABB& GetSubtreeBounds() const { return m_subtreeBounds; }
+    // Box that fits inside a primitive mesh, drawn into the occlusion buffer in its
+    // place; empty for meshes too thin or irregular to hide anything reliably
+    static AABB GetOccluderBounds(MeshType type);
+    // Primitives with coarser versions in ShapeMeshes, see ShapeMeshes::HasLodChain
+    static bool HasLodChain(MeshType type) { return type == MeshType::Sphere || type == MeshType::Cylinder; }
+    // 0 is full detail; prefab instances apply theirs to every part that has levels
+    int GetLodLevel() const { return m_lodLevel; }
+    // Occluders are large, solid nodes whose depth is drawn on the CPU each frame so
+    // that whatever they hide can be skipped
+    void SetOccluder(bool value) { m_isOccluder = value; }
+    bool IsOccluder() const { return m_isOccluder; }
     const std::vector<SceneNode*>& GetChildren() const { return m_children; }
+    SceneNode* GetParent() const { return m_parent; }
+
+    const glm::vec3& GetPosition() const { return m_position; }
+    const glm::vec3& GetRotation() const { return m_rotation; }
+    const glm::vec3& GetScale() const { return m_scale; }
+
+    // Cached matrices, valid after the last UpdateWorldTransform pass. When the node
+    // is bound to a TransformHierarchy the world matrices come from its arrays instead.
+    const glm::mat4& GetLocalMatrix() const { return m_localMatrix; }
+    const glm::mat4& GetWorldMatrix() const;
+    const glm::mat4& GetInverseWorldMatrix() const;
+    const glm::mat3& GetNormalMatrix() const;
+
+    void BindToHierarchy(TransformHierarchy* hierarchy, int index);
+    int GetHierarchyIndex() const { return m_hierarchyIndex; }
+
+    // Turns this node into a placement of a prefab; its own material and texture,
+    // when set, override those of every part
+    void SetPrefab(const Prefab* prefab);
+    const Prefab* GetPrefab() const { return m_prefab; }
+
+    // Static subtrees never move after the scene is prepared and may be baked.
+    // A baked node's geometry lives in a StaticBatch; it only draws itself while
+    // highlighted, and stays in the tree so picking still resolves to it. Moving a
+    // baked node un-bakes it and everything below it.
+    void SetStatic(bool value) { m_isStatic = value; }
+    bool IsStatic() const { return m_isStatic; }
+    void SetBaked(bool value) { m_isBaked = value; InvalidateDrawPackets(); }
+    bool IsBaked() const { return m_isBaked; }
+    const std::string& GetMaterialTag() const { return m_materialTag; }
+    const std::string& GetTextureTag() const { return m_textureTag; }
+    int GetTextureSlot() const { return m_textureSlot; }
 
 
 
 
 private:
+    // Flags this node for recompute and tells every ancestor a descendant is pending
+    void MarkTransformDirty();
+    // Flags this node's packets for rewrite and tells every ancestor a descendant is pending
+    void MarkDrawDirty();
+    // Flags this node's bounds and tells every ancestor its subtree bounds are stale
+    void MarkBoundsDirty();
+    // Clears the baked flag of this node and its baked descendants
+    void Unbake();
+    void AddOwnDrawPackets(RenderQueue& queue) const;
+
     glm::vec3 m_position;
     glm::vec3 m_rotation;
     glm::vec3 m_scale;
@@ -51,10 +150,44 @@ private:
 
     void (*m_drawFunction)(ShapeMeshes*);
 
+    SceneNode* m_parent = nullptr;
     std::vector<SceneNode*> m_children;
+    // false for arena nodes, whose storage is released by the arena in one go
+    bool m_ownsChildren = true;
+    NodeHandle m_handle;
+
+    glm::mat4 m_localMatrix = glm::mat4(1.0f);
+    glm::mat4 m_worldMatrix = glm::mat4(1.0f);
+    glm::mat4 m_inverseWorldMatrix = glm::mat4(1.0f);
+    glm::mat3 m_normalMatrix = glm::mat3(1.0f);
+    bool m_transformDirty = true;
+    bool m_childTransformDirty = false;
+
+    // Packets [m_firstDrawPacket, m_firstDrawPacket + m_drawPacketCount) of the
+    // render queue were emitted by this node at the last collection
+    uint32_t m_firstDrawPacket = 0;
+    uint32_t m_drawPacketCount = 0;
+    bool m_drawDirty = true;
+    bool m_childDrawDirty = false;
+    bool m_drawStructureDirty = false;
+    // End of the packets emitted by this whole subtree, and its node count
+    uint32_t m_subtreePacketEnd = 0;
+    uint32_t m_subtreeNodeCount = 1;
+
+    const Prefab* m_prefab = nullptr;
+
+    TransformHierarchy* m_hierarchy = nullptr;
+    int m_hierarchyIndex = -1;
 
-    glm::vec3 m_localMin = glm::vec3(-0.5f);
-    glm::vec3 m_localMax = glm::vec3(0.5f);
+    AABB m_localBounds = AABB(glm::vec3(-0.5f), glm::vec3(0.5f));
+    AABB m_worldBounds;
+    AABB m_subtreeBounds;
+    bool m_boundsDirty = true;
+    bool m_childBoundsDirty = false;
     MeshType m_meshType = MeshType::Custom;
     bool m_isHighlighted = false;
+    bool m_isStatic = false;
+    bool m_isBaked = false;
+    bool m_isOccluder = false;
+    uint8_t m_lodLevel = 0;
 };
@@ -0,0 +1,66 @@
+#include "SceneNodeArena.h"
+#include "SceneNode.h"
+
+#include <new>
+
+SceneNodeArena::SceneNodeArena(size_t nodesPerBlock) :
+    m_nodesPerBlock(nodesPerBlock > 0 ? nodesPerBlock : 1), m_nodeCount(0) {}
+
+SceneNodeArena::~SceneNodeArena() {
+    Release();
+}
+
+SceneNode* SceneNodeArena::Create() {
+    size_t block = m_nodeCount / m_nodesPerBlock;
+    size_t slot = m_nodeCount % m_nodesPerBlock;
+    if (block == m_blocks.size()) {
+        m_blocks.push_back(static_cast<SceneNode*>(::operator new(m_nodesPerBlock * sizeof(SceneNode))));
+    }
+
+    if (m_nodeCount == m_generations.size()) {
+        m_generations.push_back(1);
+    }
+
+    SceneNode* node = new (m_blocks[block] + slot) SceneNode();
+    node->m_ownsChildren = false;
+    node->m_handle.index = static_cast<uint32_t>(m_nodeCount);
+    node->m_handle.generation = m_generations[m_nodeCount];
+    ++m_nodeCount;
+    return node;
+}
+
+void SceneNodeArena::Reset() {
+    // Nodes still run their destructors to release strings and child lists,
+    // but nothing is handed back to the allocator
+    for (size_t i = 0; i < m_nodeCount; ++i) {
+        m_blocks[i / m_nodesPerBlock][i % m_nodesPerBlock].~SceneNode();
+        // Skip 0 on wrap-around so a recycled slot never matches the null handle
+        if (++m_generations[i] == 0) {
+            m_generations[i] = 1;
+        }
+    }
+    m_nodeCount = 0;
+}
+
+void SceneNodeArena::Release() {
+    Reset();
+    for (SceneNode* block : m_blocks) {
+        ::operator delete(block);
+    }
+    m_blocks.clear();
+}
+
+SceneNode* SceneNodeArena::Resolve(NodeHandle handle) const {
+    if (!handle.IsValid() || handle.index >= m_nodeCount || m_generations[handle.index] != handle.generation) {
+        return nullptr;
+    }
+    return &m_blocks[handle.index / m_nodesPerBlock][handle.index % m_nodesPerBlock];
+}
+
+size_t SceneNodeArena::GetBytesUsed() const {
+    return m_nodeCount * sizeof(SceneNode);
+}
+
+size_t SceneNodeArena::GetBytesReserved() const {
+    return m_blocks.size() * m_nodesPerBlock * sizeof(SceneNode);
+}
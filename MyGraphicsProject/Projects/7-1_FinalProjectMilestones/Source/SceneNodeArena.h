@@ -0,0 +1,41 @@
+#pragma once
+
+#include "NodeHandle.h"
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+class SceneNode;
+
+// Scene-owned pool that hands out SceneNodes from contiguous blocks. Nodes created
+// here never delete their children; the arena tears the whole scene down at once,
+// and Reset() keeps the blocks around so rebuilding a scene does not touch the heap.
+class SceneNodeArena {
+public:
+    explicit SceneNodeArena(size_t nodesPerBlock = 256);
+    ~SceneNodeArena();
+
+    SceneNode* Create();
+    // Destroys every node but keeps the blocks for the next scene
+    void Reset();
+    // Destroys every node and returns the blocks to the heap
+    void Release();
+
+    // Returns the node a handle was issued for, or nullptr once that node is gone
+    SceneNode* Resolve(NodeHandle handle) const;
+
+    size_t GetNodeCount() const { return m_nodeCount; }
+    size_t GetBlockCount() const { return m_blocks.size(); }
+    size_t GetBytesUsed() const;
+    size_t GetBytesReserved() const;
+
+private:
+    SceneNodeArena(const SceneNodeArena&) = delete;
+    SceneNodeArena& operator=(const SceneNodeArena&) = delete;
+
+    std::vector<SceneNode*> m_blocks;
+    size_t m_nodesPerBlock;
+    size_t m_nodeCount;
+    // Current generation of every slot ever used; bumped each time its node is destroyed
+    std::vector<uint32_t> m_generations;
+};
@@ -0,0 +1,354 @@
+#include "SpatialGrid.h"
+#include "SceneNode.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+    const uint32_t g_None = 0xFFFFFFFFu;
+    // Bucket of the items on the oversized list
+    const uint32_t g_Oversized = 0xFFFFFFFEu;
+    const size_t g_MinBuckets = 64;
+    // Cell coordinates are clamped to this, so far-away points still convert to int
+    const float g_MaxCellCoordinate = 16777216.0f;
+}
+
+SpatialGrid::SpatialGrid(float cellSize) :
+    m_cellSize(cellSize), m_invCellSize(1.0f / cellSize),
+    m_buckets(g_MinBuckets, g_None), m_oversizedHead(g_None), m_oversizedCount(0),
+    m_cellMin(INT_MAX), m_cellMax(INT_MIN), m_updates(0), m_relinks(0) {}
+
+void SpatialGrid::Clear() {
+    m_items.clear();
+    std::fill(m_buckets.begin(), m_buckets.end(), g_None);
+    m_oversizedHead = g_None;
+    m_oversizedCount = 0;
+    std::fill(m_itemOfSlot.begin(), m_itemOfSlot.end(), g_None);
+    m_cellMin = glm::ivec3(INT_MAX);
+    m_cellMax = glm::ivec3(INT_MIN);
+    m_updates = 0;
+    m_relinks = 0;
+}
+
+void SpatialGrid::Build(const SceneNode* root) {
+    Clear();
+    if (root) {
+        Insert(root);
+    }
+    m_updates = 0;
+    m_relinks = 0;
+}
+
+void SpatialGrid::Insert(const SceneNode* node) {
+    // Grouping nodes draw nothing and have empty bounds of their own
+    if (!node->GetWorldBounds().IsEmpty()) {
+        Update(node->GetHandle(), node->GetWorldBounds());
+    }
+    for (const SceneNode* child : node->GetChildren()) {
+        Insert(child);
+    }
+}
+
+SpatialGrid::Stats SpatialGrid::GetStats() const {
+    Stats stats;
+    stats.nodes = m_items.size();
+    stats.oversizedNodes = m_oversizedCount;
+    stats.buckets = m_buckets.size();
+    stats.updates = m_updates;
+    stats.relinks = m_relinks;
+    return stats;
+}
+
+uint32_t SpatialGrid::Place(const AABB& bounds, glm::ivec3& outCell) const {
+    glm::vec3 cell = glm::clamp(glm::floor(bounds.GetCenter() * m_invCellSize),
+        glm::vec3(-g_MaxCellCoordinate), glm::vec3(g_MaxCellCoordinate));
+    outCell = glm::ivec3(cell);
+    // Anything up to a cell across stays within half a cell of the cell holding its center
+    glm::vec3 size = bounds.max - bounds.min;
+    if (size.x > m_cellSize || size.y > m_cellSize || size.z > m_cellSize) {
+        return g_Oversized;
+    }
+    return GetBucket(outCell);
+}
+
+uint32_t SpatialGrid::GetBucket(const glm::ivec3& cell) const {
+    uint32_t hash = (static_cast<uint32_t>(cell.x) * 73856093u) ^ (static_cast<uint32_t>(cell.y) * 19349663u) ^
+        (static_cast<uint32_t>(cell.z) * 83492791u);
+    return hash & static_cast<uint32_t>(m_buckets.size() - 1);
+}
+
+uint32_t& SpatialGrid::GetHead(uint32_t bucket) {
+    return bucket == g_Oversized ? m_oversizedHead : m_buckets[bucket];
+}
+
+void SpatialGrid::Link(uint32_t index) {
+    Item& item = m_items[index];
+    uint32_t& head = GetHead(item.bucket);
+    item.prev = g_None;
+    item.next = head;
+    if (head != g_None) {
+        m_items[head].prev = index;
+    }
+    head = index;
+    if (item.bucket == g_Oversized) {
+        ++m_oversizedCount;
+    }
+    else {
+        m_cellMin = glm::min(m_cellMin, item.cell);
+        m_cellMax = glm::max(m_cellMax, item.cell);
+    }
+}
+
+void SpatialGrid::Unlink(uint32_t index) {
+    Item& item = m_items[index];
+    if (item.prev != g_None) {
+        m_items[item.prev].next = item.next;
+    }
+    else {
+        GetHead(item.bucket) = item.next;
+    }
+    if (item.next != g_None) {
+        m_items[item.next].prev = item.prev;
+    }
+    if (item.bucket == g_Oversized) {
+        --m_oversizedCount;
+    }
+}
+
+void SpatialGrid::Rehash(size_t bucketCount) {
+    m_buckets.assign(bucketCount, g_None);
+    m_oversizedHead = g_None;
+    m_oversizedCount = 0;
+    for (uint32_t index = 0; index < m_items.size(); ++index) {
+        Item& item = m_items[index];
+        if (item.bucket != g_Oversized) {
+            item.bucket = GetBucket(item.cell);
+        }
+        Link(index);
+    }
+}
+
+void SpatialGrid::Update(NodeHandle handle, const AABB& bounds) {
+    if (!handle.IsValid()) {
+        return;
+    }
+    if (bounds.IsEmpty()) {
+        Remove(handle);
+        return;
+    }
+    ++m_updates;
+    if (handle.index >= m_itemOfSlot.size()) {
+        m_itemOfSlot.resize(handle.index + 1, g_None);
+    }
+
+    glm::ivec3 cell;
+    uint32_t bucket = Place(bounds, cell);
+    uint32_t index = m_itemOfSlot[handle.index];
+    if (index == g_None) {
+        index = static_cast<uint32_t>(m_items.size());
+        m_itemOfSlot[handle.index] = index;
+        Item item;
+        item.bounds = bounds;
+        item.handle = handle;
+        item.cell = cell;
+        item.bucket = bucket;
+        m_items.push_back(item);
+        // Keep about one item per bucket; a rehash links the new item with the rest
+        if (m_items.size() > m_buckets.size()) {
+            Rehash(m_buckets.size() * 2);
+        }
+        else {
+            Link(index);
+        }
+        return;
+    }
+
+    // Moving within its cell only changes the box the queries test
+    Item& item = m_items[index];
+    item.bounds = bounds;
+    item.handle = handle;
+    if (bucket == item.bucket && (bucket == g_Oversized || cell == item.cell)) {
+        return;
+    }
+    Unlink(index);
+    item.cell = cell;
+    item.bucket = bucket;
+    Link(index);
+    ++m_relinks;
+}
+
+void SpatialGrid::Remove(NodeHandle handle) {
+    if (!handle.IsValid() || handle.index >= m_itemOfSlot.size()) {
+        return;
+    }
+    uint32_t index = m_itemOfSlot[handle.index];
+    if (index == g_None || m_items[index].handle != handle) {
+        return;
+    }
+    Unlink(index);
+    m_itemOfSlot[handle.index] = g_None;
+
+    // The last item fills the hole, relinked at its new index
+    uint32_t last = static_cast<uint32_t>(m_items.size() - 1);
+    if (index != last) {
+        Unlink(last);
+        m_items[index] = m_items[last];
+        m_itemOfSlot[m_items[index].handle.index] = index;
+        m_items.pop_back();
+        Link(index);
+    }
+    else {
+        m_items.pop_back();
+    }
+}
+
+template<typename Visitor>
+void SpatialGrid::VisitCell(const glm::ivec3& cell, Visitor&& visit) const {
+    // Other cells can hash to the same bucket; their items are skipped here and
+    // visited from their own cell
+    for (uint32_t index = m_buckets[GetBucket(cell)]; index != g_None; index = m_items[index].next) {
+        if (m_items[index].cell == cell) {
+            visit(index);
+        }
+    }
+}
+
+template<typename Visitor>
+void SpatialGrid::VisitRegion(const AABB& region, Visitor&& visit) const {
+    for (uint32_t index = m_oversizedHead; index != g_None; index = m_items[index].next) {
+        visit(index);
+    }
+    if (m_cellMin.x > m_cellMax.x) {
+        return;
+    }
+
+    // Items overhang their cell by up to half a cell
+    glm::vec3 margin(m_cellSize * 0.5f);
+    glm::ivec3 low = glm::ivec3(glm::clamp(glm::floor((region.min - margin) * m_invCellSize),
+        glm::vec3(m_cellMin), glm::vec3(m_cellMax)));
+    glm::ivec3 high = glm::ivec3(glm::clamp(glm::floor((region.max + margin) * m_invCellSize),
+        glm::vec3(m_cellMin), glm::vec3(m_cellMax)));
+    if (low.x > high.x || low.y > high.y || low.z > high.z) {
+        return;
+    }
+
+    // Past one cell per item, checking every item is cheaper than the cells
+    size_t cellCount = static_cast<size_t>(high.x - low.x + 1) * static_cast<size_t>(high.y - low.y + 1) *
+        static_cast<size_t>(high.z - low.z + 1);
+    if (cellCount > m_items.size()) {
+        for (uint32_t index = 0; index < m_items.size(); ++index) {
+            if (m_items[index].bucket != g_Oversized) {
+                visit(index);
+            }
+        }
+        return;
+    }
+    for (int z = low.z; z <= high.z; ++z) {
+        for (int y = low.y; y <= high.y; ++y) {
+            for (int x = low.x; x <= high.x; ++x) {
+                VisitCell(glm::ivec3(x, y, z), visit);
+            }
+        }
+    }
+}
+
+template<typename Visitor>
+void SpatialGrid::VisitRing(const glm::ivec3& center, int ring, Visitor&& visit) const {
+    glm::ivec3 low = glm::max(center - glm::ivec3(ring), m_cellMin);
+    glm::ivec3 high = glm::min(center + glm::ivec3(ring), m_cellMax);
+    for (int x = low.x; x <= high.x; ++x) {
+        for (int y = low.y; y <= high.y; ++y) {
+            // On the side faces every z is in the ring, elsewhere only the top and bottom
+            if (std::abs(x - center.x) == ring || std::abs(y - center.y) == ring) {
+                for (int z = low.z; z <= high.z; ++z) {
+                    VisitCell(glm::ivec3(x, y, z), visit);
+                }
+                continue;
+            }
+            if (center.z - ring >= low.z) {
+                VisitCell(glm::ivec3(x, y, center.z - ring), visit);
+            }
+            if (center.z + ring <= high.z) {
+                VisitCell(glm::ivec3(x, y, center.z + ring), visit);
+            }
+        }
+    }
+}
+
+size_t SpatialGrid::QuerySphere(const glm::vec3& center, float radius, NodeHandle* outHandles, size_t capacity) const {
+    size_t count = 0;
+    float radiusSquared = radius * radius;
+    VisitRegion(AABB(center - glm::vec3(radius), center + glm::vec3(radius)), [&](uint32_t index) {
+        if (m_items[index].bounds.DistanceSquared(center) <= radiusSquared) {
+            if (count < capacity) {
+                outHandles[count] = m_items[index].handle;
+            }
+            ++count;
+        }
+    });
+    return count;
+}
+
+size_t SpatialGrid::QueryBox(const AABB& box, NodeHandle* outHandles, size_t capacity) const {
+    size_t count = 0;
+    VisitRegion(box, [&](uint32_t index) {
+        if (m_items[index].bounds.Overlaps(box)) {
+            if (count < capacity) {
+                outHandles[count] = m_items[index].handle;
+            }
+            ++count;
+        }
+    });
+    return count;
+}
+
+size_t SpatialGrid::QueryNearest(const glm::vec3& point, size_t k, NodeHandle* outHandles, float* outDistances) const {
+    if (k == 0) {
+        return 0;
+    }
+
+    // The buffers hold the best so far, sorted by squared distance
+    size_t found = 0;
+    auto consider = [&](uint32_t index) {
+        float distanceSquared = m_items[index].bounds.DistanceSquared(point);
+        if (found == k && distanceSquared >= outDistances[k - 1]) {
+            return;
+        }
+        size_t slot = (found < k) ? found++ : k - 1;
+        for (; slot > 0 && outDistances[slot - 1] > distanceSquared; --slot) {
+            outHandles[slot] = outHandles[slot - 1];
+            outDistances[slot] = outDistances[slot - 1];
+        }
+        outHandles[slot] = m_items[index].handle;
+        outDistances[slot] = distanceSquared;
+    };
+
+    for (uint32_t index = m_oversizedHead; index != g_None; index = m_items[index].next) {
+        consider(index);
+    }
+    if (m_cellMin.x <= m_cellMax.x) {
+        // Search outwards ring by ring from the point's cell. An item in a ring further
+        // out than r has its center over r cells away and overhangs by half a cell, so
+        // once the k-th best is nearer than that the rest cannot beat it.
+        glm::ivec3 center = glm::ivec3(glm::clamp(glm::floor(point * m_invCellSize),
+            glm::vec3(-g_MaxCellCoordinate), glm::vec3(g_MaxCellCoordinate)));
+        glm::ivec3 before = glm::max(glm::max(m_cellMin - center, center - m_cellMax), glm::ivec3(0));
+        glm::ivec3 across = glm::max(m_cellMax - center, center - m_cellMin);
+        int firstRing = std::max(std::max(before.x, before.y), before.z);
+        int lastRing = std::max(std::max(across.x, across.y), across.z);
+        for (int ring = firstRing; ring <= lastRing; ++ring) {
+            VisitRing(center, ring, consider);
+            float reach = (ring - 0.5f) * m_cellSize;
+            if (found == k && reach > 0.0f && outDistances[k - 1] <= reach * reach) {
+                break;
+            }
+        }
+    }
+
+    for (size_t slot = 0; slot < found; ++slot) {
+        outDistances[slot] = std::sqrt(outDistances[slot]);
+    }
+    return found;
+}
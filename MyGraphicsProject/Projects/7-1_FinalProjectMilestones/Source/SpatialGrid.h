@@ -0,0 +1,100 @@
+#pragma once
+
+#include "AABB.h"
+#include "NodeHandle.h"
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class SceneNode;
+
+// Loose uniform grid over the world bounds of the drawing nodes, answering "what is
+// near this point" without walking the scene. Each node sits in the one cell holding
+// the center of its box and may overhang it by up to half a cell, so queries widen
+// their search by that much; boxes too big for that go on a short list every query
+// checks. Cells are hashed into a bucket table sized to the node count, so the grid
+// has no fixed origin or extent.
+//
+// Nodes are looked up by handle. A node that moves is updated in place and only
+// relinked when its center crosses into another cell.
+//
+// Queries write into buffers owned by the caller and never allocate. They return how
+// many nodes matched, which may be more than the buffer could hold.
+class SpatialGrid {
+public:
+    struct Stats {
+        size_t nodes = 0;
+        // nodes too big for their cell, tested by every query
+        size_t oversizedNodes = 0;
+        size_t buckets = 0;
+        // since the last Build
+        size_t updates = 0;
+        size_t relinks = 0;
+    };
+
+    explicit SpatialGrid(float cellSize = 4.0f);
+
+    // Indexes every drawing node under root, replacing what was there
+    void Build(const SceneNode* root);
+    void Clear();
+    // Adds a node, or moves one already indexed; empty bounds remove it
+    void Update(NodeHandle handle, const AABB& bounds);
+    void Remove(NodeHandle handle);
+
+    // Nodes whose box reaches within radius of center
+    size_t QuerySphere(const glm::vec3& center, float radius, NodeHandle* outHandles, size_t capacity) const;
+    // Nodes whose box overlaps box
+    size_t QueryBox(const AABB& box, NodeHandle* outHandles, size_t capacity) const;
+    // Up to k nodes whose boxes are nearest the point, nearest first, with their
+    // distances; 0 for a box the point is inside
+    size_t QueryNearest(const glm::vec3& point, size_t k, NodeHandle* outHandles, float* outDistances) const;
+
+    float GetCellSize() const { return m_cellSize; }
+    Stats GetStats() const;
+
+private:
+    struct Item {
+        AABB bounds;
+        NodeHandle handle;
+        glm::ivec3 cell;
+        // bucket the item is linked into, or g_Oversized
+        uint32_t bucket;
+        uint32_t prev;
+        uint32_t next;
+    };
+
+    void Insert(const SceneNode* node);
+    // Bucket, or the oversized list, that bounds belong in, and the cell of its center
+    uint32_t Place(const AABB& bounds, glm::ivec3& outCell) const;
+    uint32_t GetBucket(const glm::ivec3& cell) const;
+    uint32_t& GetHead(uint32_t bucket);
+    void Link(uint32_t item);
+    void Unlink(uint32_t item);
+    // Grows the bucket table once the nodes outnumber it, relinking every item
+    void Rehash(size_t bucketCount);
+    // Calls visit(item) once for every item that may overlap region
+    template<typename Visitor>
+    void VisitRegion(const AABB& region, Visitor&& visit) const;
+    // Calls visit(item) for the items of the cells exactly ring cells from center
+    template<typename Visitor>
+    void VisitRing(const glm::ivec3& center, int ring, Visitor&& visit) const;
+    template<typename Visitor>
+    void VisitCell(const glm::ivec3& cell, Visitor&& visit) const;
+
+    float m_cellSize;
+    float m_invCellSize;
+    std::vector<Item> m_items;
+    // first item of each bucket
+    std::vector<uint32_t> m_buckets;
+    uint32_t m_oversizedHead;
+    size_t m_oversizedCount;
+    // item of each arena slot, by NodeHandle::index
+    std::vector<uint32_t> m_itemOfSlot;
+    // cells holding an item, grown as items move and reset by Build
+    glm::ivec3 m_cellMin;
+    glm::ivec3 m_cellMax;
+    size_t m_updates;
+    size_t m_relinks;
+};
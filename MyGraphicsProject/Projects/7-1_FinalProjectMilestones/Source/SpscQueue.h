@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Fixed-size ring buffer for handing values from exactly one producer thread to
+// exactly one consumer thread without a lock. Each side only writes its own index,
+// and publishes it with release ordering after the slot it covers is written.
+template <typename T, size_t Capacity>
+class SpscQueue {
+public:
+    SpscQueue() : m_head(0), m_tail(0) {}
+
+    // Producer side; false when the queue is full
+    bool Push(const T& value) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % (Capacity + 1);
+        if (next == m_head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        m_slots[tail] = value;
+        m_tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side; false when the queue is empty
+    bool Pop(T& outValue) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        outValue = m_slots[head];
+        m_head.store((head + 1) % (Capacity + 1), std::memory_order_release);
+        return true;
+    }
+
+private:
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // One slot is always left empty to tell a full queue from an empty one
+    T m_slots[Capacity + 1];
+    // Kept on separate cache lines so the two threads do not share one
+    alignas(64) std::atomic<size_t> m_head;
+    alignas(64) std::atomic<size_t> m_tail;
+};
@@ -0,0 +1,245 @@
+#include "StaticBatch.h"
+#include "SceneNode.h"
+#include "SceneManager.h"
+#include "ShaderManager.h"
+#include "ShapeMeshes.h"
+#include "Frustum.h"
+#include "OcclusionBuffer.h"
+
+#include <algorithm>
+
+namespace {
+    // Position, normal and uv, matching ShapeMeshes
+    const size_t g_FloatsPerVertex = 8;
+
+    const ShapeMeshes::MeshData* GetMeshData(const ShapeMeshes* meshes, SceneNode::MeshType type) {
+        switch (type) {
+        case SceneNode::MeshType::Box: return &meshes->GetBoxMeshData();
+        case SceneNode::MeshType::Sphere: return &meshes->GetSphereMeshData();
+        case SceneNode::MeshType::Cylinder: return &meshes->GetCylinderMeshData();
+        case SceneNode::MeshType::Plane: return &meshes->GetPlaneMeshData();
+        case SceneNode::MeshType::Pyramid: return &meshes->GetPyramid4MeshData();
+        default: return nullptr;
+        }
+    }
+}
+
+StaticBatch::StaticBatch() :
+    m_nodeCount(0), m_culledBatches(0) {}
+
+StaticBatch::~StaticBatch() {
+    Release();
+}
+
+void StaticBatch::AddSubtree(SceneNode* root, const ShapeMeshes* meshes) {
+    AddNode(root, meshes);
+    for (SceneNode* child : root->GetChildren()) {
+        AddSubtree(child, meshes);
+    }
+}
+
+void StaticBatch::AddNode(SceneNode* node, const ShapeMeshes* meshes) {
+    // Prefab instances and custom draws keep their own path
+    if (node->GetPrefab()) {
+        return;
+    }
+    const ShapeMeshes::MeshData* mesh = GetMeshData(meshes, node->GetMeshType());
+    if (!mesh || mesh->indices.empty()) {
+        return;
+    }
+
+    Batch& batch = FindBatch(node->GetMaterialTag(), node->GetTextureTag(), node->GetTextureSlot());
+    GLuint baseVertex = static_cast<GLuint>(batch.vertices.size() / g_FloatsPerVertex);
+    const glm::mat4& world = node->GetWorldMatrix();
+    const glm::mat3& normalMatrix = node->GetNormalMatrix();
+
+    for (size_t i = 0; i + g_FloatsPerVertex <= mesh->vertices.size(); i += g_FloatsPerVertex) {
+        const GLfloat* v = &mesh->vertices[i];
+        glm::vec3 position = glm::vec3(world * glm::vec4(v[0], v[1], v[2], 1.0f));
+        batch.bounds.Expand(position);
+        glm::vec3 normal = normalMatrix * glm::vec3(v[3], v[4], v[5]);
+        float length = glm::length(normal);
+        if (length > 0.0f) {
+            normal /= length;
+        }
+        GLfloat baked[g_FloatsPerVertex] = {
+            position.x, position.y, position.z,
+            normal.x, normal.y, normal.z,
+            v[6], v[7]
+        };
+        batch.vertices.insert(batch.vertices.end(), baked, baked + g_FloatsPerVertex);
+    }
+
+    NodeRange range;
+    range.node = node;
+    range.firstIndex = static_cast<GLuint>(batch.indices.size());
+    range.indexCount = static_cast<GLuint>(mesh->indices.size());
+    range.highlighted = node->IsHighlighted();
+    range.detached = false;
+    for (GLuint index : mesh->indices) {
+        batch.indices.push_back(baseVertex + index);
+    }
+    RangeRef ref;
+    ref.batch = static_cast<uint32_t>(&batch - m_batches.data());
+    ref.range = static_cast<uint32_t>(batch.nodes.size());
+    batch.nodes.push_back(range);
+    m_rangeOfNode[node] = ref;
+    // Ranges are appended in order, so the skipped list stays sorted
+    if (range.highlighted) {
+        batch.skipped.push_back(ref.range);
+    }
+
+    node->SetBaked(true);
+    ++m_nodeCount;
+}
+
+StaticBatch::Batch& StaticBatch::FindBatch(const std::string& materialTag, const std::string& textureTag, int textureSlot) {
+    for (Batch& batch : m_batches) {
+        if (batch.materialTag == materialTag && batch.textureTag == textureTag && batch.textureSlot == textureSlot) {
+            return batch;
+        }
+    }
+
+    Batch batch;
+    batch.materialTag = materialTag;
+    batch.textureTag = textureTag;
+    batch.textureSlot = textureSlot;
+    batch.visible = true;
+    batch.vao = 0;
+    batch.vbos[0] = batch.vbos[1] = 0;
+    batch.indexCount = 0;
+    m_batches.push_back(batch);
+    return m_batches.back();
+}
+
+void StaticBatch::Upload() {
+    GLsizei stride = static_cast<GLsizei>(sizeof(GLfloat) * g_FloatsPerVertex);
+    for (Batch& batch : m_batches) {
+        if (batch.vao != 0) {
+            continue;
+        }
+
+        glGenVertexArrays(1, &batch.vao);
+        glBindVertexArray(batch.vao);
+        glGenBuffers(2, batch.vbos);
+        glBindBuffer(GL_ARRAY_BUFFER, batch.vbos[0]);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * batch.vertices.size(), batch.vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch.vbos[1]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * batch.indices.size(), batch.indices.data(), GL_STATIC_DRAW);
+
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * 3));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * 6));
+        glEnableVertexAttribArray(2);
+        glBindVertexArray(0);
+
+        batch.indexCount = static_cast<GLsizei>(batch.indices.size());
+        std::vector<GLfloat>().swap(batch.vertices);
+        std::vector<GLuint>().swap(batch.indices);
+    }
+}
+
+void StaticBatch::Release() {
+    for (Batch& batch : m_batches) {
+        if (batch.vao != 0) {
+            glDeleteBuffers(2, batch.vbos);
+            glDeleteVertexArrays(1, &batch.vao);
+        }
+        for (const NodeRange& range : batch.nodes) {
+            if (!range.detached) {
+                range.node->SetBaked(false);
+            }
+        }
+    }
+    m_batches.clear();
+    m_rangeOfNode.clear();
+    m_nodeCount = 0;
+    m_culledBatches = 0;
+}
+
+void StaticBatch::SetHighlighted(const SceneNode* node, bool highlighted) {
+    std::unordered_map<const SceneNode*, RangeRef>::const_iterator found = m_rangeOfNode.find(node);
+    if (found == m_rangeOfNode.end()) {
+        return;
+    }
+    m_batches[found->second.batch].nodes[found->second.range].highlighted = highlighted;
+    UpdateSkipped(found->second);
+}
+
+void StaticBatch::Detach(const SceneNode* node) {
+    std::unordered_map<const SceneNode*, RangeRef>::iterator found = m_rangeOfNode.find(node);
+    if (found == m_rangeOfNode.end()) {
+        return;
+    }
+    m_batches[found->second.batch].nodes[found->second.range].detached = true;
+    UpdateSkipped(found->second);
+    m_rangeOfNode.erase(found);
+    --m_nodeCount;
+}
+
+void StaticBatch::UpdateSkipped(const RangeRef& ref) {
+    Batch& batch = m_batches[ref.batch];
+    const NodeRange& range = batch.nodes[ref.range];
+    bool skip = range.highlighted || range.detached;
+    std::vector<uint32_t>::iterator at = std::lower_bound(batch.skipped.begin(), batch.skipped.end(), ref.range);
+    bool listed = at != batch.skipped.end() && *at == ref.range;
+    if (skip && !listed) {
+        batch.skipped.insert(at, ref.range);
+    }
+    else if (!skip && listed) {
+        batch.skipped.erase(at);
+    }
+}
+
+void StaticBatch::Cull(const Frustum& frustum, const OcclusionBuffer* occlusion) {
+    m_culledBatches = 0;
+    for (Batch& batch : m_batches) {
+        batch.visible = frustum.Classify(batch.bounds) != Frustum::Containment::Outside &&
+            !(occlusion && occlusion->IsOccluded(batch.bounds));
+        if (!batch.visible) {
+            ++m_culledBatches;
+        }
+    }
+}
+
+void StaticBatch::ShowAll() {
+    for (Batch& batch : m_batches) {
+        batch.visible = true;
+    }
+    m_culledBatches = 0;
+}
+
+void StaticBatch::Render(SceneManager* sceneManager, ShaderManager* shaderManager) const {
+    if (m_batches.empty()) {
+        return;
+    }
+
+    // Vertices are already in world space
+    const SceneManager::SCENE_UNIFORMS& uniforms = sceneManager->GetUniforms();
+    shaderManager->setMat4Value(uniforms.model, glm::mat4(1.0f));
+    shaderManager->setMat3Value(uniforms.normalMatrix, glm::mat3(1.0f));
+    shaderManager->setBoolValue(uniforms.highlight, false);
+
+    for (const Batch& batch : m_batches) {
+        if (batch.vao == 0 || !batch.visible) {
+            continue;
+        }
+        sceneManager->SetShaderMaterial(batch.materialTag);
+        sceneManager->SetShaderTexture(batch.textureTag, batch.textureSlot);
+
+        sceneManager->GetStateCache().BindVertexArray(batch.vao);
+        GLuint runStart = 0;
+        for (uint32_t rangeIndex : batch.skipped) {
+            const NodeRange& range = batch.nodes[rangeIndex];
+            if (range.firstIndex > runStart) {
+                glDrawElements(GL_TRIANGLES, range.firstIndex - runStart, GL_UNSIGNED_INT, (void*)(sizeof(GLuint) * runStart));
+            }
+            runStart = range.firstIndex + range.indexCount;
+        }
+        if (static_cast<GLuint>(batch.indexCount) > runStart) {
+            glDrawElements(GL_TRIANGLES, batch.indexCount - runStart, GL_UNSIGNED_INT, (void*)(sizeof(GLuint) * runStart));
+        }
+    }
+}
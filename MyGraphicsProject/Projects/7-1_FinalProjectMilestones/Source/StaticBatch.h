@@ -0,0 +1,98 @@
+#pragma once
+
+#include "AABB.h"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class SceneNode;
+class SceneManager;
+class ShaderManager;
+class ShapeMeshes;
+class Frustum;
+class OcclusionBuffer;
+
+// Geometry of static subtrees, pre-transformed into world space and merged into one
+// vertex/index buffer per material and texture. The source nodes stay in the scene
+// graph for picking and are flagged as baked so they skip their own draw.
+//
+// A baked node that moves anyway is detached: its range is left out of the batch and
+// the node draws itself from then on, until the scene is baked again.
+class StaticBatch {
+public:
+    StaticBatch();
+    ~StaticBatch();
+
+    // Appends every mesh node under root; world matrices must already be up to date
+    void AddSubtree(SceneNode* root, const ShapeMeshes* meshes);
+    // Sends the merged buffers to the GPU and drops the CPU copies
+    void Upload();
+    // Deletes the GL buffers and un-bakes the nodes
+    void Release();
+
+    // Highlighted nodes draw themselves, so their ranges are left out of the batch
+    void SetHighlighted(const SceneNode* node, bool highlighted);
+    // Leaves a node that is no longer baked out of its batch for good; nodes that
+    // were never baked are ignored
+    void Detach(const SceneNode* node);
+    // Hides the batches whose bounds are outside the frustum or behind the occluders
+    void Cull(const Frustum& frustum, const OcclusionBuffer* occlusion);
+    void ShowAll();
+    // One draw per visible batch, split around the ranges drawn elsewhere
+    void Render(SceneManager* sceneManager, ShaderManager* shaderManager) const;
+
+    size_t GetBatchCount() const { return m_batches.size(); }
+    size_t GetNodeCount() const { return m_nodeCount; }
+    // Batches left out by the last Cull
+    size_t GetCulledBatchCount() const { return m_culledBatches; }
+
+private:
+    StaticBatch(const StaticBatch&) = delete;
+    StaticBatch& operator=(const StaticBatch&) = delete;
+
+    struct NodeRange {
+        SceneNode* node;
+        GLuint firstIndex;
+        GLuint indexCount;
+        bool highlighted;
+        bool detached;
+    };
+
+    struct Batch {
+        std::string materialTag;
+        std::string textureTag;
+        int textureSlot;
+        std::vector<GLfloat> vertices;
+        std::vector<GLuint> indices;
+        // Nodes in the order their indices were appended
+        std::vector<NodeRange> nodes;
+        // Indices into nodes of the highlighted or detached ones, kept sorted
+        std::vector<uint32_t> skipped;
+        // World box of every vertex in the batch
+        AABB bounds;
+        bool visible;
+        GLuint vao;
+        GLuint vbos[2];
+        GLsizei indexCount;
+    };
+
+    void AddNode(SceneNode* node, const ShapeMeshes* meshes);
+    Batch& FindBatch(const std::string& materialTag, const std::string& textureTag, int textureSlot);
+
+    struct RangeRef {
+        uint32_t batch;
+        uint32_t range;
+    };
+    // Lists or unlists a range as skipped to match its flags
+    void UpdateSkipped(const RangeRef& ref);
+
+    std::vector<Batch> m_batches;
+    // Where each baked node's indices are, for highlight changes
+    std::unordered_map<const SceneNode*, RangeRef> m_rangeOfNode;
+    size_t m_nodeCount;
+    size_t m_culledBatches;
+};
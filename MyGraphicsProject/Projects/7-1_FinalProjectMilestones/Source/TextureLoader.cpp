@@ -0,0 +1,64 @@
+#include "TextureLoader.h"
+#include "WorkerPool.h"
+#include "stb_image.h"
+
+#include <chrono>
+#include <thread>
+
+TextureLoader::TextureLoader(WorkerPool& pool) :
+    m_pool(pool), m_pending(0), m_running(0) {}
+
+TextureLoader::~TextureLoader() {
+    while (m_running.load(std::memory_order_acquire) > 0) {
+        std::this_thread::yield();
+    }
+    for (Image& image : m_decoded) {
+        FreeImage(image);
+    }
+}
+
+void TextureLoader::Load(int slot, const std::string& filename) {
+    m_pending.fetch_add(1, std::memory_order_acq_rel);
+    m_running.fetch_add(1, std::memory_order_acq_rel);
+    m_pool.Submit([this, slot, filename]() {
+        Decode(slot, filename);
+    });
+}
+
+void TextureLoader::Decode(int slot, const std::string& filename) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Image image;
+    image.slot = slot;
+    image.filename = filename;
+    image.width = 0;
+    image.height = 0;
+    image.channels = 0;
+    // The flip setting is per thread here; the global one would race between workers
+    stbi_set_flip_vertically_on_load_thread(1);
+    image.pixels = stbi_load(filename.c_str(), &image.width, &image.height, &image.channels, 0);
+    image.decodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_decoded.push_back(image);
+    }
+    m_running.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+bool TextureLoader::PollDecoded(Image& outImage) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_decoded.empty()) {
+        return false;
+    }
+    outImage = m_decoded.front();
+    m_decoded.pop_front();
+    m_pending.fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+}
+
+void TextureLoader::FreeImage(Image& image) {
+    if (image.pixels) {
+        stbi_image_free(image.pixels);
+        image.pixels = nullptr;
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+
+class WorkerPool;
+
+// Decodes image files on the worker threads, so the GL thread never waits on a
+// file. Decoded pixels queue up until the GL thread takes them for upload; the
+// loader itself never touches GL, so what a slot means is up to the caller.
+class TextureLoader {
+public:
+    struct Image {
+        // the caller's id for the texture, as given to Load
+        int slot;
+        std::string filename;
+        // nullptr when the file could not be read
+        unsigned char* pixels;
+        int width;
+        int height;
+        int channels;
+        // time spent decoding on the worker
+        double decodeMs;
+    };
+
+    explicit TextureLoader(WorkerPool& pool);
+    // Waits for the decodes still running and frees the images never taken
+    ~TextureLoader();
+
+    // Queues a file to be decoded, flipped so its first row is the bottom one as GL expects
+    void Load(int slot, const std::string& filename);
+    // Takes the next decoded image, in the order they finished; free its pixels with FreeImage
+    bool PollDecoded(Image& outImage);
+    static void FreeImage(Image& image);
+
+    // Loads queued and not yet taken by PollDecoded
+    size_t GetPendingCount() const { return m_pending.load(std::memory_order_acquire); }
+
+private:
+    TextureLoader(const TextureLoader&) = delete;
+    TextureLoader& operator=(const TextureLoader&) = delete;
+
+    void Decode(int slot, const std::string& filename);
+
+    WorkerPool& m_pool;
+    std::mutex m_mutex;
+    std::deque<Image> m_decoded;
+    std::atomic<size_t> m_pending;
+    // decodes queued or running on the pool
+    std::atomic<size_t> m_running;
+};
@@ -0,0 +1,160 @@
+#include "TransformHierarchy.h"
+#include "SceneNode.h"
+#include "WorkerPool.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace {
+    // Levels smaller than this are cheaper to finish inline than to hand out
+    const size_t g_LevelGrainSize = 2048;
+}
+
+TransformHierarchy::TransformHierarchy() :
+    m_anyDirty(false), m_valid(false) {}
+
+TransformHierarchy::~TransformHierarchy() {
+    Clear();
+}
+
+void TransformHierarchy::Build(SceneNode* root) {
+    Clear();
+    if (!root) {
+        return;
+    }
+
+    // Breadth-first walk: parents land before children and each depth level is contiguous
+    m_nodes.push_back(root);
+    m_parents.push_back(-1);
+    m_levelStarts.push_back(0);
+    size_t levelEnd = 1;
+    for (size_t head = 0; head < m_nodes.size(); ++head) {
+        if (head == levelEnd) {
+            m_levelStarts.push_back(head);
+            levelEnd = m_nodes.size();
+        }
+        for (SceneNode* child : m_nodes[head]->GetChildren()) {
+            m_nodes.push_back(child);
+            m_parents.push_back(static_cast<int>(head));
+        }
+    }
+    m_levelStarts.push_back(m_nodes.size());
+
+    size_t count = m_nodes.size();
+    m_positions.resize(count);
+    m_rotations.resize(count);
+    m_scales.resize(count);
+    m_localMatrices.resize(count);
+    m_worldMatrices.resize(count);
+    m_inverseWorldMatrices.resize(count);
+    m_normalMatrices.resize(count);
+    m_localDirty.assign(count, 1);
+    m_worldChanged.assign(count, 0);
+
+    for (size_t i = 0; i < count; ++i) {
+        m_positions[i] = m_nodes[i]->GetPosition();
+        m_rotations[i] = m_nodes[i]->GetRotation();
+        m_scales[i] = m_nodes[i]->GetScale();
+        m_nodes[i]->BindToHierarchy(this, static_cast<int>(i));
+    }
+
+    m_anyDirty = true;
+    m_valid = true;
+}
+
+void TransformHierarchy::Clear() {
+    for (size_t i = 0; i < m_nodes.size(); ++i) {
+        SceneNode* node = m_nodes[i];
+        if (!node) {
+            continue;
+        }
+        // Slots changed since the last pass still have their node flagged dirty,
+        // so the tree recomputes exactly those
+        node->m_localMatrix = m_localMatrices[i];
+        node->m_worldMatrix = m_worldMatrices[i];
+        node->m_inverseWorldMatrix = m_inverseWorldMatrices[i];
+        node->m_normalMatrix = m_normalMatrices[i];
+        node->BindToHierarchy(nullptr, -1);
+    }
+    m_nodes.clear();
+    m_parents.clear();
+    m_levelStarts.clear();
+    m_positions.clear();
+    m_rotations.clear();
+    m_scales.clear();
+    m_localMatrices.clear();
+    m_worldMatrices.clear();
+    m_inverseWorldMatrices.clear();
+    m_normalMatrices.clear();
+    m_localDirty.clear();
+    m_worldChanged.clear();
+    m_anyDirty = false;
+    m_valid = false;
+}
+
+void TransformHierarchy::SetLocalTransform(int index, const glm::vec3& position, const glm::vec3& rotation, const glm::vec3& scale) {
+    m_positions[index] = position;
+    m_rotations[index] = rotation;
+    m_scales[index] = scale;
+    m_localDirty[index] = 1;
+    m_anyDirty = true;
+}
+
+void TransformHierarchy::DetachNode(int index) {
+    m_nodes[index] = nullptr;
+    m_valid = false;
+}
+
+void TransformHierarchy::UpdateWorldTransforms(WorkerPool* pool) {
+    if (!m_anyDirty) {
+        return;
+    }
+
+    if (pool) {
+        // Every slot in a level only reads its parent from the level above
+        for (size_t level = 0; level < GetLevelCount(); ++level) {
+            size_t begin = m_levelStarts[level];
+            size_t count = m_levelStarts[level + 1] - begin;
+            if (count <= g_LevelGrainSize) {
+                UpdateRange(begin, begin + count);
+                continue;
+            }
+            pool->ParallelFor(count, g_LevelGrainSize, [this, begin](size_t first, size_t last) {
+                UpdateRange(begin + first, begin + last);
+            });
+        }
+    }
+    else {
+        UpdateRange(0, m_nodes.size());
+    }
+    m_anyDirty = false;
+}
+
+void TransformHierarchy::UpdateRange(size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        // Every slot is resolved by this pass, so the node tree has nothing pending
+        if (m_nodes[i]) {
+            m_nodes[i]->m_transformDirty = false;
+            m_nodes[i]->m_childTransformDirty = false;
+        }
+
+        int parent = m_parents[i];
+        bool changed = m_localDirty[i] || (parent >= 0 && m_worldChanged[parent]);
+        m_worldChanged[i] = changed;
+        if (!changed) {
+            continue;
+        }
+
+        if (m_localDirty[i]) {
+            glm::mat4 local = glm::translate(glm::mat4(1.0f), m_positions[i]);
+            local = glm::rotate(local, glm::radians(m_rotations[i].x), glm::vec3(1, 0, 0));
+            local = glm::rotate(local, glm::radians(m_rotations[i].y), glm::vec3(0, 1, 0));
+            local = glm::rotate(local, glm::radians(m_rotations[i].z), glm::vec3(0, 0, 1));
+            m_localMatrices[i] = glm::scale(local, m_scales[i]);
+            m_localDirty[i] = 0;
+        }
+
+        m_worldMatrices[i] = parent >= 0 ? m_worldMatrices[parent] * m_localMatrices[i] : m_localMatrices[i];
+        m_inverseWorldMatrices[i] = glm::inverse(m_worldMatrices[i]);
+        m_normalMatrices[i] = glm::mat3(glm::transpose(m_inverseWorldMatrices[i]));
+    }
+}
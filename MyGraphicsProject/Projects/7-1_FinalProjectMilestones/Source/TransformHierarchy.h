@@ -0,0 +1,63 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+class SceneNode;
+class WorkerPool;
+
+// Flattened storage for a SceneNode tree. Every array is indexed by the same node
+// index, and nodes are stored breadth-first so a parent always comes before its
+// children. World transforms are then resolved in one forward pass over the arrays.
+class TransformHierarchy {
+public:
+    TransformHierarchy();
+    ~TransformHierarchy();
+
+    // Flattens the tree under root and binds every node to its slot
+    void Build(SceneNode* root);
+    // Hands every node the matrices last resolved for it, unbinds it and releases
+    // the arrays, so the node tree carries on from where the flat pass left off
+    void Clear();
+
+    // Resolves local and world matrices for every slot touched since the last pass.
+    // With a pool, each depth level is split across the workers; levels run in order.
+    void UpdateWorldTransforms(WorkerPool* pool = nullptr);
+
+    void SetLocalTransform(int index, const glm::vec3& position, const glm::vec3& rotation, const glm::vec3& scale);
+    // Called when a bound node is destroyed or gains children, forcing a rebuild
+    void DetachNode(int index);
+    void Invalidate() { m_valid = false; }
+    bool IsValid() const { return m_valid; }
+
+    size_t GetNodeCount() const { return m_parents.size(); }
+    const glm::mat4& GetWorldMatrix(int index) const { return m_worldMatrices[index]; }
+    const glm::mat4& GetInverseWorldMatrix(int index) const { return m_inverseWorldMatrices[index]; }
+    const glm::mat3& GetNormalMatrix(int index) const { return m_normalMatrices[index]; }
+    size_t GetLevelCount() const { return m_levelStarts.empty() ? 0 : m_levelStarts.size() - 1; }
+
+private:
+    void UpdateRange(size_t begin, size_t end);
+
+    std::vector<SceneNode*> m_nodes;
+    std::vector<int> m_parents;
+    // depth level d occupies indices [m_levelStarts[d], m_levelStarts[d + 1])
+    std::vector<size_t> m_levelStarts;
+
+    std::vector<glm::vec3> m_positions;
+    std::vector<glm::vec3> m_rotations;
+    std::vector<glm::vec3> m_scales;
+
+    std::vector<glm::mat4> m_localMatrices;
+    std::vector<glm::mat4> m_worldMatrices;
+    std::vector<glm::mat4> m_inverseWorldMatrices;
+    std::vector<glm::mat3> m_normalMatrices;
+
+    // m_localDirty marks slots whose TRS changed; m_worldChanged records which
+    // slots were rewritten during the current pass so children can follow
+    std::vector<uint8_t> m_localDirty;
+    std::vector<uint8_t> m_worldChanged;
+    bool m_anyDirty;
+    bool m_valid;
+};
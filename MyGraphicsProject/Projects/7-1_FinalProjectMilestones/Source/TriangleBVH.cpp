@@ -0,0 +1,193 @@
+#include "TriangleBVH.h"
+#include "BinnedSah.h"
+#include "RayBoxKernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    const uint32_t g_MaxLeafSize = 4;
+    const int g_MaxDepth = 48;
+    // Hits closer than this are the ray leaving the surface it starts on
+    const float g_MinDistance = 1e-6f;
+
+    // Moller-Trumbore; culls neither side
+    bool IntersectTriangle(const Ray& ray, const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2,
+        float& outT, float& outU, float& outV) {
+        glm::vec3 edge1 = p1 - p0;
+        glm::vec3 edge2 = p2 - p0;
+        glm::vec3 p = glm::cross(ray.direction, edge2);
+        float determinant = glm::dot(edge1, p);
+        if (std::fabs(determinant) < 1e-12f) {
+            return false;
+        }
+        float invDeterminant = 1.0f / determinant;
+        glm::vec3 s = ray.origin - p0;
+        float u = glm::dot(s, p) * invDeterminant;
+        if (u < 0.0f || u > 1.0f) {
+            return false;
+        }
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = glm::dot(ray.direction, q) * invDeterminant;
+        if (v < 0.0f || u + v > 1.0f) {
+            return false;
+        }
+        outT = glm::dot(edge2, q) * invDeterminant;
+        outU = u;
+        outV = v;
+        return true;
+    }
+}
+
+void TriangleBVH::Build(const std::vector<float>& vertices, const std::vector<unsigned int>& indices, size_t floatsPerVertex) {
+    m_nodes.clear();
+    m_corners.clear();
+    m_triangleIds.clear();
+
+    size_t triangleCount = indices.size() / 3;
+    m_corners.reserve(triangleCount * 3);
+    m_triangleIds.reserve(triangleCount);
+    std::vector<glm::vec3> centers;
+    centers.reserve(triangleCount);
+    for (size_t triangle = 0; triangle < triangleCount; ++triangle) {
+        glm::vec3 corners[3];
+        for (int corner = 0; corner < 3; ++corner) {
+            const float* position = &vertices[indices[triangle * 3 + corner] * floatsPerVertex];
+            corners[corner] = glm::vec3(position[0], position[1], position[2]);
+        }
+        m_corners.insert(m_corners.end(), corners, corners + 3);
+        m_triangleIds.push_back(static_cast<uint32_t>(triangle));
+        centers.push_back((corners[0] + corners[1] + corners[2]) / 3.0f);
+    }
+    if (triangleCount == 0) {
+        return;
+    }
+
+    m_nodes.reserve(triangleCount * 2);
+    Node root;
+    root.first = 0;
+    root.count = static_cast<uint32_t>(triangleCount);
+    root.bounds = GetTriangleBounds(root.first, root.count);
+    m_nodes.push_back(root);
+    Subdivide(0, 1, centers);
+}
+
+AABB TriangleBVH::GetTriangleBounds(uint32_t first, uint32_t count) const {
+    AABB bounds;
+    for (size_t corner = first * 3; corner < (first + count) * 3; ++corner) {
+        bounds.Expand(m_corners[corner]);
+    }
+    return bounds;
+}
+
+void TriangleBVH::Subdivide(uint32_t nodeIndex, int depth, std::vector<glm::vec3>& centers) {
+    Node node = m_nodes[nodeIndex];
+    if (node.count <= g_MaxLeafSize || depth >= g_MaxDepth) {
+        return;
+    }
+
+    int bestAxis;
+    float bestPosition;
+    bool split = BinnedSah::FindSplit(node.bounds, centers.data(), node.first, node.count,
+        [this](uint32_t triangle) {
+            AABB bounds;
+            for (int corner = 0; corner < 3; ++corner) {
+                bounds.Expand(m_corners[triangle * 3 + corner]);
+            }
+            return bounds;
+        }, bestAxis, bestPosition);
+    if (!split) {
+        return;
+    }
+
+    // Partition the triangles, their corners and centers moving together
+    uint32_t left = node.first;
+    uint32_t right = node.first + node.count;
+    while (left < right) {
+        if (centers[left][bestAxis] < bestPosition) {
+            ++left;
+        }
+        else {
+            --right;
+            std::swap(centers[left], centers[right]);
+            std::swap(m_triangleIds[left], m_triangleIds[right]);
+            std::swap_ranges(m_corners.begin() + left * 3, m_corners.begin() + left * 3 + 3, m_corners.begin() + right * 3);
+        }
+    }
+    uint32_t leftCount = left - node.first;
+    if (leftCount == 0 || leftCount == node.count) {
+        return;
+    }
+
+    uint32_t childIndex = static_cast<uint32_t>(m_nodes.size());
+    Node leftChild;
+    leftChild.first = node.first;
+    leftChild.count = leftCount;
+    leftChild.bounds = GetTriangleBounds(leftChild.first, leftChild.count);
+    Node rightChild;
+    rightChild.first = left;
+    rightChild.count = node.count - leftCount;
+    rightChild.bounds = GetTriangleBounds(rightChild.first, rightChild.count);
+    m_nodes.push_back(leftChild);
+    m_nodes.push_back(rightChild);
+    m_nodes[nodeIndex].first = childIndex;
+    m_nodes[nodeIndex].count = 0;
+
+    Subdivide(childIndex, depth + 1, centers);
+    Subdivide(childIndex + 1, depth + 1, centers);
+}
+
+bool TriangleBVH::Raycast(const Ray& ray, float tLimit, Hit& hit) const {
+    float tRoot;
+    if (m_nodes.empty() || !RayBoxKernels::IntersectBox(ray, m_nodes[0].bounds, tLimit, tRoot)) {
+        return false;
+    }
+
+    // Nearer child first, so the closest hit so far can skip the farther one
+    float best = tLimit;
+    bool found = false;
+    struct Entry {
+        uint32_t node;
+        float tNear;
+    };
+    Entry stack[g_MaxDepth * 2];
+    int stackSize = 0;
+    stack[stackSize++] = { 0, tRoot };
+    while (stackSize > 0) {
+        Entry entry = stack[--stackSize];
+        if (entry.tNear > best) {
+            continue;
+        }
+        const Node& node = m_nodes[entry.node];
+        if (node.count > 0) {
+            for (uint32_t triangle = node.first; triangle < node.first + node.count; ++triangle) {
+                const glm::vec3* corners = &m_corners[triangle * 3];
+                float t, u, v;
+                if (IntersectTriangle(ray, corners[0], corners[1], corners[2], t, u, v) && t > g_MinDistance && t <= best) {
+                    best = t;
+                    hit.distance = t;
+                    hit.triangle = m_triangleIds[triangle];
+                    hit.barycentrics = glm::vec2(u, v);
+                    found = true;
+                }
+            }
+            continue;
+        }
+
+        float tLeft, tRight;
+        bool hitLeft = RayBoxKernels::IntersectBox(ray, m_nodes[node.first].bounds, best, tLeft);
+        bool hitRight = RayBoxKernels::IntersectBox(ray, m_nodes[node.first + 1].bounds, best, tRight);
+        if (hitLeft && hitRight) {
+            bool leftFirst = tLeft <= tRight;
+            stack[stackSize++] = leftFirst ? Entry{ node.first + 1, tRight } : Entry{ node.first, tLeft };
+            stack[stackSize++] = leftFirst ? Entry{ node.first, tLeft } : Entry{ node.first + 1, tRight };
+        }
+        else if (hitLeft) {
+            stack[stackSize++] = { node.first, tLeft };
+        }
+        else if (hitRight) {
+            stack[stackSize++] = { node.first + 1, tRight };
+        }
+    }
+    return found;
+}
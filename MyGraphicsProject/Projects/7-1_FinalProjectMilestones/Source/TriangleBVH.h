@@ -0,0 +1,55 @@
+#pragma once
+
+#include "AABB.h"
+#include "Ray.h"
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy over the triangles of one mesh, in the mesh's own space.
+// It is built once when the mesh is loaded and shared by every node drawing that
+// mesh; a ray is brought into mesh space before it is traced. Same flat layout and
+// binned SAH splits as SceneBVH, with the triangle corners copied into leaf order.
+class TriangleBVH {
+public:
+    struct Hit {
+        // along the ray, in the units of the ray that was traced
+        float distance;
+        // index of the triangle in the mesh's index list, i.e. first index / 3
+        uint32_t triangle;
+        // weights of the triangle's second and third corners; the first is 1 - u - v
+        glm::vec2 barycentrics;
+    };
+
+    // Reads an indexed triangle list whose vertices are floatsPerVertex apart,
+    // each starting with its position
+    void Build(const std::vector<float>& vertices, const std::vector<unsigned int>& indices, size_t floatsPerVertex);
+    bool IsEmpty() const { return m_nodes.empty(); }
+
+    // Nearest triangle hit in (0, tLimit]; both sides of a triangle count. Leaves hit
+    // untouched and returns false when there is none.
+    bool Raycast(const Ray& ray, float tLimit, Hit& hit) const;
+
+    size_t GetTriangleCount() const { return m_triangleIds.size(); }
+    size_t GetNodeCount() const { return m_nodes.size(); }
+    const AABB& GetBounds() const { return m_nodes.front().bounds; }
+
+private:
+    struct Node {
+        AABB bounds;
+        // first child for inner nodes, first triangle for leaves
+        uint32_t first;
+        // 0 for inner nodes
+        uint32_t count;
+    };
+
+    void Subdivide(uint32_t nodeIndex, int depth, std::vector<glm::vec3>& centers);
+    AABB GetTriangleBounds(uint32_t first, uint32_t count) const;
+
+    std::vector<Node> m_nodes;
+    // three corners per triangle, in leaf order
+    std::vector<glm::vec3> m_corners;
+    std::vector<uint32_t> m_triangleIds;
+};
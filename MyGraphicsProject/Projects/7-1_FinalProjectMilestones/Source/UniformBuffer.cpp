@@ -0,0 +1,67 @@
+#include "UniformBuffer.h"
+
+#include <cstring>
+
+UniformBuffer::UniformBuffer() :
+    m_buffer(0), m_binding(0), m_shadowValid(false), m_uploadCount(0) {}
+
+UniformBuffer::~UniformBuffer() {
+    Release();
+}
+
+void UniformBuffer::Create(GLuint binding, GLsizeiptr size) {
+    Release();
+    m_binding = binding;
+    m_shadow.assign(static_cast<size_t>(size), 0);
+
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, m_binding, m_buffer);
+}
+
+void UniformBuffer::Release() {
+    if (m_buffer != 0) {
+        glDeleteBuffers(1, &m_buffer);
+        m_buffer = 0;
+    }
+    m_shadow.clear();
+    m_shadowValid = false;
+}
+
+bool UniformBuffer::Update(const void* data, GLsizeiptr size) {
+    if (m_buffer == 0 || static_cast<size_t>(size) > m_shadow.size()) {
+        return false;
+    }
+    if (m_shadowValid && std::memcmp(m_shadow.data(), data, static_cast<size_t>(size)) == 0) {
+        return false;
+    }
+
+    std::memcpy(m_shadow.data(), data, static_cast<size_t>(size));
+    m_shadowValid = true;
+
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    ++m_uploadCount;
+    return true;
+}
+
+void UniformBuffer::BindProgramBlocks(GLuint program) {
+    const struct {
+        const char* name;
+        GLuint binding;
+    } blocks[] = {
+        { "FrameData", FrameBlockBinding },
+        { "MaterialData", MaterialBlockBinding },
+        { "LightData", LightBlockBinding }
+    };
+
+    for (const auto& block : blocks) {
+        GLuint index = glGetUniformBlockIndex(program, block.name);
+        if (index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(program, index, block.binding);
+        }
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Binding points of the uniform blocks shared by every scene program
+enum UniformBlockBinding : GLuint {
+    FrameBlockBinding = 0,
+    MaterialBlockBinding = 1,
+    LightBlockBinding = 2
+};
+
+const int g_MaxBlockMaterials = 64;
+const int g_MaxBlockPointLights = 16;
+
+// CPU mirrors of the std140 blocks declared in vertex.glsl, vertex_instanced.glsl
+// and fragment.glsl. Every member is a vec4, ivec4 or mat4, so the C++ layout
+// already matches std140 and the structs can be uploaded as they are.
+struct FrameBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 viewPosition;
+    // x: seconds since start
+    glm::vec4 frameTime;
+};
+
+struct MaterialBlockEntry {
+    // rgb: color, a: ambient strength
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    // rgb: color, a: shininess
+    glm::vec4 specular;
+};
+
+struct MaterialBlock {
+    MaterialBlockEntry materials[g_MaxBlockMaterials];
+};
+
+struct PointLightEntry {
+    // xyz: position
+    glm::vec4 position;
+    // rgb: color, a: linear attenuation
+    glm::vec4 diffuse;
+    // rgb: color, a: quadratic attenuation
+    glm::vec4 specular;
+    // intensity = x + y * sin(time * z + w)
+    glm::vec4 flicker;
+};
+
+struct LightBlock {
+    PointLightEntry pointLights[g_MaxBlockPointLights];
+    // xyz: direction towards the light
+    glm::vec4 directionalDirection;
+    glm::vec4 directionalDiffuse;
+    glm::vec4 directionalSpecular;
+    glm::vec4 ambient;
+    // x: point lights in use
+    glm::ivec4 counts;
+};
+
+static_assert(sizeof(FrameBlock) == 160, "FrameBlock must match the std140 layout of FrameData");
+static_assert(sizeof(MaterialBlock) == 48 * g_MaxBlockMaterials, "MaterialBlock must match the std140 layout of MaterialData");
+static_assert(sizeof(LightBlock) == 64 * g_MaxBlockPointLights + 80, "LightBlock must match the std140 layout of LightData");
+
+// A uniform buffer object attached to one binding point. It keeps a copy of what
+// was last uploaded, so writing the same contents again costs no GL call.
+class UniformBuffer {
+public:
+    UniformBuffer();
+    ~UniformBuffer();
+
+    void Create(GLuint binding, GLsizeiptr size);
+    void Release();
+
+    // Copies size bytes to the start of the buffer when they differ from the
+    // last upload; returns true when an upload was issued
+    bool Update(const void* data, GLsizeiptr size);
+
+    GLuint GetBinding() const { return m_binding; }
+    size_t GetUploadCount() const { return m_uploadCount; }
+
+    // Points a program's Frame, Material and Light blocks at the shared binding
+    // points; blocks the program does not declare are skipped
+    static void BindProgramBlocks(GLuint program);
+
+private:
+    GLuint m_buffer;
+    GLuint m_binding;
+    std::vector<unsigned char> m_shadow;
+    bool m_shadowValid;
+    size_t m_uploadCount;
+};
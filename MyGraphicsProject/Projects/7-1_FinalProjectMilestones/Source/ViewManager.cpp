@@ -20,8 +20,6 @@ namespace
 	// Variables for window width and height
 	const int WINDOW_WIDTH = 1000;
 	const int WINDOW_HEIGHT = 800;
-	const char* g_ViewName = "view";
-	const char* g_ProjectionName = "projection";
 
 	// camera object used for viewing and interacting with
 	// the 3D scene
@@ -52,6 +50,8 @@ ViewManager::ViewManager(
 	// initialize the member variables
 	m_pShaderManager = pShaderManager;
 	m_pWindow = NULL;
+	m_viewMatrix = glm::mat4(1.0f);
+	m_projectionMatrix = glm::mat4(1.0f);
 	g_pCamera = new Camera();
 	// default camera view parameters
 	g_pCamera->Position = glm::vec3(0.0f, 10.0f, 50.0f);
@@ -229,9 +229,6 @@ Camera* ViewManager::GetCamera()
  ***********************************************************/
 void ViewManager::PrepareSceneView()
 {
-	glm::mat4 view;
-	glm::mat4 projection;
-
 	// per-frame timing
 	float currentFrame = glfwGetTime();
 	gDeltaTime = currentFrame - gLastFrame;
@@ -242,26 +239,18 @@ void ViewManager::PrepareSceneView()
 	ProcessKeyboardEvents();
 
 	// get the current view matrix from the camera
-	view = g_pCamera->GetViewMatrix();
+	m_viewMatrix = g_pCamera->GetViewMatrix();
 
 	// define the current projection matrix
 	if (bOrthographicProjection) {
 		// Ortho projection
-		projection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, 0.1f, 100.0f);
+		m_projectionMatrix = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, 0.1f, 100.0f);
 	}
 	else {
 		// Perspective projection
-		projection = glm::perspective(glm::radians(g_pCamera->Zoom), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
+		m_projectionMatrix = glm::perspective(glm::radians(g_pCamera->Zoom), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
 	}
 
-	// if the shader manager object is valid
-	if (NULL != m_pShaderManager)
-	{
-		// set the view matrix into the shader for proper rendering
-		m_pShaderManager->setMat4Value(g_ViewName, view);
-		// set the view matrix into the shader for proper rendering
-		m_pShaderManager->setMat4Value(g_ProjectionName, projection);
-		// set the view position of the camera into the shader for proper rendering
-		m_pShaderManager->setVec3Value("viewPosition", g_pCamera->Position);
-	}
+	// the matrices reach the shaders through the scene's frame
+	// uniform block, see SceneManager::SetViewTransforms()
 }
\ No newline at end of file
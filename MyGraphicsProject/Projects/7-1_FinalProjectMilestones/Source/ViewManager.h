@@ -34,6 +34,9 @@ private:
 	ShaderManager* m_pShaderManager;
 	// active OpenGL display window
 	GLFWwindow* m_pWindow;
+	// camera matrices computed by the last PrepareSceneView()
+	glm::mat4 m_viewMatrix;
+	glm::mat4 m_projectionMatrix;
 
 	// process keyboard events for interaction with the 3D scene
 	void ProcessKeyboardEvents();
@@ -46,4 +49,6 @@ public:
 
 	// prepare the conversion from 3D object display to 2D scene display
 	void PrepareSceneView();
+	const glm::mat4& GetViewMatrix() const { return m_viewMatrix; }
+	const glm::mat4& GetProjectionMatrix() const { return m_projectionMatrix; }
 };
\ No newline at end of file
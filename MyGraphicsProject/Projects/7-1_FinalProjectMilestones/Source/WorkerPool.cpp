@@ -0,0 +1,100 @@
+#include "WorkerPool.h"
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+WorkerPool::WorkerPool(unsigned threadCount) :
+    m_stopping(false) {
+    if (threadCount == 0) {
+        unsigned hardware = std::thread::hardware_concurrency();
+        threadCount = hardware > 1 ? hardware - 1 : 1;
+    }
+    for (unsigned i = 0; i < threadCount; ++i) {
+        m_threads.emplace_back(&WorkerPool::WorkerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (std::thread& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::Submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_wake.notify_one();
+}
+
+void WorkerPool::WorkerLoop() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+            if (m_stopping && m_tasks.empty()) {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void WorkerPool::ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& body) {
+    if (count == 0) {
+        return;
+    }
+    grainSize = std::max<size_t>(grainSize, 1);
+    size_t chunkCount = (count + grainSize - 1) / grainSize;
+    if (chunkCount == 1 || m_threads.empty()) {
+        body(0, count);
+        return;
+    }
+
+    // Shared between the caller and any helpers; a helper that wakes up after the
+    // last chunk was claimed finds nothing left and never touches body
+    struct Job {
+        std::atomic<size_t> nextChunk;
+        std::atomic<size_t> doneChunks;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->nextChunk = 0;
+    job->doneChunks = 0;
+    const std::function<void(size_t, size_t)>* work = &body;
+
+    auto drain = [job, work, count, grainSize, chunkCount]() {
+        for (;;) {
+            size_t chunk = job->nextChunk.fetch_add(1);
+            if (chunk >= chunkCount) {
+                return;
+            }
+            size_t begin = chunk * grainSize;
+            (*work)(begin, std::min(begin + grainSize, count));
+            if (job->doneChunks.fetch_add(1) + 1 == chunkCount) {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                job->finished.notify_all();
+            }
+        }
+    };
+
+    size_t helpers = std::min<size_t>(m_threads.size(), chunkCount - 1);
+    for (size_t i = 0; i < helpers; ++i) {
+        Submit(drain);
+    }
+    drain();
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->finished.wait(lock, [&job, chunkCount] { return job->doneChunks.load() == chunkCount; });
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstddef>
+
+// Fixed set of worker threads shared by the scene's parallel passes.
+// Submit() queues fire-and-forget tasks; ParallelFor() splits an index range into
+// chunks that the workers and the calling thread pull until the range is done.
+class WorkerPool {
+public:
+    // threadCount of 0 uses one worker per hardware thread, minus the caller
+    explicit WorkerPool(unsigned threadCount = 0);
+    ~WorkerPool();
+
+    void Submit(std::function<void()> task);
+    // Runs body(begin, end) over [0, count) in chunks of grainSize and blocks until done
+    void ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& body);
+
+    unsigned GetThreadCount() const { return static_cast<unsigned>(m_threads.size()); }
+
+private:
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void WorkerLoop();
+
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stopping;
+};
@@ -3,6 +3,9 @@
 in vec2 TexCoords;
 in vec3 FragPos;
 in vec3 Normal;
+flat in int TextureIndex;
+flat in int MaterialIndex;
+flat in int Highlight;
 
 out vec4 FragTexture;
 
@@ -23,129 +26,144 @@ uniform sampler2D shrineRoofTexture;
 uniform sampler2D shrineWallTexture;
 uniform sampler2D kanjiTexture;
 
-uniform int object;
 uniform vec4 objectColor;
 uniform bool useTexture;
-uniform vec3 viewPos; 
-uniform float time;
-uniform bool uHighlight;
+
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition;
+    vec4 frameTime;     // x: seconds since start
+};
+
+const int MAX_MATERIALS = 64;
+const int MAX_POINT_LIGHTS = 16;
+
+struct Material
+{
+    vec4 ambient;       // rgb: color, a: ambient strength
+    vec4 diffuse;
+    vec4 specular;      // rgb: color, a: shininess
+};
+
+layout(std140) uniform MaterialData
+{
+    Material materials[MAX_MATERIALS];
+};
+
+struct PointLight
+{
+    vec4 position;
+    vec4 diffuse;       // rgb: color, a: linear attenuation
+    vec4 specular;      // rgb: color, a: quadratic attenuation
+    vec4 flicker;       // intensity = x + y * sin(time * z + w)
+};
+
+layout(std140) uniform LightData
+{
+    PointLight pointLights[MAX_POINT_LIGHTS];
+    vec4 directionalDirection;
+    vec4 directionalDiffuse;
+    vec4 directionalSpecular;
+    vec4 ambientLight;
+    ivec4 lightCounts;  // x: point lights in use
+};
 
 void main()
 {
     vec4 finalTexture;
 
     if (useTexture) {
-        if (object == 0) {
+        if (TextureIndex == 0) {
             finalTexture = texture(floorTexture, TexCoords);
         } 
-        else if (object == 1) {
+        else if (TextureIndex == 1) {
             vec4 stoneColor = texture(stoneTexture, TexCoords);
             vec4 crackColor = texture(crackTexture, TexCoords);
             finalTexture = mix(stoneColor, crackColor, 0.05);
         } 
-        else if (object == 2) {
+        else if (TextureIndex == 2) {
             finalTexture = texture(lanternSupportTexture, TexCoords);
         } 
-        else if (object == 3) {
+        else if (TextureIndex == 3) {
             finalTexture = texture(lampBaseTexture, TexCoords);
         } 
-        else if (object == 4) {
+        else if (TextureIndex == 4) {
             finalTexture = texture(lampFlameTexture, TexCoords);
             vec3 emissive = vec3(1.0, 0.8, 0.4);
             finalTexture.rgb += emissive * 1.5;
         } 
-        else if (object == 5) {
+        else if (TextureIndex == 5) {
             finalTexture = texture(grassTexture, TexCoords);
         } 
-        else if (object == 6) {
+        else if (TextureIndex == 6) {
             finalTexture = texture(plankTexture, TexCoords);
         }
-        else if (object == 7) {
+        else if (TextureIndex == 7) {
             finalTexture = texture(supportTexture, TexCoords);
         }
-        else if (object == 8) {
+        else if (TextureIndex == 8) {
             finalTexture = texture(groundSupportTexture, TexCoords);
         }
-        else if (object == 9) {
+        else if (TextureIndex == 9) {
             finalTexture = texture(dirtTexture, TexCoords);
         }
-        else if (object == 10){
+        else if (TextureIndex == 10){
             finalTexture = texture(toriiTexture, TexCoords);
         }
-        else if (object == 11){
+        else if (TextureIndex == 11){
             finalTexture = texture(toriiRoofTexture, TexCoords);
         }
-        else if (object == 12){
+        else if (TextureIndex == 12){
             finalTexture = texture(shrineRoofTexture, TexCoords);
         }
-        else if (object == 13){
+        else if (TextureIndex == 13){
             finalTexture = texture(shrineWallTexture, TexCoords);
         }
-        else if (object == 14){
+        else if (TextureIndex == 14){
             finalTexture = texture(kanjiTexture, TexCoords);
         }
     } else {
         finalTexture = objectColor;
     }
 
-    if (uHighlight) {
+    if (Highlight != 0) {
         finalTexture = vec4(1.0);  // full white, ignore texture
     }
 
-    vec3 ambient = vec3(0.2, 0.1, 0.2) * finalTexture.rgb;
-
-    vec3 pointLightPos[8];
-    pointLightPos[0] = vec3(0.0, 6.0, 0.0);
-    pointLightPos[1] = vec3(0.0, 6.0, 12.0);
-    pointLightPos[2] = vec3(0.0, 6.0, 24.0);
-    pointLightPos[3] = vec3(0.0, 6.0, 36.0);
-    pointLightPos[4] = vec3(18.0, 6.0, 0.0);
-    pointLightPos[5] = vec3(18.0, 6.0, 36.0);
-    pointLightPos[6] = vec3(18.75, 4.80, 15.5);
-    pointLightPos[7] = vec3(18.75, 4.80, 20.5);
-
-    vec3 pointLightDiffuse = vec3(1.0, 0.6, 0.3);
-    vec3 pointLightSpecular = vec3(1.0, 0.9, 0.5);
-
-    float flicker[8];
-    flicker[0] = 0.5 + 0.3 * sin(time * 3.0);
-    flicker[1] = 0.5 + 0.3 * sin(time * 3.0 + 1.0);
-    flicker[2] = 0.5 + 0.3 * sin(time * 3.0 + 2.0);
-    flicker[3] = 0.5 + 0.3 * sin(time * 3.0 + 3.0);
-    flicker[4] = 0.5 + 0.3 * sin(time * 3.0);
-    flicker[5] = 0.5 + 0.3 * sin(time * 3.0 + 3.0);
-    flicker[6] = 1.0;
-    flicker[7] = 1.0;
+    float shininess = materials[MaterialIndex].specular.a;
+
+    vec3 ambient = ambientLight.rgb * finalTexture.rgb;
 
     vec3 norm = normalize(Normal);
-    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 viewDir = normalize(viewPosition.xyz - FragPos);
     vec3 lighting = ambient;
 
-    vec3 dirLightDir = normalize(vec3(1.0, -0.5, -1.0));
-    vec3 dirLightDiffuse = vec3(0.8, 0.4, 0.3);
-    vec3 dirLightSpecular = vec3(1.0, 1.0, 1.0);
+    vec3 dirLightDir = directionalDirection.xyz;
 
     float dirDiff = max(dot(norm, dirLightDir), 0.0);
-    vec3 dirDiffuse = dirDiff * dirLightDiffuse * finalTexture.rgb;
+    vec3 dirDiffuse = dirDiff * directionalDiffuse.rgb * finalTexture.rgb;
     
     vec3 dirReflectDir = reflect(-dirLightDir, norm);
-    float dirSpec = pow(max(dot(viewDir, dirReflectDir), 0.0), 16.0);
-    vec3 dirSpecular = dirLightSpecular * dirSpec * finalTexture.rgb;
+    float dirSpec = pow(max(dot(viewDir, dirReflectDir), 0.0), shininess);
+    vec3 dirSpecular = directionalSpecular.rgb * dirSpec * finalTexture.rgb;
 
-    for (int i = 0; i < 8; i++) {
-        vec3 lightPos = pointLightPos[i];
-        float flickerAmount = flicker[i];
+    for (int i = 0; i < lightCounts.x; i++) {
+        PointLight light = pointLights[i];
+        vec3 lightPos = light.position.xyz;
+        float flickerAmount = light.flicker.x + light.flicker.y * sin(frameTime.x * light.flicker.z + light.flicker.w);
 
         vec3 lightDir = normalize(lightPos - FragPos);
         float diff = max(dot(norm, lightDir), 0.0);
-        vec3 diffuse = diff * pointLightDiffuse * flickerAmount * finalTexture.rgb;
+        vec3 diffuse = diff * light.diffuse.rgb * flickerAmount * finalTexture.rgb;
 
         vec3 reflectDir = reflect(-lightDir, norm);
-        float spec = pow(max(dot(viewDir, reflectDir), 0.0), 16.0);
-        vec3 specular = pointLightSpecular * spec * flickerAmount * finalTexture.rgb;
+        float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+        vec3 specular = light.specular.rgb * spec * flickerAmount * finalTexture.rgb;
 
         float distance = length(lightPos - FragPos);
-        float attenuation = 1.0 / (1.0 + 0.1 * distance + 0.05 * (distance * distance));
+        float attenuation = 1.0 / (1.0 + light.diffuse.a * distance + light.specular.a * (distance * distance));
 
         lighting += (diffuse + specular) * attenuation;
     }
@@ -7,19 +7,36 @@ layout(location = 2) in vec2 aTexCoords;
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+flat out int TextureIndex;
+flat out int MaterialIndex;
+flat out int Highlight;
+
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition;
+    vec4 frameTime;     // x: seconds since start
+};
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform mat3 normalMatrix;
+uniform int object;
+uniform int materialIndex;
+uniform bool uHighlight;
 
 void main()
 {
     FragPos = vec3(model * vec4(aPos, 1.0));
 
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    Normal = normalMatrix * aNormal;
 
     TexCoords = aTexCoords;
 
+    TextureIndex = object;
+    MaterialIndex = materialIndex;
+    Highlight = uHighlight ? 1 : 0;
+
     gl_Position = projection * view * vec4(FragPos, 1.0);
 
 }
\ No newline at end of file
@@ -0,0 +1,41 @@
+#version 330 core
+
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+// per-instance attributes: model matrix, normal matrix and
+// (texture selector, material index, highlight, unused)
+layout(location = 3) in mat4 aModel;
+layout(location = 7) in mat3 aNormalMatrix;
+layout(location = 10) in ivec4 aInstanceState;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+flat out int TextureIndex;
+flat out int MaterialIndex;
+flat out int Highlight;
+
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition;
+    vec4 frameTime;     // x: seconds since start
+};
+
+void main()
+{
+    FragPos = vec3(aModel * vec4(aPos, 1.0));
+
+    Normal = aNormalMatrix * aNormal;
+
+    TexCoords = aTexCoords;
+
+    TextureIndex = aInstanceState.x;
+    MaterialIndex = aInstanceState.y;
+    Highlight = aInstanceState.z;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+
+}
\ No newline at end of file
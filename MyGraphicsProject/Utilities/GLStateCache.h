@@ -0,0 +1,194 @@
+///////////////////////////////////////////////////////////////////////////////
+// glstatecache.h
+// ============
+// track the bound OpenGL state and drop calls that would not change it
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GL/glew.h>        // GLEW library
+
+/***********************************************************
+ *  GLStateCache
+ *
+ *  The render code sets the current program, vertex array,
+ *  texture bindings and blend, depth and cull state through
+ *  this object. A call asking for the state that is already
+ *  set is dropped instead of reaching the driver. Code that
+ *  changes any of this state with direct GL calls must call
+ *  Invalidate() before the cache is used again.
+ ***********************************************************/
+class GLStateCache
+{
+public:
+	static const int MAX_TEXTURE_UNITS = 32;
+
+	// calls passed on to GL and calls dropped as no-ops
+	struct STATS
+	{
+		unsigned long long issued;
+		unsigned long long filtered;
+	};
+
+	GLStateCache()
+	{
+		Invalidate();
+		ResetCounters();
+	}
+
+	// forget the tracked state so that the next call of each
+	// kind is always issued
+	// ------------------------------------------------------------------------
+	void Invalidate()
+	{
+		m_program = UNKNOWN_NAME;
+		m_vertexArray = UNKNOWN_NAME;
+		m_activeUnit = UNKNOWN_NAME;
+		for (int i = 0; i < MAX_TEXTURE_UNITS; i++)
+		{
+			m_textures[i] = UNKNOWN_NAME;
+		}
+		m_blendSrc = UNKNOWN_NAME;
+		m_blendDst = UNKNOWN_NAME;
+		m_blend = UNKNOWN_FLAG;
+		m_depthTest = UNKNOWN_FLAG;
+		m_cullFace = UNKNOWN_FLAG;
+	}
+
+	// ------------------------------------------------------------------------
+	inline void UseProgram(GLuint program)
+	{
+		if (program == m_program)
+		{
+			m_stats.filtered++;
+			return;
+		}
+		glUseProgram(program);
+		m_program = program;
+		m_stats.issued++;
+	}
+
+	// ------------------------------------------------------------------------
+	inline void BindVertexArray(GLuint vertexArray)
+	{
+		if (vertexArray == m_vertexArray)
+		{
+			m_stats.filtered++;
+			return;
+		}
+		glBindVertexArray(vertexArray);
+		m_vertexArray = vertexArray;
+		m_stats.issued++;
+	}
+
+	// ------------------------------------------------------------------------
+	inline void ActiveTexture(int unit)
+	{
+		if ((GLuint)unit == m_activeUnit)
+		{
+			m_stats.filtered++;
+			return;
+		}
+		glActiveTexture(GL_TEXTURE0 + unit);
+		m_activeUnit = unit;
+		m_stats.issued++;
+	}
+
+	// bind a 2D texture to a texture unit; the active unit is
+	// only switched when the binding actually changes
+	// ------------------------------------------------------------------------
+	inline void BindTexture2D(int unit, GLuint texture)
+	{
+		if (unit < 0 || unit >= MAX_TEXTURE_UNITS)
+		{
+			return;
+		}
+		if (texture == m_textures[unit])
+		{
+			m_stats.filtered++;
+			return;
+		}
+		ActiveTexture(unit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		m_textures[unit] = texture;
+		m_stats.issued++;
+	}
+
+	// ------------------------------------------------------------------------
+	inline void SetBlend(bool bEnable)
+	{
+		SetCapability(GL_BLEND, bEnable, m_blend);
+	}
+
+	inline void SetBlendFunc(GLenum src, GLenum dst)
+	{
+		if (src == m_blendSrc && dst == m_blendDst)
+		{
+			m_stats.filtered++;
+			return;
+		}
+		glBlendFunc(src, dst);
+		m_blendSrc = src;
+		m_blendDst = dst;
+		m_stats.issued++;
+	}
+
+	// ------------------------------------------------------------------------
+	inline void SetDepthTest(bool bEnable)
+	{
+		SetCapability(GL_DEPTH_TEST, bEnable, m_depthTest);
+	}
+
+	// ------------------------------------------------------------------------
+	inline void SetCullFace(bool bEnable)
+	{
+		SetCapability(GL_CULL_FACE, bEnable, m_cullFace);
+	}
+
+	// ------------------------------------------------------------------------
+	GLuint GetProgram() const { return m_program; }
+	GLuint GetVertexArray() const { return m_vertexArray; }
+	const STATS& GetStats() const { return m_stats; }
+	void ResetCounters()
+	{
+		m_stats.issued = 0;
+		m_stats.filtered = 0;
+	}
+
+private:
+	static const GLuint UNKNOWN_NAME = 0xFFFFFFFF;
+	static const int UNKNOWN_FLAG = -1;
+
+	inline void SetCapability(GLenum capability, bool bEnable, int& current)
+	{
+		if (current == (int)bEnable)
+		{
+			m_stats.filtered++;
+			return;
+		}
+		if (bEnable == true)
+		{
+			glEnable(capability);
+		}
+		else
+		{
+			glDisable(capability);
+		}
+		current = (int)bEnable;
+		m_stats.issued++;
+	}
+
+	GLuint m_program;
+	GLuint m_vertexArray;
+	GLuint m_activeUnit;
+	GLuint m_textures[MAX_TEXTURE_UNITS];
+	GLenum m_blendSrc;
+	GLenum m_blendDst;
+	// -1 until first set, then 0 or 1
+	int m_blend;
+	int m_depthTest;
+	int m_cullFace;
+
+	STATS m_stats;
+};
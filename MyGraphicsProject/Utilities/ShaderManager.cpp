@@ -113,7 +113,82 @@ GLuint ShaderManager::LoadShaders(const char * vertex_file_path,const char * fra
 	glDeleteShader(VertexShaderID);
 	glDeleteShader(FragmentShaderID);
 
+	ReflectUniforms(ProgramID);
+
 	return ProgramID;
 }
 
+/***********************************************************
+ *  ReflectUniforms()
+ *
+ *  This method is called to list the active uniforms of a
+ *  linked program and resolve each location once, so later
+ *  uploads need no glGetUniformLocation() call.
+ ***********************************************************/
+void ShaderManager::ReflectUniforms(GLuint programID)
+{
+	std::unordered_map<std::string, int>& names = m_programUniforms[programID];
+	names.clear();
+
+	GLint uniformCount = 0;
+	GLint maxNameLength = 0;
+	glGetProgramiv(programID, GL_ACTIVE_UNIFORMS, &uniformCount);
+	glGetProgramiv(programID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+	std::vector<char> nameBuffer(maxNameLength + 1);
+	for (GLint i = 0; i < uniformCount; i++)
+	{
+		GLsizei nameLength = 0;
+		GLint arraySize = 0;
+		GLenum type = GL_NONE;
+		glGetActiveUniform(programID, i, (GLsizei)nameBuffer.size(), &nameLength, &arraySize, &type, &nameBuffer[0]);
+
+		// arrays are reported as "name[0]"; look them up by the bare name
+		std::string name(&nameBuffer[0], nameLength);
+		if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+		{
+			name.erase(name.size() - 3);
+		}
+
+		// members of uniform blocks have no location of their own
+		GLint location = glGetUniformLocation(programID, name.c_str());
+		if (location < 0)
+		{
+			continue;
+		}
+
+		UniformInfo uniform;
+		uniform.programID = programID;
+		uniform.location = location;
+		uniform.type = type;
+		uniform.name = name;
+		uniform.bShadowValid = false;
+
+		names[name] = (int)m_uniforms.size();
+		m_uniforms.push_back(uniform);
+	}
+}
+
+/***********************************************************
+ *  GetUniformHandle()
+ *
+ *  This method is called to find an active uniform of a
+ *  loaded program by name.
+ ***********************************************************/
+ShaderManager::UniformHandle ShaderManager::GetUniformHandle(GLuint programID, const std::string& name) const
+{
+	UniformHandle handle;
+
+	std::unordered_map<GLuint, std::unordered_map<std::string, int>>::const_iterator program = m_programUniforms.find(programID);
+	if (program != m_programUniforms.end())
+	{
+		std::unordered_map<std::string, int>::const_iterator uniform = program->second.find(name);
+		if (uniform != program->second.end())
+		{
+			handle.index = uniform->second;
+		}
+	}
+	return(handle);
+}
+
 
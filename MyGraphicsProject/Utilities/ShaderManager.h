@@ -10,12 +10,21 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <cstring>
 
 class ShaderManager
 {
 public:
-	unsigned int m_programID;
-	
+	// an active uniform of a loaded program, resolved once when the
+	// program is linked; invalid when the program has no such uniform
+	struct UniformHandle
+	{
+		int index = -1;
+		bool IsValid() const { return index >= 0; }
+	};
+
 	GLuint LoadShaders(
 		const char* vertex_file_path, 
 		const char* fragment_file_path);
@@ -27,77 +36,238 @@ public:
 		glUseProgram(m_programID);
 	}
 
-	// utility uniform functions
+	// make a loaded program the current one for use() and the
+	// name-based setters; binding it is left to the caller, so a
+	// state cache in front of glUseProgram stays in step
+	// ------------------------------------------------------------------------
+	inline void SetCurrentProgram(GLuint programID)
+	{
+		m_programID = programID;
+	}
+
+	// look up an active uniform of a program loaded by LoadShaders()
+	// ------------------------------------------------------------------------
+	UniformHandle GetUniformHandle(GLuint programID, const std::string& name) const;
+
+	inline GLint GetUniformLocation(UniformHandle handle) const
+	{
+		return handle.IsValid() ? m_uniforms[handle.index].location : -1;
+	}
+	inline GLenum GetUniformType(UniformHandle handle) const
+	{
+		return handle.IsValid() ? m_uniforms[handle.index].type : GL_NONE;
+	}
+
+	// uploads sent and skipped as unchanged since the last reset
+	// ------------------------------------------------------------------------
+	unsigned long long GetUniformUploadCount() const { return m_uniformUploads; }
+	unsigned long long GetSkippedUniformUploadCount() const { return m_skippedUniformUploads; }
+	void ResetUniformCounters() { m_uniformUploads = 0; m_skippedUniformUploads = 0; }
+
+	// handle uniform functions; the handle's program must be the one
+	// in use, and a value equal to the last one sent is not uploaded
+	// ------------------------------------------------------------------------
+	inline void setBoolValue(UniformHandle handle, bool value)
+	{
+		setIntValue(handle, (int)value);
+	}
+
+	// ------------------------------------------------------------------------
+	inline void setIntValue(UniformHandle handle, int value)
+	{
+		if (UpdateShadow(handle, &value, sizeof(value)))
+		{
+			glUniform1i(m_uniforms[handle.index].location, value);
+		}
+	}
+
+	// ------------------------------------------------------------------------
+	inline void setFloatValue(UniformHandle handle, float value)
+	{
+		if (UpdateShadow(handle, &value, sizeof(value)))
+		{
+			glUniform1f(m_uniforms[handle.index].location, value);
+		}
+	}
+
 	// ------------------------------------------------------------------------
-	inline void setBoolValue(const std::string &name, bool value) const
+	inline void setVec2Value(UniformHandle handle, const glm::vec2 &value)
 	{
-		glUniform1i(glGetUniformLocation(m_programID, name.c_str()), (int)value);
+		if (UpdateShadow(handle, &value[0], sizeof(value)))
+		{
+			glUniform2fv(m_uniforms[handle.index].location, 1, &value[0]);
+		}
 	}
 
 	// ------------------------------------------------------------------------
-	inline void setIntValue(const std::string &name, int value) const
+	inline void setVec3Value(UniformHandle handle, const glm::vec3 &value)
 	{
-		glUniform1i(glGetUniformLocation(m_programID, name.c_str()), value);
+		if (UpdateShadow(handle, &value[0], sizeof(value)))
+		{
+			glUniform3fv(m_uniforms[handle.index].location, 1, &value[0]);
+		}
 	}
 
 	// ------------------------------------------------------------------------
-	inline void setFloatValue(const std::string &name, float value) const
+	inline void setVec4Value(UniformHandle handle, const glm::vec4 &value)
 	{
-		glUniform1f(glGetUniformLocation(m_programID, name.c_str()), value);
+		if (UpdateShadow(handle, &value[0], sizeof(value)))
+		{
+			glUniform4fv(m_uniforms[handle.index].location, 1, &value[0]);
+		}
 	}
 
 	// ------------------------------------------------------------------------
-	inline void setVec2Value(const std::string &name, const glm::vec2 &value) const
+	inline void setMat2Value(UniformHandle handle, const glm::mat2 &mat)
 	{
-		glUniform2fv(glGetUniformLocation(m_programID, name.c_str()), 1, &value[0]);
+		if (UpdateShadow(handle, &mat[0][0], sizeof(mat)))
+		{
+			glUniformMatrix2fv(m_uniforms[handle.index].location, 1, GL_FALSE, &mat[0][0]);
+		}
 	}
 
-	inline void setVec2Value(const std::string &name, float x, float y) const
+	// ------------------------------------------------------------------------
+	inline void setMat3Value(UniformHandle handle, const glm::mat3 &mat)
 	{
-		glUniform2f(glGetUniformLocation(m_programID, name.c_str()), x, y);
+		if (UpdateShadow(handle, &mat[0][0], sizeof(mat)))
+		{
+			glUniformMatrix3fv(m_uniforms[handle.index].location, 1, GL_FALSE, &mat[0][0]);
+		}
 	}
 
 	// ------------------------------------------------------------------------
-	inline void setVec3Value(const std::string &name, const glm::vec3 &value) const
+	inline void setMat4Value(UniformHandle handle, const glm::mat4 &mat)
 	{
-		glUniform3fv(glGetUniformLocation(m_programID, name.c_str()), 1, &value[0]);
+		if (UpdateShadow(handle, &mat[0][0], sizeof(mat)))
+		{
+			glUniformMatrix4fv(m_uniforms[handle.index].location, 1, GL_FALSE, glm::value_ptr(mat));
+		}
 	}
-	inline void setVec3Value(const std::string &name, float x, float y, float z) const
+
+	// ------------------------------------------------------------------------
+	inline void setSampler2DValue(UniformHandle handle, const int &value)
 	{
-		glUniform3f(glGetUniformLocation(m_programID, name.c_str()), x, y, z);
+		setIntValue(handle, value);
 	}
 
+	// utility uniform functions, looking the name up in the current
+	// program's uniforms
 	// ------------------------------------------------------------------------
-	inline void setVec4Value(const std::string &name, const glm::vec4 &value) const
+	inline void setBoolValue(const std::string &name, bool value)
 	{
-		glUniform4fv(glGetUniformLocation(m_programID, name.c_str()), 1, &value[0]);
+		setBoolValue(GetUniformHandle(m_programID, name), value);
+	}
+
+	// ------------------------------------------------------------------------
+	inline void setIntValue(const std::string &name, int value)
+	{
+		setIntValue(GetUniformHandle(m_programID, name), value);
+	}
+
+	// ------------------------------------------------------------------------
+	inline void setFloatValue(const std::string &name, float value)
+	{
+		setFloatValue(GetUniformHandle(m_programID, name), value);
+	}
+
+	// ------------------------------------------------------------------------
+	inline void setVec2Value(const std::string &name, const glm::vec2 &value)
+	{
+		setVec2Value(GetUniformHandle(m_programID, name), value);
+	}
+
+	inline void setVec2Value(const std::string &name, float x, float y)
+	{
+		setVec2Value(GetUniformHandle(m_programID, name), glm::vec2(x, y));
+	}
+
+	// ------------------------------------------------------------------------
+	inline void setVec3Value(const std::string &name, const glm::vec3 &value)
+	{
+		setVec3Value(GetUniformHandle(m_programID, name), value);
+	}
+	inline void setVec3Value(const std::string &name, float x, float y, float z)
+	{
+		setVec3Value(GetUniformHandle(m_programID, name), glm::vec3(x, y, z));
+	}
+
+	// ------------------------------------------------------------------------
+	inline void setVec4Value(const std::string &name, const glm::vec4 &value)
+	{
+		setVec4Value(GetUniformHandle(m_programID, name), value);
 	}
 	inline void setVec4Value(const std::string &name, float x, float y, float z, float w)
 	{
-		glUniform4f(glGetUniformLocation(m_programID, name.c_str()), x, y, z, w);
+		setVec4Value(GetUniformHandle(m_programID, name), glm::vec4(x, y, z, w));
 	}
 
 	// ------------------------------------------------------------------------
-	inline void setMat2Value(const std::string &name, const glm::mat2 &mat) const
+	inline void setMat2Value(const std::string &name, const glm::mat2 &mat)
 	{
-		glUniformMatrix2fv(glGetUniformLocation(m_programID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		setMat2Value(GetUniformHandle(m_programID, name), mat);
 	}
 
 	// ------------------------------------------------------------------------
-	inline void setMat3Value(const std::string &name, const glm::mat3 &mat) const
+	inline void setMat3Value(const std::string &name, const glm::mat3 &mat)
 	{
-		glUniformMatrix3fv(glGetUniformLocation(m_programID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		setMat3Value(GetUniformHandle(m_programID, name), mat);
 	}
 
 	// ------------------------------------------------------------------------
-	inline void setMat4Value(const std::string &name, const glm::mat4 &mat) const
+	inline void setMat4Value(const std::string &name, const glm::mat4 &mat)
 	{
-		glUniformMatrix4fv(glGetUniformLocation(m_programID, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat));
+		setMat4Value(GetUniformHandle(m_programID, name), mat);
 	}
 
 	// ------------------------------------------------------------------------
-	inline void setSampler2DValue(const std::string& name, const int &value) const
+	inline void setSampler2DValue(const std::string& name, const int &value)
 	{
-		glUniform1i(glGetUniformLocation(m_programID, name.c_str()), value);
+		setSampler2DValue(GetUniformHandle(m_programID, name), value);
 	}
+
+private:
+	// an active uniform found by reflecting a linked program
+	struct UniformInfo
+	{
+		GLuint programID;
+		GLint location;
+		GLenum type;
+		std::string name;
+		// copy of the last value uploaded, large enough for a mat4
+		unsigned char shadow[sizeof(glm::mat4)];
+		bool bShadowValid;
+	};
+
+	// build the uniform table of a freshly linked program
+	void ReflectUniforms(GLuint programID);
+
+	// compare a value with the last one sent through the handle and
+	// record it; returns true when it differs and must be uploaded
+	inline bool UpdateShadow(UniformHandle handle, const void* value, size_t bytes)
+	{
+		if (handle.IsValid() == false)
+		{
+			return(false);
+		}
+
+		UniformInfo& uniform = m_uniforms[handle.index];
+		if (uniform.bShadowValid == true && memcmp(uniform.shadow, value, bytes) == 0)
+		{
+			m_skippedUniformUploads++;
+			return(false);
+		}
+		memcpy(uniform.shadow, value, bytes);
+		uniform.bShadowValid = true;
+		m_uniformUploads++;
+		return(true);
+	}
+
+	// program of use() and the name-based setters, the last one
+	// loaded unless changed through SetCurrentProgram()
+	GLuint m_programID = 0;
+	std::vector<UniformInfo> m_uniforms;
+	// uniform index by name, for each loaded program
+	std::unordered_map<GLuint, std::unordered_map<std::string, int>> m_programUniforms;
+	unsigned long long m_uniformUploads = 0;
+	unsigned long long m_skippedUniformUploads = 0;
 };
\ No newline at end of file